@@ -347,10 +347,12 @@
 #define __NR_fanotify_mark	339
 #define __NR_prlimit64		340
 #define __NR_clock_adjtime	341
+#define __NR_process_vm_readv	342
+#define __NR_process_vm_writev	343
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 342
+#define NR_syscalls 344
 
 #define __ARCH_WANT_IPC_PARSE_VERSION
 #define __ARCH_WANT_OLD_READDIR
@@ -671,6 +671,10 @@ __SYSCALL(__NR_fanotify_mark, sys_fanotify_mark)
 __SYSCALL(__NR_prlimit64, sys_prlimit64)
 #define __NR_clock_adjtime			303
 __SYSCALL(__NR_clock_adjtime, sys_clock_adjtime)
+#define __NR_process_vm_readv			304
+__SYSCALL(__NR_process_vm_readv, sys_process_vm_readv)
+#define __NR_process_vm_writev			305
+__SYSCALL(__NR_process_vm_writev, sys_process_vm_writev)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
@@ -6,6 +6,8 @@
 #include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/cpu.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
 
 #include <asm/tlbflush.h>
 #include <asm/mmu_context.h>
@@ -41,7 +43,8 @@ DEFINE_PER_CPU_SHARED_ALIGNED(struct tlb_state, cpu_tlbstate)
 union smp_flush_state {
 	struct {
 		struct mm_struct *flush_mm;
-		unsigned long flush_va;
+		unsigned long flush_start;
+		unsigned long flush_end;
 		raw_spinlock_t tlbstate_lock;
 		DECLARE_BITMAP(flush_cpumask, NR_CPUS);
 	};
@@ -111,7 +114,8 @@ EXPORT_SYMBOL_GPL(leave_mm);
 /*
  * TLB flush IPI:
  *
- * 1) Flush the tlb entries if the cpu uses the mm that's being flushed.
+ * 1) Flush the tlb entries if the cpu uses the mm that's being flushed,
+ *    or whatever mm it uses if none is given.
  * 2) Leave the mm if we are in the lazy tlb mode.
  *
  * Interrupts are disabled.
@@ -152,12 +156,17 @@ void smp_invalidate_interrupt(struct pt_regs *regs)
 		 * BUG();
 		 */
 
-	if (f->flush_mm == percpu_read(cpu_tlbstate.active_mm)) {
+	if (!f->flush_mm || f->flush_mm == percpu_read(cpu_tlbstate.active_mm)) {
 		if (percpu_read(cpu_tlbstate.state) == TLBSTATE_OK) {
-			if (f->flush_va == TLB_FLUSH_ALL)
+			if (f->flush_end == TLB_FLUSH_ALL)
 				local_flush_tlb();
-			else
-				__flush_tlb_one(f->flush_va);
+			else {
+				unsigned long addr;
+
+				for (addr = f->flush_start; addr < f->flush_end;
+				     addr += PAGE_SIZE)
+					__flush_tlb_one(addr);
+			}
 		} else
 			leave_mm(cpu);
 	}
@@ -170,7 +179,8 @@ out:
 }
 
 static void flush_tlb_others_ipi(const struct cpumask *cpumask,
-				 struct mm_struct *mm, unsigned long va)
+				 struct mm_struct *mm, unsigned long start,
+				 unsigned long end)
 {
 	unsigned int sender;
 	union smp_flush_state *f;
@@ -187,7 +197,8 @@ static void flush_tlb_others_ipi(const struct cpumask *cpumask,
 	raw_spin_lock(&f->tlbstate_lock);
 
 	f->flush_mm = mm;
-	f->flush_va = va;
+	f->flush_start = start;
+	f->flush_end = end;
 	if (cpumask_andnot(to_cpumask(f->flush_cpumask), cpumask, cpumask_of(smp_processor_id()))) {
 		/*
 		 * We have to send the IPI only to
@@ -201,24 +212,30 @@ static void flush_tlb_others_ipi(const struct cpumask *cpumask,
 	}
 
 	f->flush_mm = NULL;
-	f->flush_va = 0;
+	f->flush_start = 0;
+	f->flush_end = 0;
 	raw_spin_unlock(&f->tlbstate_lock);
 }
 
 void native_flush_tlb_others(const struct cpumask *cpumask,
-			     struct mm_struct *mm, unsigned long va)
+			     struct mm_struct *mm, unsigned long start,
+			     unsigned long end)
 {
 	if (is_uv_system()) {
+		unsigned long va = TLB_FLUSH_ALL;
 		unsigned int cpu;
 
+		/* The BAU flushes either one page or everything */
+		if (end != TLB_FLUSH_ALL && end - start <= PAGE_SIZE)
+			va = start;
 		cpu = get_cpu();
 		cpumask = uv_flush_tlb_others(cpumask, mm, va, cpu);
 		if (cpumask)
-			flush_tlb_others_ipi(cpumask, mm, va);
+			flush_tlb_others_ipi(cpumask, mm, start, end);
 		put_cpu();
 		return;
 	}
-	flush_tlb_others_ipi(cpumask, mm, va);
+	flush_tlb_others_ipi(cpumask, mm, start, end);
 }
 
 static void __cpuinit calculate_tlb_offset(void)
@@ -284,7 +301,7 @@ void flush_tlb_current_task(void)
 
 	local_flush_tlb();
 	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
-		flush_tlb_others(mm_cpumask(mm), mm, TLB_FLUSH_ALL);
+		flush_tlb_others(mm_cpumask(mm), mm, 0UL, TLB_FLUSH_ALL);
 	preempt_enable();
 }
 
@@ -299,7 +316,42 @@ void flush_tlb_mm(struct mm_struct *mm)
 			leave_mm(smp_processor_id());
 	}
 	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
-		flush_tlb_others(mm_cpumask(mm), mm, TLB_FLUSH_ALL);
+		flush_tlb_others(mm_cpumask(mm), mm, 0UL, TLB_FLUSH_ALL);
+
+	preempt_enable();
+}
+
+/*
+ * Flushing page by page beats dropping the whole TLB, and refilling it
+ * afterwards, only up to a point: above this many pages a range flush
+ * falls back to flushing the whole mm.
+ */
+unsigned long tlb_single_page_flush_ceiling __read_mostly = 33;
+
+void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
+			unsigned long end, unsigned long vmflag)
+{
+	unsigned long addr;
+
+	/* Huge pages would be flushed many times over, page by page */
+	if ((vmflag & VM_HUGETLB) || end == TLB_FLUSH_ALL ||
+	    (end - start) >> PAGE_SHIFT > tlb_single_page_flush_ceiling) {
+		flush_tlb_mm(mm);
+		return;
+	}
+
+	preempt_disable();
+
+	if (current->active_mm == mm) {
+		if (current->mm) {
+			for (addr = start; addr < end; addr += PAGE_SIZE)
+				__flush_tlb_one(addr);
+		} else
+			leave_mm(smp_processor_id());
+	}
+
+	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
+		flush_tlb_others(mm_cpumask(mm), mm, start, end);
 
 	preempt_enable();
 }
@@ -318,11 +370,28 @@ void flush_tlb_page(struct vm_area_struct *vma, unsigned long va)
 	}
 
 	if (cpumask_any_but(mm_cpumask(mm), smp_processor_id()) < nr_cpu_ids)
-		flush_tlb_others(mm_cpumask(mm), mm, va);
+		flush_tlb_others(mm_cpumask(mm), mm, va, va + PAGE_SIZE);
 
 	preempt_enable();
 }
 
+/*
+ * Flush the whole TLB of every CPU in @cpumask, whichever mm it is in:
+ * this completes the unmapping of pages from many mms at once, as done
+ * by reclaim, with one IPI per CPU.
+ */
+void flush_tlb_batched(const struct cpumask *cpumask)
+{
+	int cpu = get_cpu();
+
+	if (cpumask_test_cpu(cpu, cpumask))
+		local_flush_tlb();
+	if (cpumask_any_but(cpumask, cpu) < nr_cpu_ids)
+		flush_tlb_others(cpumask, NULL, 0UL, TLB_FLUSH_ALL);
+
+	put_cpu();
+}
+
 static void do_flush_tlb_all(void *info)
 {
 	__flush_tlb_all();
@@ -334,3 +403,47 @@ void flush_tlb_all(void)
 {
 	on_each_cpu(do_flush_tlb_all, NULL, 1);
 }
+
+static ssize_t tlbflush_read_file(struct file *file, char __user *user_buf,
+				  size_t count, loff_t *ppos)
+{
+	char buf[32];
+	unsigned int len;
+
+	len = sprintf(buf, "%lu\n", tlb_single_page_flush_ceiling);
+	return simple_read_from_buffer(user_buf, count, ppos, buf, len);
+}
+
+static ssize_t tlbflush_write_file(struct file *file,
+				   const char __user *user_buf,
+				   size_t count, loff_t *ppos)
+{
+	char buf[32];
+	ssize_t len;
+	unsigned long ceiling;
+
+	len = min(count, sizeof(buf) - 1);
+	if (copy_from_user(buf, user_buf, len))
+		return -EFAULT;
+
+	buf[len] = '\0';
+	if (strict_strtoul(buf, 0, &ceiling))
+		return -EINVAL;
+
+	tlb_single_page_flush_ceiling = ceiling;
+	return count;
+}
+
+static const struct file_operations fops_tlbflush = {
+	.read = tlbflush_read_file,
+	.write = tlbflush_write_file,
+	.llseek = default_llseek,
+};
+
+static int __init create_tlb_single_page_flush_ceiling(void)
+{
+	debugfs_create_file("tlb_single_page_flush_ceiling", S_IRUSR | S_IWUSR,
+			    arch_debugfs_dir, NULL, &fops_tlbflush);
+	return 0;
+}
+late_initcall(create_tlb_single_page_flush_ceiling);
@@ -24,10 +24,14 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/bit_spinlock.h>
 
 #include "zram_drv.h"
 
@@ -38,15 +42,7 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
+static struct kmem_cache *zram_entry_cache;
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
@@ -67,6 +63,21 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+/*
+ * Table entries are protected by a bit spinlock in their flags word, so
+ * that I/O to different pages runs in parallel and swap slot free
+ * notifications, which come in atomic context, can take it too.
+ */
+void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -85,21 +96,40 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Zero filled pages are the common case, but pages filled with any one
+ * repeated word are just as cheap to detect and need no storage at all.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned long element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	if (!element) {
+		memset(ptr, 0, PAGE_SIZE);
+		return;
+	}
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -129,75 +159,429 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*-- Stored objects and dedup */
+
+static struct zram_entry *zram_entry_alloc(struct zram *zram, u32 len,
+					gfp_t flags)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry;
+	u32 offset = 0;
+
+	entry = kmem_cache_alloc(zram_entry_cache, flags & ~__GFP_HIGHMEM);
+	if (!entry)
+		return NULL;
+
+	if (len == PAGE_SIZE) {
+		entry->page = alloc_page(flags);
+		if (!entry->page)
+			goto free_entry;
+	} else if (xv_malloc(zram->mem_pool, len, &entry->page, &offset,
+				flags)) {
+		goto free_entry;
+	}
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->offset = offset;
+	entry->len = len;
+	entry->checksum = 0;
+	entry->refcount = 1;
+	return entry;
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+free_entry:
+	kmem_cache_free(zram_entry_cache, entry);
+	return NULL;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	if (entry->len == PAGE_SIZE)
+		__free_page(entry->page);
+	else
+		xv_free(zram->mem_pool, entry->page, entry->offset);
+	kmem_cache_free(zram_entry_cache, entry);
+}
+
+static struct zram_hash *zram_entry_hash(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum % zram->hash_size];
+}
+
+/*
+ * Objects are compared in their stored form.  LZO output is a function
+ * of its input only, so two pages are identical if and only if their
+ * compressed forms are, and we avoid decompressing the candidate.
+ */
+static int zram_entry_match(struct zram_entry *entry, void *mem, u32 len)
+{
+	unsigned char *cmem;
+	int match;
+
+	if (entry->len != len)
+		return 0;
+
+	cmem = kmap_atomic(entry->page, KM_USER1);
+	match = !memcmp(cmem + entry->offset, mem, len);
+	kunmap_atomic(cmem, KM_USER1);
+
+	return match;
+}
+
+/*
+ * Look for an object identical to @mem and take a reference on it.
+ * Colliding checksums are rare enough that we only look at the first
+ * entry with a matching checksum.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram, void *mem,
+					u32 len, u32 checksum)
+{
+	struct zram_hash *hash = zram_entry_hash(zram, checksum);
+	struct rb_node *rb_node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		struct zram_entry *e;
+
+		e = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum < e->checksum) {
+			rb_node = rb_node->rb_left;
+		} else if (checksum > e->checksum) {
+			rb_node = rb_node->rb_right;
+		} else {
+			if (zram_entry_match(e, mem, len)) {
+				e->refcount++;
+				entry = e;
+			}
+			break;
 		}
+	}
+	spin_unlock(&hash->lock);
+
+	return entry;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum)
+{
+	struct zram_hash *hash = zram_entry_hash(zram, checksum);
+	struct rb_node **rb_node, *parent = NULL;
+
+	entry->checksum = checksum;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		struct zram_entry *e;
+
+		parent = *rb_node;
+		e = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < e->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Drop a table slot's reference on @entry, freeing the object with the
+ * last one.
+ */
+static void zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash = NULL;
+	unsigned long refcount;
+
+	if (!RB_EMPTY_NODE(&entry->rb_node)) {
+		hash = zram_entry_hash(zram, entry->checksum);
+		spin_lock(&hash->lock);
+	}
+	refcount = --entry->refcount;
+	if (!refcount && hash)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	if (hash)
+		spin_unlock(&hash->lock);
+
+	if (refcount) {
+		atomic_dec(&zram->stats.pages_dedup);
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+	if (entry->len == PAGE_SIZE)
+		atomic_dec(&zram->stats.pages_expand);
+	else if (entry->len <= PAGE_SIZE / 2)
+		atomic_dec(&zram->stats.good_compress);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+
+	zram_entry_free(zram, entry);
+}
+
+/*-- Backing device */
+
+/* Block 0 is never handed out, so a valid blk_idx is never zero */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_blocks, blk_idx);
+	if (blk_idx >= zram->nr_blocks)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk_idx)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk_idx, zram->bitmap));
+	atomic_dec(&zram->stats.bd_count);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Synchronously read or write one page of the backing device.  Must not
+ * be called from our own make_request function: bios submitted from
+ * there are only dispatched once it returns.
+ */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk_idx, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	if (!ret)
+		zram_stat64_inc(zram, rw == READ ? &zram->stats.bd_reads :
+						&zram->stats.bd_writes);
+	return ret;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+
+	zw->ret = zram_bdev_rw(zw->zram, zw->page, zw->blk_idx, READ);
+}
+
+/* Punt the read to a worker, see zram_bdev_rw() */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk_idx)
+{
+	struct zram_work zw;
+
+	zw.zram = zram;
+	zw.page = page;
+	zw.blk_idx = blk_idx;
+
+	INIT_WORK_ONSTACK(&zw.work, zram_sync_read);
+	schedule_work(&zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	return zw.ret;
+}
+
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	close_bdev_exclusive(zram->bdev, FMODE_READ | FMODE_WRITE);
+	zram->bdev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+}
+
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_blocks;
+	unsigned long *bitmap;
+	char *name;
+	int ret = 0;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	strim(name);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		ret = -EBUSY;
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	bdev = open_bdev_exclusive(name, FMODE_READ | FMODE_WRITE, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out;
+	}
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+		ret = -ENOMEM;
+		goto out;
+	}
 
+	zram_reset_bdev(zram);
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	zram->backing_dev = name;
+	name = NULL;
+	pr_info("setup backing device %s\n", zram->backing_dev);
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
-
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	mutex_unlock(&zram->init_lock);
+	kfree(name);
+	return ret;
 }
 
-static void handle_zero_page(struct page *page)
+/*-- Table slots */
+
+/* Called with the slot locked */
+static void zram_free_page(struct zram *zram, size_t index)
 {
-	void *user_mem;
+	struct table *slot = &zram->table[index];
 
-	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	flush_dcache_page(page);
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, slot->blk_idx);
+		slot->blk_idx = 0;
+		return;
+	}
+
+	/*
+	 * No memory is allocated for same element filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (!slot->element)
+			atomic_dec(&zram->stats.pages_zero);
+		atomic_dec(&zram->stats.pages_same);
+		slot->element = 0;
+		return;
+	}
+
+	if (!slot->entry)
+		return;
+
+	zram_entry_put(zram, slot->entry);
+	atomic_dec(&zram->stats.pages_stored);
+	slot->entry = NULL;
 }
 
-static void handle_uncompressed_page(struct zram *zram,
-				struct page *page, u32 index)
+/* Called with the slot locked */
+static int zram_read_entry(struct zram *zram, struct zram_entry *entry,
+			struct page *page, u32 index)
 {
 	unsigned char *user_mem, *cmem;
+	size_t clen = PAGE_SIZE;
+	int ret = LZO_E_OK;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(entry->page, KM_USER1) + entry->offset;
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(entry->len == PAGE_SIZE))
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = lzo1x_decompress_safe(cmem, entry->len,
+					user_mem, &clen);
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret != LZO_E_OK)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
+
+	return 0;
+}
 
+static int zram_bvec_read(struct zram *zram, struct page *page, u32 index)
+{
+	struct table *slot = &zram->table[index];
+	void *user_mem;
+	int ret = 0;
+
+	zram_slot_lock(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk_idx = slot->blk_idx;
+
+		zram_slot_unlock(zram, index);
+		ret = zram_read_from_bdev(zram, page, blk_idx);
+		goto out;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME) || !slot->entry) {
+		/* Read before write leaves zeros, like any other disk */
+		user_mem = kmap_atomic(page, KM_USER0);
+		zram_fill_page(user_mem, slot->element);
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_slot_unlock(zram, index);
+		goto out;
+	}
+
+	ret = zram_read_entry(zram, slot->entry, page, index);
+	zram_slot_unlock(zram, index);
+
+out:
 	flush_dcache_page(page);
+	return ret;
 }
 
 static int zram_read(struct zram *zram, struct bio *bio)
@@ -217,66 +601,152 @@ static int zram_read(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+		if (zram_bvec_read(zram, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
 
-		page = bvec->bv_page;
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return 0;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			continue;
-		}
+out:
+	bio_io_error(bio);
+	return 0;
+}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			/* Do nothing */
-			continue;
-		}
+static int zram_bvec_write(struct zram *zram, struct page *page, u32 index)
+{
+	struct zram_entry *entry = NULL;
+	struct zram_stream *zstrm;
+	unsigned long element;
+	unsigned char *user_mem, *cmem;
+	size_t clen;
+	u32 checksum = 0;
+	int dedup = 0;
+	int ret;
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		zram_slot_unlock(zram, index);
+		if (!element)
+			atomic_inc(&zram->stats.pages_zero);
+		atomic_inc(&zram->stats.pages_same);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		user_mem = kmap_atomic(page, KM_USER0);
+compress_again:
+	/*
+	 * Each CPU has its own compression buffers, so writes from
+	 * different CPUs compress in parallel.  We must not sleep until
+	 * the compressed data has been copied out of the stream.
+	 */
+	zstrm = get_cpu_ptr(zram->streams);
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, zstrm->buffer, &clen,
+				zstrm->workmem);
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (ret == LZO_E_OK && unlikely(clen > max_zpage_size)) {
 		clen = PAGE_SIZE;
+		memcpy(zstrm->buffer, user_mem, PAGE_SIZE);
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	if (unlikely(ret != LZO_E_OK)) {
+		put_cpu_ptr(zram->streams);
+		pr_err("Compression failed! err=%d\n", ret);
+		ret = -EIO;
+		goto out;
+	}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	if (entry && entry->len != clen) {
+		/* Page changed since the previous pass, start over */
+		zram_entry_free(zram, entry);
+		entry = NULL;
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	if (zram->use_dedup) {
+		checksum = jhash(zstrm->buffer, clen, 0);
+		if (!entry) {
+			entry = zram_dedup_find(zram, zstrm->buffer, clen,
+						checksum);
+			if (entry) {
+				put_cpu_ptr(zram->streams);
+				dedup = 1;
+				goto found;
+			}
+		}
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
+	if (!entry) {
+		entry = zram_entry_alloc(zram, clen, GFP_NOWAIT | __GFP_NOWARN |
+					__GFP_HIGHMEM);
+		if (!entry) {
+			/*
+			 * Out of atomic memory: allocate with the stream
+			 * released, then compress the page again, which is
+			 * cheaper than keeping a copy of the output around.
+			 */
+			put_cpu_ptr(zram->streams);
+			entry = zram_entry_alloc(zram, clen,
+						GFP_NOIO | __GFP_HIGHMEM);
+			if (!entry) {
+				pr_info("Error allocating memory for compressed "
+					"page: %u, size=%zu\n", index, clen);
+				ret = -ENOMEM;
+				goto out;
+			}
+			goto compress_again;
 		}
+	}
 
-		flush_dcache_page(page);
-		index++;
+	cmem = kmap_atomic(entry->page, KM_USER1) + entry->offset;
+	memcpy(cmem, zstrm->buffer, clen);
+	kunmap_atomic(cmem, KM_USER1);
+	put_cpu_ptr(zram->streams);
+
+	if (zram->use_dedup)
+		zram_dedup_insert(zram, entry, checksum);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (clen == PAGE_SIZE)
+		atomic_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
+
+found:
+	if (dedup) {
+		atomic_inc(&zram->stats.pages_dedup);
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
 	}
+	atomic_inc(&zram->stats.pages_stored);
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	zram->table[index].entry = entry;
+	zram_slot_unlock(zram, index);
 	return 0;
 
 out:
-	bio_io_error(bio);
-	return 0;
+	if (entry)
+		zram_entry_free(zram, entry);
+	zram_stat64_inc(zram, &zram->stats.failed_writes);
+	return ret;
 }
 
 static int zram_write(struct zram *zram, struct bio *bio)
@@ -295,119 +765,95 @@ static int zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
-
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+		if (zram_bvec_write(zram, bvec->bv_page, index))
+			goto out;
+		index++;
+	}
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return 0;
 
-		mutex_lock(&zram->lock);
+out:
+	bio_io_error(bio);
+	return 0;
+}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			continue;
+/*
+ * Write pages back to the backing device: incompressible ones if @huge,
+ * otherwise those still marked idle.  Pages shared through dedup are left
+ * alone since writing one of them back would not free any memory.
+ */
+ssize_t zram_writeback(struct zram *zram, int huge)
+{
+	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long index;
+	unsigned long blk_idx;
+	struct zram_entry *entry;
+	struct page *page;
+	ssize_t ret = 0;
+	int err;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(zram, index);
+		entry = zram->table[index].entry;
+		if (zram_test_flag(zram, index, ZRAM_WB) ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_UNDER_WB) || !entry)
+			goto next;
+		if (huge ? entry->len != PAGE_SIZE :
+			   !zram_test_flag(zram, index, ZRAM_IDLE))
+			goto next;
+		if (entry->refcount > 1)
+			goto next;
+
+		if (zram_read_entry(zram, entry, page, index))
+			goto next;
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+
+		blk_idx = zram_alloc_block(zram);
+		if (!blk_idx) {
+			zram_slot_lock(zram, index);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, index);
+			ret = -ENOSPC;
+			break;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
-
-		kunmap_atomic(user_mem, KM_USER0);
-
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+		err = zram_bdev_rw(zram, page, blk_idx, WRITE);
 
+		zram_slot_lock(zram, index);
 		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
+		 * The page may have been freed or rewritten, or read again
+		 * if we are writing back idle pages, while we were doing IO.
 		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+		if (err || !zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+		    (!huge && !zram_test_flag(zram, index, ZRAM_IDLE))) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_free_block(zram, blk_idx);
+			if (err)
+				ret = err;
+			goto next;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
-
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
-
-		memcpy(cmem, src, clen);
-
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
-
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
-
-		mutex_unlock(&zram->lock);
-		index++;
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].blk_idx = blk_idx;
+next:
+		zram_slot_unlock(zram, index);
+		cond_resched();
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return 0;
-
-out:
-	bio_io_error(bio);
-	return 0;
+	__free_page(page);
+	return ret;
 }
 
 /*
@@ -454,43 +900,73 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
-void zram_reset_device(struct zram *zram)
+static void zram_free_streams(struct zram *zram)
 {
-	size_t index;
+	int cpu;
 
-	mutex_lock(&zram->init_lock);
-	zram->init_done = 0;
+	if (!zram->streams)
+		return;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	for_each_possible_cpu(cpu) {
+		struct zram_stream *zstrm = per_cpu_ptr(zram->streams, cpu);
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+		kfree(zstrm->workmem);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+	free_percpu(zram->streams);
+	zram->streams = NULL;
+}
 
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+static int zram_alloc_streams(struct zram *zram)
+{
+	int cpu;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+	zram->streams = alloc_percpu(struct zram_stream);
+	if (!zram->streams)
+		return -ENOMEM;
 
-		if (!page)
-			continue;
+	for_each_possible_cpu(cpu) {
+		struct zram_stream *zstrm = per_cpu_ptr(zram->streams, cpu);
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zstrm->workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							__GFP_ZERO, 1);
+		if (!zstrm->workmem || !zstrm->buffer)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	zram->init_done = 0;
+
+	/* Free all pages that are still in this zram device */
+	if (zram->table) {
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+			zram_free_page(zram, index);
 	}
 
+	/* Free various per-device buffers */
+	zram_free_streams(zram);
+
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+
+	if (zram->mem_pool)
+		xv_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	zram_reset_bdev(zram);
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 
@@ -501,7 +977,7 @@ void zram_reset_device(struct zram *zram)
 int zram_init_device(struct zram *zram)
 {
 	int ret;
-	size_t num_pages;
+	size_t i, num_pages;
 
 	mutex_lock(&zram->init_lock);
 
@@ -512,30 +988,31 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_streams(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams!\n");
 		goto fail;
 	}
 
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	zram->table = vzalloc(num_pages * sizeof(*zram->table));
+	if (!zram->table) {
+		pr_err("Error allocating zram address table\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
-	num_pages = zram->disksize >> PAGE_SHIFT;
-	zram->table = vmalloc(num_pages * sizeof(*zram->table));
-	if (!zram->table) {
-		pr_err("Error allocating zram address table\n");
-		/* To prevent accessing table entries during cleanup */
-		zram->disksize = 0;
+	zram->hash_size = max_t(size_t, num_pages >> ZRAM_HASH_SHIFT, 1);
+	zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+	if (!zram->hash) {
+		pr_err("Error allocating zram dedup hash\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
-	memset(zram->table, 0, num_pages * sizeof(*zram->table));
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
 
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
@@ -568,7 +1045,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -581,9 +1060,9 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	zram->use_dedup = 1;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -669,11 +1148,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -703,6 +1188,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -721,6 +1208,7 @@ static void __exit zram_exit(void)
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	kmem_cache_destroy(zram_entry_cache);
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
@@ -17,6 +17,7 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 
 #include "xvmalloc.h"
 
@@ -55,6 +56,12 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
  * otherwise, xv_malloc() would always return failure.
  */
 
+/*
+ * Number of dedup hash buckets per page of disk, as a shift: one
+ * bucket for every 1 << ZRAM_HASH_SHIFT disk pages.
+ */
+#define ZRAM_HASH_SHIFT		10
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -64,24 +71,60 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
-	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
+	/* Bit spinlock protecting the table entry */
+	ZRAM_ACCESS,
+
+	/* Page consists entirely of one repeated word, see table.element */
+	ZRAM_SAME,
+
+	/* Page has been written back to the backing device */
+	ZRAM_WB,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is being written back to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page has not been accessed since it was last marked idle */
+	ZRAM_IDLE,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
-struct table {
+/*
+ * A stored object.  Identical pages share a single entry when dedup is
+ * enabled, so an entry may be referenced from several table slots.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash[checksum % hash_size] */
 	struct page *page;
 	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __attribute__((aligned(4)));
+	u32 len;		/* compressed size, PAGE_SIZE if stored as-is */
+	u32 checksum;
+	unsigned long refcount;	/* protected by the hash bucket lock */
+};
+
+/* Allocated for each disk page */
+struct table {
+	union {
+		struct zram_entry *entry;	/* stored object */
+		unsigned long element;		/* ZRAM_SAME fill pattern */
+		unsigned long blk_idx;		/* ZRAM_WB backing block */
+	};
+	unsigned long flags;
+};
+
+/* Dedup hash bucket */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+/* Per-CPU compression stream */
+struct zram_stream {
+	void *workmem;		/* LZO1X_MEM_COMPRESS bytes */
+	void *buffer;		/* two pages: LZO output may exceed PAGE_SIZE */
+};
 
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
@@ -91,20 +134,31 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* no. of writes that found an identical page */
+	u64 bd_reads;		/* no. of pages read from the backing device */
+	u64 bd_writes;		/* no. of pages written to the backing device */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of same element filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t pages_dedup;	/* no. of pages sharing another's object */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t bd_count;	/* no. of pages on the backing device */
 };
 
 struct zram {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_stream __percpu *streams;
 	struct table *table;
+	struct zram_hash *hash;
+	size_t hash_size;
+	int use_dedup;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	/* Backing device for writeback, set through sysfs before init */
+	struct block_device *bdev;
+	unsigned long *bitmap;	/* allocated blocks on bdev */
+	unsigned long nr_blocks;
+	char *backing_dev;	/* path of bdev */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -127,5 +181,9 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_slot_lock(struct zram *zram, u32 index);
+extern void zram_slot_unlock(struct zram *zram, u32 index);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern ssize_t zram_writeback(struct zram *zram, int huge);
 
 #endif
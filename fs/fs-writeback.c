@@ -26,6 +26,7 @@
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
+#include <linux/memcontrol.h>
 #include <linux/tracepoint.h>
 #include "internal.h"
 
@@ -504,6 +505,16 @@ static int writeback_sb_inodes(struct super_block *sb, struct bdi_writeback *wb,
 		if (inode_dirtied_after(inode, wbc->wb_start))
 			return 1;
 
+		/*
+		 * Leave the inodes of other cgroups for the global pass of
+		 * wb_writeback(), without changing their dirtied_when.
+		 */
+		if (wbc->for_cgroup &&
+		    !mem_cgroup_should_writeback_inode(inode)) {
+			requeue_io(inode);
+			continue;
+		}
+
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
 		writeback_single_inode(inode, wbc);
@@ -589,6 +600,22 @@ static inline bool over_bground_thresh(void)
 		global_page_state(NR_UNSTABLE_NFS) > background_thresh);
 }
 
+/*
+ * Keep the bdi's write bandwidth estimate fresh from the flusher side, so
+ * that it is already meaningful when dirtiers start to get throttled.
+ */
+static void wb_update_bandwidth(struct bdi_writeback *wb,
+				unsigned long start_time)
+{
+	struct backing_dev_info *bdi = wb->bdi;
+
+	if (time_is_after_eq_jiffies(bdi->bw_time_stamp + BANDWIDTH_INTERVAL))
+		return;
+	spin_lock(&inode_lock);
+	__bdi_update_bandwidth(bdi, 0, 0, 0, 0, 0, start_time);
+	spin_unlock(&inode_lock);
+}
+
 /*
  * Explicit flushing or periodic writeback of "old" data.
  *
@@ -616,6 +643,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 	};
 	unsigned long oldest_jif;
 	long wrote = 0;
+	bool cgroups_done = false;
 	struct inode *inode;
 
 	if (wbc.for_kupdate) {
@@ -638,10 +666,15 @@ static long wb_writeback(struct bdi_writeback *wb,
 
 		/*
 		 * For background writeout, stop when we are below the
-		 * background dirty threshold
+		 * background dirty threshold.  Memory cgroups over their own
+		 * background threshold get their inodes written first.
 		 */
-		if (work->for_background && !over_bground_thresh())
-			break;
+		if (work->for_background) {
+			wbc.for_cgroup = !cgroups_done &&
+				mem_cgroups_over_bground_dirty_thresh();
+			if (!wbc.for_cgroup && !over_bground_thresh())
+				break;
+		}
 
 		wbc.more_io = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
@@ -654,6 +687,8 @@ static long wb_writeback(struct bdi_writeback *wb,
 			writeback_inodes_wb(wb, &wbc);
 		trace_wbc_writeback_written(&wbc, wb->bdi);
 
+		wb_update_bandwidth(wb, wbc.wb_start);
+
 		work->nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 
@@ -662,6 +697,14 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 */
 		if (wbc.nr_to_write <= 0)
 			continue;
+		/*
+		 * Nothing more of the cgroups over their limits to write to
+		 * this bdi: go on with the other inodes, if still needed.
+		 */
+		if (wbc.for_cgroup) {
+			cgroups_done = true;
+			continue;
+		}
 		/*
 		 * Didn't write everything and we don't have more IO, bail
 		 */
@@ -942,6 +985,9 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 			sb->s_op->dirty_inode(inode);
 	}
 
+	if (flags & I_DIRTY_PAGES)
+		mem_cgroup_mark_inode_dirty(inode);
+
 	/*
 	 * make sure that changes are seen by all cpus before we test i_state
 	 * -- mikulas
@@ -208,6 +208,24 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+static inline int pmd_trans_splitting(pmd_t pmd)
+{
+	return 0;
+}
+static inline int pmd_write(pmd_t pmd)
+{
+	BUG();
+	return 0;
+}
+/* Only reachable through a PageTransHuge() page, which can't exist */
+#define pmdp_clear_flush_young(__vma, __address, __pmdp)	({ BUG(); 0; })
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 static inline pte_t __ptep_modify_prot_start(struct mm_struct *mm,
 					     unsigned long addr,
 					     pte_t *ptep)
@@ -264,6 +282,19 @@ static inline void ptep_modify_prot_commit(struct mm_struct *mm,
 	__ptep_modify_prot_commit(mm, addr, ptep, pte);
 }
 #endif /* __HAVE_ARCH_PTEP_MODIFY_PROT_TRANSACTION */
+
+#ifndef CONFIG_NUMA_BALANCING
+/*
+ * Technically a PTE can be PROTNONE even when not doing NUMA balancing
+ * but the only user of pte_protnone() is the NUMA hinting fault path,
+ * which only exists when CONFIG_NUMA_BALANCING is set.  Architectures
+ * supporting NUMA balancing provide their own definition.
+ */
+static inline int pte_protnone(pte_t pte)
+{
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif /* CONFIG_MMU */
 
 /*
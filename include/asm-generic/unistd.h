@@ -646,9 +646,15 @@ __SYSCALL(__NR_prlimit64, sys_prlimit64)
 __SYSCALL(__NR_fanotify_init, sys_fanotify_init)
 #define __NR_fanotify_mark 263
 __SYSCALL(__NR_fanotify_mark, sys_fanotify_mark)
+#define __NR_process_vm_readv 264
+__SC_COMP(__NR_process_vm_readv, sys_process_vm_readv, \
+	  compat_sys_process_vm_readv)
+#define __NR_process_vm_writev 265
+__SC_COMP(__NR_process_vm_writev, sys_process_vm_writev, \
+	  compat_sys_process_vm_writev)
 
 #undef __NR_syscalls
-#define __NR_syscalls 264
+#define __NR_syscalls 266
 
 /*
  * All syscalls below here should go away really,
@@ -601,6 +601,7 @@ static inline int cgroup_attach_task_current_cg(struct task_struct *tsk)
  * But the css returned by this routine can be "not populated yet" or "being
  * destroyed". The caller should check css and cgroup's status.
  */
+#define CSS_ID_MAX	(65535)
 
 /*
  * Typically Called at ->destroy(), or somewhere the subsys frees
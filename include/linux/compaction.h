@@ -19,10 +19,41 @@ extern int sysctl_extfrag_threshold;
 extern int sysctl_extfrag_handler(struct ctl_table *table, int write,
 			void __user *buffer, size_t *length, loff_t *ppos);
 
+extern int sysctl_compaction_proactive_order;
+extern int sysctl_compaction_proactive_blocks;
+extern int sysctl_compaction_proactive_centisecs;
+extern int sysctl_compaction_proactive_handler(struct ctl_table *table,
+			int write, void __user *buffer, size_t *length,
+			loff_t *ppos);
+
 extern int fragmentation_index(struct zone *zone, unsigned int order);
 extern unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			int order, gfp_t gfp_mask, nodemask_t *mask);
 
+extern int kcompactd_run(int nid);
+extern void kcompactd_stop(int nid);
+extern void wakeup_kcompactd(struct pglist_data *pgdat, int order);
+
+/*
+ * Called with zone->lock held when a high-order page has been taken off
+ * the free lists. If kcompactd left free blocks behind for an allocation
+ * that would otherwise have entered direct compaction, account the stall
+ * it saved.
+ */
+static inline void compaction_account_alloc(struct zone *zone, int order,
+						gfp_t gfp_mask)
+{
+	const gfp_t direct = __GFP_WAIT | __GFP_FS | __GFP_IO;
+
+	if (order <= PAGE_ALLOC_COSTLY_ORDER || !zone->compact_blocks_ready)
+		return;
+	if ((gfp_mask & direct) != direct)
+		return;
+
+	zone->compact_blocks_ready--;
+	__count_vm_event(COMPACTSTALL_AVOIDED);
+}
+
 /* Do not skip compaction more than 64 times */
 #define COMPACT_MAX_DEFER_SHIFT 6
 
@@ -68,6 +99,24 @@ static inline bool compaction_deferred(struct zone *zone)
 	return 1;
 }
 
+static inline int kcompactd_run(int nid)
+{
+	return 0;
+}
+
+static inline void kcompactd_stop(int nid)
+{
+}
+
+static inline void wakeup_kcompactd(struct pglist_data *pgdat, int order)
+{
+}
+
+static inline void compaction_account_alloc(struct zone *zone, int order,
+						gfp_t gfp_mask)
+{
+}
+
 #endif /* CONFIG_COMPACTION */
 
 #if defined(CONFIG_COMPACTION) && defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
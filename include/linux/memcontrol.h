@@ -24,6 +24,34 @@ struct mem_cgroup;
 struct page_cgroup;
 struct page;
 struct mm_struct;
+struct inode;
+
+/* Stats that can be updated by kernel. */
+enum mem_cgroup_page_stat_item {
+	MEMCG_NR_FILE_MAPPED, /* # of pages charged as file rss */
+	MEMCG_NR_FILE_DIRTY, /* # of dirty pages in page cache */
+	MEMCG_NR_FILE_WRITEBACK, /* # of pages under writeback */
+	MEMCG_NR_FILE_UNSTABLE_NFS, /* # of NFS unstable pages */
+};
+
+/* Dirty limits of a memory cgroup and its dirty pages, see page-writeback.c */
+struct dirty_info {
+	unsigned long dirty_thresh;
+	unsigned long background_thresh;
+	unsigned long nr_file_dirty;
+	unsigned long nr_writeback;
+	unsigned long nr_unstable_nfs;
+};
+
+static inline unsigned long dirty_info_reclaimable(struct dirty_info *info)
+{
+	return info->nr_file_dirty + info->nr_unstable_nfs;
+}
+
+static inline unsigned long dirty_info_dirty(struct dirty_info *info)
+{
+	return dirty_info_reclaimable(info) + info->nr_writeback;
+}
 
 extern unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 					struct list_head *dst,
@@ -121,7 +149,27 @@ static inline bool mem_cgroup_disabled(void)
 	return false;
 }
 
-void mem_cgroup_update_file_mapped(struct page *page, int val);
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item idx, int val);
+
+static inline void mem_cgroup_inc_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+	mem_cgroup_update_page_stat(page, idx, 1);
+}
+
+static inline void mem_cgroup_dec_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+	mem_cgroup_update_page_stat(page, idx, -1);
+}
+
+bool mem_cgroup_dirty_info(unsigned long sys_available_mem,
+			   struct dirty_info *info);
+bool mem_cgroups_over_bground_dirty_thresh(void);
+bool mem_cgroup_should_writeback_inode(struct inode *inode);
+void mem_cgroup_mark_inode_dirty(struct inode *inode);
+
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask);
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
@@ -293,8 +341,33 @@ mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 {
 }
 
-static inline void mem_cgroup_update_file_mapped(struct page *page,
-							int val)
+static inline void mem_cgroup_inc_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+}
+
+static inline void mem_cgroup_dec_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+}
+
+static inline bool mem_cgroup_dirty_info(unsigned long sys_available_mem,
+					 struct dirty_info *info)
+{
+	return false;
+}
+
+static inline bool mem_cgroups_over_bground_dirty_thresh(void)
+{
+	return false;
+}
+
+static inline bool mem_cgroup_should_writeback_inode(struct inode *inode)
+{
+	return true;
+}
+
+static inline void mem_cgroup_mark_inode_dirty(struct inode *inode)
 {
 }
 
@@ -313,5 +386,14 @@ u64 mem_cgroup_get_limit(struct mem_cgroup *mem)
 
 #endif /* CONFIG_CGROUP_MEM_CONT */
 
+#if defined(CONFIG_CGROUP_MEM_RES_CTLR) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail);
+#else
+static inline void mem_cgroup_split_huge_fixup(struct page *head,
+						struct page *tail)
+{
+}
+#endif
+
 #endif /* _LINUX_MEMCONTROL_H */
 
@@ -19,19 +19,238 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Returns the generation of @page, or -1 if it is not on any */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((page->flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+/*
+ * Only ever changed under the zone's lru_lock, but the other bits of
+ * page->flags are updated atomically without it.
+ */
+static inline void page_set_lru_gen(struct page *page, int gen)
+{
+	unsigned long old, new;
+
+	do {
+		old = ACCESS_ONCE(page->flags);
+		new = (old & ~LRU_GEN_MASK) |
+			((unsigned long)(gen + 1) << LRU_GEN_PGOFF);
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+/* The two youngest generations are accounted as active */
+static inline bool lru_gen_is_active(struct zone *zone, int gen)
+{
+	unsigned long max_seq = zone->lrugen.max_seq;
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
 static inline void
-add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+__lru_gen_update_size(struct zone *zone, int type, int gen, long delta)
+{
+	enum lru_list l = type * LRU_FILE;
+
+	if (lru_gen_is_active(zone, gen))
+		l += LRU_ACTIVE;
+	zone->lrugen.nr_pages[gen][type] += delta;
+	__mod_zone_page_state(zone, NR_LRU_BASE + l, delta);
+}
+
+static inline void lru_gen_move_page(struct zone *zone, struct page *page,
+				     int gen, int new_gen, bool tail)
+{
+	int type = page_is_file_cache(page);
+	struct list_head *head = &zone->lrugen.lists[new_gen][type];
+
+	if (gen != new_gen) {
+		page_set_lru_gen(page, new_gen);
+		__lru_gen_update_size(zone, type, gen, -hpage_nr_pages(page));
+		__lru_gen_update_size(zone, type, new_gen, hpage_nr_pages(page));
+	}
+	if (tail)
+		list_move_tail(&page->lru, head);
+	else
+		list_move(&page->lru, head);
+}
+
+/*
+ * Pages which were just activated, or faulted in, start out in the
+ * youngest generation; anon pages not yet in swapcache, and dirty pages
+ * waiting for writeback, in the second youngest as they could not be
+ * reclaimed right away anyway; everything else in one of the oldest.
+ */
+static inline bool lru_gen_add_page(struct zone *zone, struct page *page)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+	int gen;
+
+	if (!lrugen->enabled || PageUnevictable(page))
+		return false;
+
+	VM_BUG_ON(page_lru_gen(page) != -1);
+
+	if (TestClearPageActive(page))
+		seq = lrugen->max_seq;
+	else if ((!type && !PageSwapCache(page)) ||
+		 (PageReclaim(page) &&
+		  (PageDirty(page) || PageWriteback(page))))
+		seq = lrugen->max_seq - 1;
+	else if (lrugen->min_seq[type] + MIN_NR_GENS >= lrugen->max_seq)
+		seq = lrugen->min_seq[type];
+	else
+		seq = lrugen->min_seq[type] + 1;
+
+	gen = lru_gen_from_seq(seq);
+	page_set_lru_gen(page, gen);
+	__lru_gen_update_size(zone, type, gen, hpage_nr_pages(page));
+	list_add(&page->lru, &lrugen->lists[gen][type]);
+	mem_cgroup_add_lru_list(page, type * LRU_FILE);
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct zone *zone, struct page *page)
+{
+	int gen = page_lru_gen(page);
+	int type;
+
+	if (gen < 0)
+		return false;
+
+	type = page_is_file_cache(page);
+	page_set_lru_gen(page, -1);
+	__lru_gen_update_size(zone, type, gen, -hpage_nr_pages(page));
+	list_del(&page->lru);
+	mem_cgroup_del_lru_list(page, type * LRU_FILE);
+	return true;
+}
+
+/*
+ * Take a page which is being isolated off its generation: from then on
+ * it is accounted like a page isolated from the inactive list, which is
+ * what the callers of __isolate_lru_page() expect.  The caller moves
+ * page->lru.
+ */
+static inline void lru_gen_isolate_page(struct zone *zone, struct page *page)
+{
+	int gen = page_lru_gen(page);
+	int type = page_is_file_cache(page);
+	int nr_pages = hpage_nr_pages(page);
+
+	if (gen < 0)
+		return;
+
+	page_set_lru_gen(page, -1);
+	zone->lrugen.nr_pages[gen][type] -= nr_pages;
+	if (lru_gen_is_active(zone, gen)) {
+		__mod_zone_page_state(zone, NR_LRU_BASE + type * LRU_FILE +
+				      LRU_ACTIVE, -nr_pages);
+		__mod_zone_page_state(zone, NR_LRU_BASE + type * LRU_FILE,
+				      nr_pages);
+	}
+}
+
+/* Move a page to be evicted first, after its writeback completed */
+static inline bool lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	int gen = page_lru_gen(page);
+	int type = page_is_file_cache(page);
+
+	if (gen < 0)
+		return false;
+
+	lru_gen_move_page(zone, page, gen,
+			  lru_gen_from_seq(zone->lrugen.min_seq[type]), true);
+	return true;
+}
+
+/* Put the tail of a huge page being split into the head's generation */
+static inline bool lru_gen_add_page_tail(struct zone *zone, struct page *page,
+					 struct page *page_tail)
 {
-	list_add(&page->lru, &zone->lru[l].list);
-	__inc_zone_state(zone, NR_LRU_BASE + l);
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	page_set_lru_gen(page_tail, gen);
+	__lru_gen_update_size(zone, page_is_file_cache(page_tail), gen, 1);
+	list_add_tail(&page_tail->lru, &page->lru);
+	mem_cgroup_add_lru_list(page_tail,
+				page_is_file_cache(page_tail) * LRU_FILE);
+	return true;
+}
+
+#else /* !CONFIG_LRU_GEN */
+
+static inline int page_lru_gen(struct page *page)
+{
+	return -1;
+}
+
+static inline bool lru_gen_add_page(struct zone *zone, struct page *page)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct zone *zone, struct page *page)
+{
+	return false;
+}
+
+static inline void lru_gen_isolate_page(struct zone *zone, struct page *page)
+{
+}
+
+static inline bool lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page_tail(struct zone *zone, struct page *page,
+					 struct page *page_tail)
+{
+	return false;
+}
+
+#endif /* CONFIG_LRU_GEN */
+
+static inline void
+__add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l,
+		       struct list_head *head)
+{
+	list_add(&page->lru, head);
+	__mod_zone_page_state(zone, NR_LRU_BASE + l, hpage_nr_pages(page));
 	mem_cgroup_add_lru_list(page, l);
 }
 
+static inline void
+add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+{
+	if (lru_gen_add_page(zone, page))
+		return;
+	__add_page_to_lru_list(zone, page, l, &zone->lru[l].list);
+}
+
 static inline void
 del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_del_page(zone, page))
+		return;
 	list_del(&page->lru);
-	__dec_zone_state(zone, NR_LRU_BASE + l);
+	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 	mem_cgroup_del_lru_list(page, l);
 }
 
@@ -55,6 +274,8 @@ del_page_from_lru(struct zone *zone, struct page *page)
 {
 	enum lru_list l;
 
+	if (lru_gen_del_page(zone, page))
+		return;
 	list_del(&page->lru);
 	if (PageUnevictable(page)) {
 		__ClearPageUnevictable(page);
@@ -66,7 +287,7 @@ del_page_from_lru(struct zone *zone, struct page *page)
 			l += LRU_ACTIVE;
 		}
 	}
-	__dec_zone_state(zone, NR_LRU_BASE + l);
+	__mod_zone_page_state(zone, NR_LRU_BASE + l, -hpage_nr_pages(page));
 	mem_cgroup_del_lru_list(page, l);
 }
 
@@ -92,4 +313,22 @@ static inline enum lru_list page_lru(struct page *page)
 	return lru;
 }
 
+/*
+ * Adjust the LRU size accounted to @page by @delta, as when a huge page
+ * on the LRU is split: each tail page is added to the LRU on its own.
+ */
+static inline void update_lru_size(struct zone *zone, struct page *page,
+				   long delta)
+{
+#ifdef CONFIG_LRU_GEN
+	int gen = page_lru_gen(page);
+
+	if (gen >= 0) {
+		__lru_gen_update_size(zone, page_is_file_cache(page), gen, delta);
+		return;
+	}
+#endif
+	__mod_zone_page_state(zone, NR_LRU_BASE + page_lru(page), delta);
+}
+
 #endif
@@ -11,6 +11,8 @@
 #include <linux/rwsem.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <linux/page-debug-flags.h>
 #include <asm/page.h>
 #include <asm/mmu.h>
@@ -141,6 +143,14 @@ struct vm_area_struct {
 
 	struct rb_node vm_rb;
 
+	/*
+	 * Largest free memory gap in bytes to the left of this VMA.
+	 * Either between this VMA and vma->vm_prev, or between one of the
+	 * VMAs below us in the VMA rbtree and its ->vm_prev. This helps
+	 * get_unmapped_area find a free area of the right size.
+	 */
+	unsigned long rb_subtree_gap;
+
 	/*
 	 * For areas with an address space and backing store,
 	 * linkage into the address_space->i_mmap prio tree, or
@@ -177,12 +187,23 @@ struct vm_area_struct {
 	void * vm_private_data;		/* was vm_pte (shared mem) */
 	unsigned long vm_truncate_count;/* truncate_count or restart_addr */
 
+#ifdef CONFIG_SWAP
+	atomic_long_t swap_readahead_info; /* last fault, window, hits */
+#endif
 #ifndef CONFIG_MMU
 	struct vm_region *vm_region;	/* NOMMU mapping region */
 #endif
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Bumped around changes that speculative page faults must not
+	 * miss, under mmap_sem held for write: see vm_write_begin().
+	 */
+	seqcount_t vm_sequence;
+	struct rcu_head vm_rcu;		/* vmas are freed after a grace period */
+#endif
 };
 
 struct core_thread {
@@ -200,6 +221,10 @@ enum {
 	MM_FILEPAGES,
 	MM_ANONPAGES,
 	MM_SWAPENTS,
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	MM_SPF_SUCCESS,		/* faults handled without mmap_sem */
+	MM_SPF_FALLBACK,	/* ... or retried under mmap_sem */
+#endif
 	NR_MM_COUNTERS
 };
 
@@ -219,10 +244,18 @@ struct mm_rss_stat {
 };
 #endif /* !USE_SPLIT_PTLOCKS */
 
+/*
+ * Each task caches the last few vmas its find_vma() calls returned, in
+ * task_struct->vmacache: see include/linux/vmacache.h.
+ */
+#define VMACACHE_BITS 2
+#define VMACACHE_SIZE (1U << VMACACHE_BITS)
+#define VMACACHE_MASK (VMACACHE_SIZE - 1)
+
 struct mm_struct {
 	struct vm_area_struct * mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
-	struct vm_area_struct * mmap_cache;	/* last find_vma result */
+	u32 vmacache_seqnum;			/* per-thread vmacache */
 #ifdef CONFIG_MMU
 	unsigned long (*get_unmapped_area) (struct file *filp,
 				unsigned long addr, unsigned long len,
@@ -312,6 +345,29 @@ struct mm_struct {
 #endif
 	/* How many tasks sharing this mm are OOM_DISABLE */
 	atomic_t oom_disable_count;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the next time in jiffies the address space
+	 * is due for a NUMA hinting scan, numa_scan_offset is where the
+	 * previous scan stopped.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+#endif
+#ifdef CONFIG_LRU_GEN
+	/* on the list of mms whose page tables age the LRU generations */
+	struct list_head lru_gen_list;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Reclaim has cleared ptes of this mm without flushing the TLB
+	 * yet: see flush_tlb_batched_pending().
+	 */
+	bool tlb_flush_batched;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
@@ -106,6 +106,11 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,
+	WORKINGSET_ACTIVATE,
+	WORKINGSET_NODERECLAIM,
+	NR_ANON_TRANSPARENT_HUGEPAGES,
+	NR_SHMEM_HUGEPAGES,	/* shmem huge page teams */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -168,13 +173,24 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists hold pages of orders up to PAGE_ALLOC_COSTLY_ORDER, with
+ * one list per order and migrate type.
+ */
+#define NR_PCP_ORDERS		(PAGE_ALLOC_COSTLY_ORDER + 1)
+#define NR_PCP_LISTS		(MIGRATE_PCPTYPES * NR_PCP_ORDERS)
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* high-order allocations served from, and refilling, the lists */
+	unsigned long high_order_hit;
+	unsigned long high_order_miss;
+
+	/* Lists of pages, one per order and migrate type */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -279,6 +295,44 @@ struct zone_reclaim_stat {
 	unsigned long		nr_saved_scan[NR_LRU_LISTS];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-generational LRU, the evictable pages of a zone are
+ * sorted into generations rather than onto the active and inactive
+ * lists.  Generations are numbered by sequence numbers which only ever
+ * grow: max_seq is the youngest generation, and min_seq[] the oldest
+ * one of each type, where type 0 is anon and type 1 is file backed.
+ * A sequence number maps to its lists by lru_gen_from_seq().
+ *
+ * Aging creates a new youngest generation and promotes to it the pages
+ * found accessed in the page tables; eviction reclaims pages from the
+ * oldest generation.  The two youngest generations are accounted as
+ * active, the others as inactive, in the zone LRU counters.
+ */
+#define MIN_NR_GENS		2
+#define MAX_NR_GENS		4
+
+struct lru_gen_struct {
+	unsigned long		max_seq;
+	unsigned long		min_seq[2];
+	/* jiffies when each generation was created */
+	unsigned long		timestamps[MAX_NR_GENS];
+	struct list_head	lists[MAX_NR_GENS][2];
+	long			nr_pages[MAX_NR_GENS][2];
+	/*
+	 * Decaying averages of the pages evicted from, and of the pages
+	 * which turned out to be in use (or refaulted) for each type, to
+	 * balance eviction between anon and file.
+	 */
+	unsigned long		avg_total[2];
+	unsigned long		avg_refaulted[2];
+	/* WORKINGSET_ACTIVATE when the file refaults were last sampled */
+	unsigned long		nr_activate;
+	/* whether the generations are in use, protected by lru_lock */
+	bool			enabled;
+};
+#endif
+
 struct zone {
 	/* Fields commonly accessed by the page allocator */
 
@@ -338,6 +392,12 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+
+	/*
+	 * High-order blocks freed up by kcompactd that have not yet been
+	 * consumed by a costly allocation. Protected by zone->lock.
+	 */
+	unsigned long		compact_blocks_ready;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -349,6 +409,9 @@ struct zone {
 	} lru[NR_LRU_LISTS];
 
 	struct zone_reclaim_stat reclaim_stat;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen_struct	lrugen;
+#endif
 
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
@@ -362,6 +425,9 @@ struct zone {
 	 */
 	unsigned int inactive_ratio;
 
+	/* Evictions & activations on the inactive file list */
+	atomic_long_t		inactive_age;
+
 
 	ZONE_PADDING(_pad2_)
 	/* Rarely used or read-mostly fields */
@@ -443,6 +509,14 @@ static inline void zone_clear_flag(struct zone *zone, zone_flags_t flag)
 	clear_bit(flag, &zone->flags);
 }
 
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_init_zone(struct zone *zone);
+#else
+static inline void lru_gen_init_zone(struct zone *zone)
+{
+}
+#endif
+
 static inline int zone_is_reclaim_congested(const struct zone *zone)
 {
 	return test_bit(ZONE_CONGESTED, &zone->flags);
@@ -645,6 +719,19 @@ typedef struct pglist_data {
 	wait_queue_head_t kswapd_wait;
 	struct task_struct *kswapd;
 	int kswapd_max_order;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+	unsigned int kcompactd_backoff;	/* proactive passes without progress */
+#endif
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+	/*
+	 * The struct pages of the highest zone from this pfn onwards are
+	 * left for pgdatinit to initialise; ULONG_MAX if none are.
+	 */
+	unsigned long first_deferred_pfn;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
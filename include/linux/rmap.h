@@ -5,28 +5,31 @@
  */
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/spinlock.h>
 #include <linux/memcontrol.h>
 
 /*
- * The anon_vma heads a list of private "related" vmas, to scan if
+ * The anon_vma heads a tree of private "related" vmas, to scan if
  * an anonymous page pointing to this anon_vma needs to be unmapped:
- * the vmas on the list will be related by forking, or by splitting.
+ * the vmas in the tree will be related by forking, or by splitting.
+ * The tree is an interval tree keyed by the page offsets each vma
+ * covers, so that a walk only visits the vmas which can map a page.
  *
  * Since vmas come and go as they are split and merged (particularly
  * in mprotect), the mapping field of an anonymous page cannot point
- * directly to a vma: instead it points to an anon_vma, on whose list
+ * directly to a vma: instead it points to an anon_vma, in whose tree
  * the related vmas can be easily linked or unlinked.
  *
- * After unlinking the last vma on the list, we must garbage collect
+ * After unlinking the last vma from the tree, we must garbage collect
  * the anon_vma object itself: we're guaranteed no page can be
- * pointing to this anon_vma once its vma list is empty.
+ * pointing to this anon_vma once its vma tree is empty.
  */
 struct anon_vma {
 	struct anon_vma *root;	/* Root of this anon_vma tree */
-	spinlock_t lock;	/* Serialize access to vma list */
+	spinlock_t lock;	/* Serialize access to vma tree */
 #if defined(CONFIG_KSM) || defined(CONFIG_MIGRATION)
 
 	/*
@@ -40,14 +43,25 @@ struct anon_vma {
 	atomic_t external_refcount;
 #endif
 	/*
-	 * NOTE: the LSB of the head.next is set by
+	 * Count of child anon_vmas and VMAs which point to this anon_vma.
+	 *
+	 * This counter is used for making decision about reusing anon_vma
+	 * instead of forking new one. See comments in anon_vma_clone().
+	 * Protected by the root anon_vma's lock.
+	 */
+	unsigned degree;
+
+	struct anon_vma *parent;	/* Parent of this anon_vma */
+
+	/*
+	 * NOTE: the LSB of the rb_root.rb_node is set by
 	 * mm_take_all_locks() _after_ taking the above lock. So the
-	 * head must only be read/written after taking the above lock
+	 * rb_root must only be read/written after taking the above lock
 	 * to be sure to see a valid next pointer. The LSB bit itself
 	 * is serialized by a system wide lock only visible to
 	 * mm_take_all_locks() (mm_all_locks_mutex).
 	 */
-	struct list_head head;	/* Chain of private "related" vmas */
+	struct rb_root rb_root;	/* Interval tree of private "related" vmas */
 };
 
 /*
@@ -60,14 +74,15 @@ struct anon_vma {
  * with a VMA, or the VMAs associated with an anon_vma.
  * The "same_vma" list contains the anon_vma_chains linking
  * all the anon_vmas associated with this VMA.
- * The "same_anon_vma" list contains the anon_vma_chains
+ * The "rb" field indexes on an interval tree the anon_vma_chains
  * which link all the VMAs associated with this anon_vma.
  */
 struct anon_vma_chain {
 	struct vm_area_struct *vma;
 	struct anon_vma *anon_vma;
 	struct list_head same_vma;   /* locked by mmap_sem & page_table_lock */
-	struct list_head same_anon_vma;	/* locked by anon_vma->lock */
+	struct rb_node rb;			/* locked by anon_vma->lock */
+	unsigned long rb_subtree_last;
 };
 
 #ifdef CONFIG_MMU
@@ -150,6 +165,29 @@ int anon_vma_fork(struct vm_area_struct *, struct vm_area_struct *);
 void __anon_vma_link(struct vm_area_struct *);
 void anon_vma_free(struct anon_vma *);
 
+/*
+ * Interval tree of the anon_vma_chains hanging off an anon_vma, in
+ * mm/interval_tree.c.  Each chain covers the page offsets
+ * [vm_pgoff, vm_pgoff + vma_pages(vma) - 1] of its vma, so the vma's
+ * range must not change while its chains are in the tree: bracket any
+ * such change with anon_vma_interval_tree_pre_update_vma() and
+ * anon_vma_interval_tree_post_update_vma(), under the anon_vma lock.
+ */
+void anon_vma_interval_tree_insert(struct anon_vma_chain *node,
+				   struct rb_root *root);
+void anon_vma_interval_tree_remove(struct anon_vma_chain *node,
+				   struct rb_root *root);
+struct anon_vma_chain *anon_vma_interval_tree_iter_first(
+	struct rb_root *root, unsigned long start, unsigned long last);
+struct anon_vma_chain *anon_vma_interval_tree_iter_next(
+	struct anon_vma_chain *node, unsigned long start, unsigned long last);
+void anon_vma_interval_tree_pre_update_vma(struct vm_area_struct *vma);
+void anon_vma_interval_tree_post_update_vma(struct vm_area_struct *vma);
+
+#define anon_vma_interval_tree_foreach(avc, root, start, last)		 \
+	for (avc = anon_vma_interval_tree_iter_first(root, start, last); \
+	     avc; avc = anon_vma_interval_tree_iter_next(avc, start, last))
+
 static inline void anon_vma_merge(struct vm_area_struct *vma,
 				  struct vm_area_struct *next)
 {
@@ -195,6 +233,7 @@ enum ttu_flags {
 	TTU_IGNORE_MLOCK = (1 << 8),	/* ignore mlock */
 	TTU_IGNORE_ACCESS = (1 << 9),	/* don't age */
 	TTU_IGNORE_HWPOISON = (1 << 10),/* corrupted page is recoverable */
+	TTU_BATCH_FLUSH = (1 << 11),	/* caller calls try_to_unmap_flush() */
 };
 #define TTU_ACTION(x) ((x) & TTU_ACTION_MASK)
 
@@ -224,6 +263,12 @@ static inline pte_t *page_check_address(struct page *page, struct mm_struct *mm,
  */
 unsigned long page_address_in_vma(struct page *, struct vm_area_struct *);
 
+/*
+ * Used by the transparent hugepage code to locate the pmd mapping a
+ * huge page in a given vma.
+ */
+unsigned long vma_address(struct page *, struct vm_area_struct *);
+
 /*
  * Cleans the PTEs of shared mappings.
  * (and since clean PTEs should also be readonly, write protects them too)
@@ -140,6 +140,19 @@ repeat:
 	return ret;
 }
 
+/*
+ * Like read_seqcount_begin(), but does not wait for a writer to finish:
+ * a write in progress makes the following read_seqcount_retry() fail.
+ * For readers which cannot wait, or which must not: the writer may sleep.
+ */
+static inline unsigned raw_seqcount_begin(const seqcount_t *s)
+{
+	unsigned ret = ACCESS_ONCE(s->sequence);
+
+	smp_rmb();
+	return ret & ~1;
+}
+
 /*
  * Test if reader processed invalid data because sequence number has changed.
  */
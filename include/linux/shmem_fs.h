@@ -32,8 +32,16 @@ struct shmem_sb_info {
 	gid_t gid;		    /* Mount gid for root directory */
 	mode_t mode;		    /* Mount mode for root directory */
 	struct mempolicy *mpol;     /* default memory policy for mappings */
+	int huge;		    /* SHMEM_HUGE_* policy for huge pages */
+	unsigned long nr_huge;	    /* Huge page teams in this mount */
 };
 
+/* Values of sbinfo->huge and of /proc/sys/vm/shmem_huge */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1
+#define SHMEM_HUGE_WITHIN_SIZE	2
+#define SHMEM_HUGE_ADVISE	3
+
 static inline struct shmem_inode_info *SHMEM_I(struct inode *inode)
 {
 	return container_of(inode, struct shmem_inode_info, vfs_inode);
@@ -41,5 +49,8 @@ static inline struct shmem_inode_info *SHMEM_I(struct inode *inode)
 
 extern int init_tmpfs(void);
 extern int shmem_fill_super(struct super_block *sb, void *data, int silent);
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+extern int sysctl_shmem_huge;
+#endif
 
 #endif
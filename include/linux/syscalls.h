@@ -732,6 +732,18 @@ asmlinkage long sys_move_pages(pid_t pid, unsigned long nr_pages,
 				const int __user *nodes,
 				int __user *status,
 				int flags);
+asmlinkage ssize_t sys_process_vm_readv(pid_t pid,
+				const struct iovec __user *lvec,
+				unsigned long liovcnt,
+				const struct iovec __user *rvec,
+				unsigned long riovcnt,
+				unsigned long flags);
+asmlinkage ssize_t sys_process_vm_writev(pid_t pid,
+				const struct iovec __user *lvec,
+				unsigned long liovcnt,
+				const struct iovec __user *rvec,
+				unsigned long riovcnt,
+				unsigned long flags);
 asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 				unsigned long mode,
 				unsigned long __user *nmask,
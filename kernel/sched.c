@@ -2713,6 +2713,16 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->numa_preferred_nid = -1;
+	p->numa_work_pending = 0;
+	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
+	p->node_stamp = 0;
+	p->numa_faults = NULL;
+	p->numa_faults_locality[0] = 0;
+	p->numa_faults_locality[1] = 0;
+#endif
 }
 
 /*
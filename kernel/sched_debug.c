@@ -461,6 +461,22 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_preferred_nid);
+	P(numa_scan_period);
+	SEQ_printf(m, "%-35s:%21Ld\n",
+		   "numa_faults_local", (long long)p->numa_faults_locality[1]);
+	SEQ_printf(m, "%-35s:%21Ld\n",
+		   "numa_faults_remote", (long long)p->numa_faults_locality[0]);
+	{
+		unsigned long *faults = ACCESS_ONCE(p->numa_faults);
+		int nid;
+
+		for_each_node(nid)
+			SEQ_printf(m, "numa_faults_node%-19d:%21Ld\n", nid,
+				   faults ? (long long)faults[nid] : 0LL);
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
@@ -22,6 +22,7 @@
 
 #include <linux/latencytop.h>
 #include <linux/sched.h>
+#include <linux/mempolicy.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -1126,6 +1127,220 @@ static void yield_task_fair(struct rq *rq)
 	se->vruntime = rightmost->vruntime + 1;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing.
+ *
+ * Every numa_scan_period of runtime a task marks the next
+ * sysctl_numa_balancing_scan_size MB of its address space PROT_NONE
+ * (see change_prot_numa()).  The resulting hinting faults tell which
+ * node accesses the memory; misplaced pages get migrated to the
+ * faulting node and the per-node fault counts pick the task's
+ * preferred node, which wakeups and load balancing then favour.
+ */
+int sysctl_numa_balancing = 1;
+
+/* runtime in ms before the first scan of a new task */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/* bounds in ms for the adaptive scan period */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+
+/* MB of address space to scan each time */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Pick the node with the most recent faults as the preferred node and
+ * age the fault counts.  Scan faster while most faults are remote and
+ * back off once memory is mostly local.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long faults, max_faults = 0;
+	unsigned long local, remote;
+	int nid, max_nid = -1;
+
+	if (!p->numa_faults)
+		return;
+
+	for_each_node(nid) {
+		faults = p->numa_faults[nid];
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+		p->numa_faults[nid] = faults / 2;
+	}
+	if (max_nid != -1)
+		p->numa_preferred_nid = max_nid;
+
+	local = p->numa_faults_locality[1];
+	remote = p->numa_faults_locality[0];
+	if (local + remote) {
+		if (remote > local)
+			p->numa_scan_period = max(p->numa_scan_period / 2,
+				sysctl_numa_balancing_scan_period_min);
+		else
+			p->numa_scan_period = min(p->numa_scan_period * 2,
+				sysctl_numa_balancing_scan_period_max);
+	}
+	p->numa_faults_locality[0] = 0;
+	p->numa_faults_locality[1] = 0;
+}
+
+/*
+ * Called from the NUMA hinting fault path with the node @pages now
+ * live on.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	p->numa_faults[node] += pages;
+	p->numa_faults_locality[node == numa_node_id()] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+/*
+ * The expensive part of NUMA balancing, run from the return to user
+ * path of a task whose scan came due.  Only one thread of a process
+ * scans per period, the others just update their placement.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	p->numa_work_pending = 0;
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	task_numa_placement(p);
+
+	if (!mm->numa_next_scan)
+		mm->numa_next_scan = now +
+			msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT;
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma))
+			continue;
+
+		/* PROT_NONE mappings can't take hinting faults */
+		if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		/* shared library text is mapped everywhere, leave it be */
+		if (vma->vm_file &&
+		    (vma->vm_flags & (VM_READ | VM_WRITE)) == VM_READ)
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			change_prot_numa(vma, start, end);
+
+			pages -= (end - start) >> PAGE_SHIFT;
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/* start over once the whole address space has been covered */
+	mm->numa_scan_offset = vma ? start : 0;
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Ask @curr to run task_numa_work() on its way back to user space once
+ * it has used up its scan period of runtime.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	struct mm_struct *mm = curr->mm;
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || num_online_nodes() == 1)
+		return;
+	if (!mm || (curr->flags & (PF_EXITING | PF_KTHREAD)) ||
+	    curr->numa_work_pending)
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		if (!curr->node_stamp)
+			curr->numa_scan_period =
+				sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!mm->numa_next_scan ||
+		    !time_before(jiffies, mm->numa_next_scan)) {
+			curr->numa_work_pending = 1;
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+		}
+	}
+}
+
+static inline int task_numa_nid(struct task_struct *p)
+{
+	if (!sysctl_numa_balancing)
+		return -1;
+	return p->numa_preferred_nid;
+}
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline int task_numa_nid(struct task_struct *p)
+{
+	return -1;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #ifdef CONFIG_SMP
 
 static void task_waking_fair(struct rq *rq, struct task_struct *p)
@@ -1443,6 +1658,24 @@ static int select_idle_sibling(struct task_struct *p, int target)
  *
  * preempt must be disabled.
  */
+/*
+ * If exactly one of @cpu and @prev_cpu sits on @p's preferred NUMA
+ * node, that's where @p should wake up regardless of the affine
+ * heuristics.  Returns -1 when there is no preference.
+ */
+static int numa_wake_target(struct task_struct *p, int cpu, int prev_cpu)
+{
+	int nid = task_numa_nid(p);
+
+	if (nid < 0 || cpu_to_node(cpu) == cpu_to_node(prev_cpu))
+		return -1;
+	if (cpu_to_node(prev_cpu) == nid)
+		return prev_cpu;
+	if (cpu_to_node(cpu) == nid)
+		return cpu;
+	return -1;
+}
+
 static int
 select_task_rq_fair(struct rq *rq, struct task_struct *p, int sd_flag, int wake_flags)
 {
@@ -1526,6 +1759,10 @@ select_task_rq_fair(struct rq *rq, struct task_struct *p, int sd_flag, int wake_
 #endif
 
 	if (affine_sd) {
+		int target = numa_wake_target(p, cpu, prev_cpu);
+
+		if (target >= 0)
+			return select_idle_sibling(p, target);
 		if (cpu == prev_cpu || wake_affine(affine_sd, p, sync))
 			return select_idle_sibling(p, cpu);
 		else
@@ -1769,6 +2006,7 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		     int *all_pinned)
 {
 	int tsk_cache_hot = 0;
+	int nid;
 	/*
 	 * We do not migrate tasks that are:
 	 * 1) running (obviously), or
@@ -1786,6 +2024,20 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		return 0;
 	}
 
+	/*
+	 * Moving a task to its preferred NUMA node is worth losing cache
+	 * hotness, moving it away only happens once balancing keeps
+	 * failing.
+	 */
+	nid = task_numa_nid(p);
+	if (nid >= 0 && cpu_to_node(this_cpu) != cpu_to_node(cpu_of(rq))) {
+		if (cpu_to_node(this_cpu) == nid)
+			return 1;
+		if (cpu_to_node(cpu_of(rq)) == nid &&
+		    sd->nr_balance_failed <= sd->cache_nice_tries)
+			return 0;
+	}
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -3794,6 +4046,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -0,0 +1,387 @@
+/*
+ * Boot time test of the radix tree functions
+ *
+ * Checks insertion, lookup, gang lookup, tagging and deletion of order-0
+ * and multi-order entries, then times lookups in a tree of order-0
+ * entries and in a tree of multi-order entries covering the same range.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/radix-tree.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/gfp.h>
+
+#define TEST_TAG	0
+#define TEST_TAG2	1
+
+/* Order of the entries in the second benchmark tree: a 2MB huge page */
+#define BENCH_ORDER	9
+#define BENCH_SIZE	(1UL << 18)
+
+static int failed __initdata;
+
+#define CHECK(cond)							\
+do {									\
+	if (!(cond)) {							\
+		printk(KERN_ERR "radix_tree_test: %s:%d: %s\n",		\
+		       __func__, __LINE__, #cond);			\
+		failed++;						\
+	}								\
+} while (0)
+
+/*
+ * The tree never dereferences the items, so any value with the two low
+ * bits clear will do.  Derive it from the index, to check lookups.
+ */
+static inline void *item(unsigned long index)
+{
+	return (void *)((index << 3) | 4);
+}
+
+static inline unsigned long item_index(void *item)
+{
+	return (unsigned long)item >> 3;
+}
+
+static inline int tree_empty(struct radix_tree_root *root)
+{
+	return !root->rnode && !root->height;
+}
+
+static void __init test_order0(void)
+{
+	RADIX_TREE(tree, GFP_KERNEL);
+	unsigned long indices[] = { 0, 1, 63, 64, 1000, 4095, 4096, 1UL << 30,
+				    ULONG_MAX };
+	void *results[ARRAY_SIZE(indices)];
+	unsigned int i, nr;
+
+	for (i = 0; i < ARRAY_SIZE(indices); i++) {
+		CHECK(radix_tree_insert(&tree, indices[i],
+					item(indices[i])) == 0);
+		CHECK(radix_tree_insert(&tree, indices[i],
+					item(indices[i])) == -EEXIST);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(indices); i++) {
+		CHECK(radix_tree_lookup(&tree, indices[i]) == item(indices[i]));
+		if (indices[i] != ULONG_MAX)
+			CHECK(!radix_tree_lookup(&tree, indices[i] + 2));
+	}
+
+	nr = radix_tree_gang_lookup(&tree, results, 0, ARRAY_SIZE(results));
+	CHECK(nr == ARRAY_SIZE(indices));
+	for (i = 0; i < nr; i++)
+		CHECK(results[i] == item(indices[i]));
+
+	CHECK(radix_tree_tag_set(&tree, 4096, TEST_TAG) == item(4096));
+	CHECK(radix_tree_tag_get(&tree, 4096, TEST_TAG));
+	CHECK(!radix_tree_tag_get(&tree, 4095, TEST_TAG));
+	nr = radix_tree_gang_lookup_tag(&tree, results, 0,
+					ARRAY_SIZE(results), TEST_TAG);
+	CHECK(nr == 1 && results[0] == item(4096));
+
+	for (i = 0; i < ARRAY_SIZE(indices); i++)
+		CHECK(radix_tree_delete(&tree, indices[i]) == item(indices[i]));
+	CHECK(!radix_tree_tagged(&tree, TEST_TAG));
+	CHECK(tree_empty(&tree));
+}
+
+/* Insert, look up, tag and delete an entry of @order at @index */
+static void __init test_multiorder_at(unsigned long index, unsigned int order)
+{
+	RADIX_TREE(tree, GFP_KERNEL);
+	unsigned long size = 1UL << order;
+	unsigned long last = index + size - 1;
+	unsigned long first, i, found;
+	void *results[4];
+	void **slot;
+
+	CHECK(__radix_tree_insert(&tree, index, order, item(index)) == 0);
+	CHECK(__radix_tree_insert(&tree, index, order, item(index)) == -EEXIST);
+	CHECK(radix_tree_insert(&tree, last, item(last)) == -EEXIST);
+	if (!(index & (2 * size - 1)))
+		CHECK(__radix_tree_insert(&tree, index, order + 1,
+					  item(index)) == -EEXIST);
+
+	slot = radix_tree_lookup_slot(&tree, index);
+	CHECK(slot && radix_tree_deref_slot(slot) == item(index));
+	for (i = index; i - index < size; i++) {
+		CHECK(radix_tree_lookup(&tree, i) == item(index));
+		CHECK(radix_tree_lookup_slot(&tree, i) == slot);
+	}
+	if (index)
+		CHECK(!radix_tree_lookup(&tree, index - 1));
+	if (last != ULONG_MAX)
+		CHECK(!radix_tree_lookup(&tree, last + 1));
+
+	/* A gang lookup from the middle returns the covering entry, once */
+	CHECK(radix_tree_gang_lookup(&tree, results, index + size / 2,
+				     ARRAY_SIZE(results)) == 1);
+	CHECK(results[0] == item(index));
+	CHECK(radix_tree_gang_lookup_slot(&tree, (void ***)results, &found,
+					  0, ARRAY_SIZE(results)) == 1);
+	CHECK(results[0] == slot && found == index);
+
+	/* Tags are shared by all the indices of the entry */
+	CHECK(radix_tree_tag_set(&tree, last, TEST_TAG) == item(index));
+	CHECK(radix_tree_tag_get(&tree, index, TEST_TAG));
+	CHECK(radix_tree_tag_get(&tree, index + size / 2, TEST_TAG));
+	CHECK(radix_tree_gang_lookup_tag(&tree, results, last,
+					 ARRAY_SIZE(results), TEST_TAG) == 1);
+	CHECK(results[0] == item(index));
+
+	first = index + size / 2;
+	CHECK(radix_tree_range_tag_if_tagged(&tree, &first, last, 16,
+					     TEST_TAG, TEST_TAG2) == 1);
+	CHECK(radix_tree_tag_get(&tree, index, TEST_TAG2));
+
+	CHECK(radix_tree_tag_clear(&tree, index + size / 2, TEST_TAG) ==
+	      item(index));
+	CHECK(!radix_tree_tag_get(&tree, last, TEST_TAG));
+	CHECK(!radix_tree_tagged(&tree, TEST_TAG));
+
+	/* Deleting it by any index covered, also drops the remaining tag */
+	CHECK(radix_tree_delete(&tree, last) == item(index));
+	CHECK(!radix_tree_lookup(&tree, index));
+	CHECK(!radix_tree_tagged(&tree, TEST_TAG2));
+	CHECK(tree_empty(&tree));
+}
+
+static void __init test_multiorder(void)
+{
+	unsigned int order;
+
+	for (order = 0; order <= 2 * RADIX_TREE_MAP_SHIFT + 2; order++) {
+		test_multiorder_at(0, order);
+		test_multiorder_at(3UL << order, order);
+		test_multiorder_at(1UL << (BITS_PER_LONG - 2), order);
+		cond_resched();
+	}
+}
+
+/* Entries of different orders must not overlap */
+static void __init test_overlap(void)
+{
+	RADIX_TREE(tree, GFP_KERNEL);
+
+	CHECK(radix_tree_insert(&tree, 70, item(70)) == 0);
+	CHECK(__radix_tree_insert(&tree, 64, RADIX_TREE_MAP_SHIFT,
+				  item(64)) == -EEXIST);
+	CHECK(__radix_tree_insert(&tree, 68, 2, item(68)) == -EEXIST);
+	CHECK(__radix_tree_insert(&tree, 0, RADIX_TREE_MAP_SHIFT + 1,
+				  item(0)) == -EEXIST);
+	CHECK(__radix_tree_insert(&tree, 0, 2 * RADIX_TREE_MAP_SHIFT,
+				  item(0)) == -EEXIST);
+	CHECK(__radix_tree_insert(&tree, 72, 3, item(72)) == 0);
+	CHECK(__radix_tree_insert(&tree, 0, RADIX_TREE_MAP_SHIFT,
+				  item(0)) == 0);
+
+	CHECK(radix_tree_lookup(&tree, 63) == item(0));
+	CHECK(radix_tree_lookup(&tree, 69) == NULL);
+	CHECK(radix_tree_lookup(&tree, 70) == item(70));
+	CHECK(radix_tree_lookup(&tree, 79) == item(72));
+
+	CHECK(radix_tree_delete(&tree, 5) == item(0));
+	CHECK(radix_tree_delete(&tree, 75) == item(72));
+	CHECK(radix_tree_delete(&tree, 70) == item(70));
+	CHECK(tree_empty(&tree));
+}
+
+/*
+ * Fill a range with entries of assorted orders, and check that gang
+ * lookups in small batches see each of them once, in index order.
+ */
+static void __init test_mixed(void)
+{
+	static const unsigned int orders[] = { 0, 9, 0, 1, 6, 0, 2, 12, 3, 0 };
+	RADIX_TREE(tree, GFP_KERNEL);
+	unsigned long start[4 * ARRAY_SIZE(orders)], end[ARRAY_SIZE(start)];
+	unsigned long indices[3], index, next;
+	void **slots[3];
+	unsigned int i, nr, found;
+	void *results[3];
+
+	index = 0;
+	for (i = 0; i < ARRAY_SIZE(start); i++) {
+		unsigned int order = orders[i % ARRAY_SIZE(orders)];
+
+		index = ALIGN(index, 1UL << order);
+		CHECK(__radix_tree_insert(&tree, index, order,
+					  item(index)) == 0);
+		if (i % 3 == 0)
+			radix_tree_tag_set(&tree, index, TEST_TAG);
+		start[i] = index;
+		end[i] = index + (1UL << order);
+		/* Leave a hole after some of them */
+		index = end[i] + (i & 1);
+	}
+
+	next = 0;
+	found = 0;
+	while ((nr = radix_tree_gang_lookup_slot(&tree, slots, indices, next,
+						 ARRAY_SIZE(slots)))) {
+		for (i = 0; i < nr && found < ARRAY_SIZE(start); i++) {
+			CHECK(indices[i] == start[found]);
+			CHECK(radix_tree_deref_slot(slots[i]) ==
+			      item(indices[i]));
+			next = end[found++];
+		}
+	}
+	CHECK(found == ARRAY_SIZE(start));
+
+	next = 0;
+	found = 0;
+	while ((nr = radix_tree_gang_lookup_tag(&tree, results, next,
+						ARRAY_SIZE(results),
+						TEST_TAG))) {
+		for (i = 0; i < nr && found < ARRAY_SIZE(start); i++) {
+			CHECK(results[i] == item(start[found]));
+			next = end[found];
+			found += 3;
+		}
+	}
+	CHECK(found == roundup(ARRAY_SIZE(start), 3));
+
+	next = 0;
+	while ((nr = radix_tree_gang_lookup(&tree, results, next,
+					    ARRAY_SIZE(results)))) {
+		for (i = 0; i < nr; i++) {
+			next = item_index(results[i]);
+			CHECK(radix_tree_delete(&tree, next) == results[i]);
+		}
+	}
+	CHECK(!radix_tree_tagged(&tree, TEST_TAG));
+	CHECK(tree_empty(&tree));
+}
+
+/* A multi-order entry must keep its height when the tree shrinks */
+static void __init test_shrink(void)
+{
+	RADIX_TREE(tree, GFP_KERNEL);
+	unsigned long far = 1UL << (3 * RADIX_TREE_MAP_SHIFT);
+
+	CHECK(__radix_tree_insert(&tree, 0, RADIX_TREE_MAP_SHIFT,
+				  item(0)) == 0);
+	CHECK(tree.height == 2);
+	CHECK(radix_tree_insert(&tree, far, item(far)) == 0);
+	CHECK(tree.height == 4);
+	CHECK(radix_tree_delete(&tree, far) == item(far));
+	CHECK(tree.height == 2);
+	CHECK(radix_tree_lookup(&tree, RADIX_TREE_MAP_MASK) == item(0));
+	CHECK(!radix_tree_lookup(&tree, RADIX_TREE_MAP_SIZE));
+	CHECK(radix_tree_delete(&tree, 1) == item(0));
+	CHECK(tree_empty(&tree));
+}
+
+static u64 __init elapsed_ns(ktime_t start, unsigned long nr)
+{
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), nr);
+}
+
+/*
+ * Time insertion, lookup of every index, gang lookup and tagging in a
+ * tree covering BENCH_SIZE indices with entries of @order.
+ */
+static void __init benchmark(unsigned int order)
+{
+	RADIX_TREE(tree, GFP_KERNEL);
+	unsigned long mask = (1UL << order) - 1;
+	unsigned long nr_entries = BENCH_SIZE >> order;
+	unsigned long index, found;
+	u64 insert_ns, lookup_ns, gang_ns, tag_ns, tag_gang_ns;
+	void *results[16];
+	unsigned int nr;
+	ktime_t start;
+
+	start = ktime_get();
+	for (index = 0; index < BENCH_SIZE; index += mask + 1) {
+		if (__radix_tree_insert(&tree, index, order, item(index))) {
+			CHECK(0);
+			goto out;
+		}
+	}
+	insert_ns = elapsed_ns(start, nr_entries);
+
+	found = 0;
+	start = ktime_get();
+	rcu_read_lock();
+	for (index = 0; index < BENCH_SIZE; index++)
+		if (radix_tree_lookup(&tree, index) == item(index & ~mask))
+			found++;
+	rcu_read_unlock();
+	lookup_ns = elapsed_ns(start, BENCH_SIZE);
+	CHECK(found == BENCH_SIZE);
+
+	found = 0;
+	index = 0;
+	start = ktime_get();
+	rcu_read_lock();
+	while ((nr = radix_tree_gang_lookup(&tree, results, index,
+					    ARRAY_SIZE(results)))) {
+		found += nr;
+		index = item_index(results[nr - 1]) + mask + 1;
+	}
+	rcu_read_unlock();
+	gang_ns = elapsed_ns(start, nr_entries);
+	CHECK(found == nr_entries);
+
+	start = ktime_get();
+	for (index = 0; index < BENCH_SIZE; index += mask + 1)
+		radix_tree_tag_set(&tree, index, TEST_TAG);
+	tag_ns = elapsed_ns(start, nr_entries);
+
+	found = 0;
+	index = 0;
+	start = ktime_get();
+	rcu_read_lock();
+	while ((nr = radix_tree_gang_lookup_tag(&tree, results, index,
+						ARRAY_SIZE(results),
+						TEST_TAG))) {
+		found += nr;
+		index = item_index(results[nr - 1]) + mask + 1;
+	}
+	rcu_read_unlock();
+	tag_gang_ns = elapsed_ns(start, nr_entries);
+	CHECK(found == nr_entries);
+
+	printk(KERN_INFO "radix_tree_test: %lu entries of order %u: "
+	       "insert %llu, lookup %llu (per index), gang lookup %llu, "
+	       "tag %llu, tagged gang lookup %llu ns\n",
+	       nr_entries, order, insert_ns, lookup_ns, gang_ns, tag_ns,
+	       tag_gang_ns);
+out:
+	for (index = 0; index < BENCH_SIZE; index += mask + 1)
+		radix_tree_delete(&tree, index);
+	CHECK(tree_empty(&tree));
+}
+
+static int __init radix_tree_test(void)
+{
+	test_order0();
+	test_multiorder();
+	test_overlap();
+	test_mixed();
+	test_shrink();
+
+	if (!failed) {
+		benchmark(0);
+		benchmark(BENCH_ORDER);
+	}
+
+	if (failed) {
+		printk(KERN_ERR "radix_tree_test: %d checks failed\n", failed);
+		return -EINVAL;
+	}
+	printk(KERN_INFO "radix_tree_test: passed\n");
+	return 0;
+}
+module_init(radix_tree_test);
@@ -32,27 +32,6 @@
 #include <linux/bitops.h>
 #include <linux/rcupdate.h>
 
-
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	struct rcu_head	rcu_head;
-	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
 struct radix_tree_path {
 	struct radix_tree_node *node;
 	int offset;
@@ -92,6 +71,96 @@ static inline void *indirect_to_ptr(void *ptr)
 	return (void *)((unsigned long)ptr & ~RADIX_TREE_INDIRECT_PTR);
 }
 
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+/*
+ * A multi-order entry covers a naturally aligned range of 1 << order
+ * indices.  It lives in the node whose slots each cover the largest power
+ * of RADIX_TREE_MAP_SIZE indices not above that, and takes as many of its
+ * slots as needed: the first one holds the item, the others hold sibling
+ * entries.  A sibling entry is an indirect pointer to that first slot, so
+ * unlike a pointer to a child node it points inside its own node.
+ *
+ * Tags are only set on the first slot of an entry.
+ */
+static inline int is_sibling_entry(struct radix_tree_node *node, void *entry)
+{
+	unsigned long ptr = (unsigned long)indirect_to_ptr(entry);
+
+	return radix_tree_is_indirect_ptr(entry) &&
+		ptr - (unsigned long)node->slots < sizeof(node->slots);
+}
+
+static inline unsigned long sibling_offset(struct radix_tree_node *node,
+					   void *entry)
+{
+	return (void **)indirect_to_ptr(entry) - (void **)node->slots;
+}
+
+/* Number of slots taken by the entry at @offset, siblings included */
+static inline unsigned int entry_slots(struct radix_tree_node *node,
+				       unsigned long offset)
+{
+	void *sibling = ptr_to_indirect(&node->slots[offset]);
+	unsigned int nr = 1;
+
+	while (offset + nr < RADIX_TREE_MAP_SIZE &&
+	       node->slots[offset + nr] == sibling)
+		nr++;
+	return nr;
+}
+#else
+static inline int is_sibling_entry(struct radix_tree_node *node, void *entry)
+{
+	return 0;
+}
+
+static inline unsigned long sibling_offset(struct radix_tree_node *node,
+					   void *entry)
+{
+	return 0;
+}
+
+static inline unsigned int entry_slots(struct radix_tree_node *node,
+				       unsigned long offset)
+{
+	return 1;
+}
+#endif
+
+/*
+ * Return the entry in @node which covers @index, with the node's slots
+ * covering 1 << @shift indices each, and store its slot offset in
+ * @offsetp.  A sibling entry is followed to the first slot of its
+ * multi-order entry.
+ */
+static inline void *radix_tree_descend(struct radix_tree_node *node,
+				       unsigned long index, unsigned int shift,
+				       unsigned long *offsetp)
+{
+	unsigned long offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+	void *entry = rcu_dereference_raw(node->slots[offset]);
+
+	if (is_sibling_entry(node, entry)) {
+		offset = sibling_offset(node, entry);
+		entry = rcu_dereference_raw(node->slots[offset]);
+		/* Lockless lookup raced with the entry's slots being reused */
+		if (radix_tree_is_indirect_ptr(entry))
+			entry = NULL;
+	}
+	*offsetp = offset;
+	return entry;
+}
+
+/*
+ * Above the bottom level of the tree, an indirect pointer is a child node.
+ * At the bottom level it can only be the item left behind in a node freed
+ * by radix_tree_shrink(), which lockless lookups may still come across.
+ */
+static inline int entry_is_node(void *entry, unsigned int height)
+{
+	return height > 1 && radix_tree_is_indirect_ptr(entry);
+}
+
 static inline gfp_t root_gfp_mask(struct radix_tree_root *root)
 {
 	return root->gfp_mask & __GFP_BITS_MASK;
@@ -251,9 +320,11 @@ static inline unsigned long radix_tree_maxindex(unsigned int height)
 }
 
 /*
- *	Extend a radix tree so it can store key @index.
+ *	Extend a radix tree so it can store key @index, and an entry of
+ *	@order in a slot of a node.
  */
-static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+static int radix_tree_extend(struct radix_tree_root *root,
+			     unsigned long index, unsigned int order)
 {
 	struct radix_tree_node *node;
 	unsigned int height;
@@ -261,7 +332,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 
 	/* Figure out what the height should be.  */
 	height = root->height + 1;
-	while (index > radix_tree_maxindex(height))
+	while (index > radix_tree_maxindex(height) ||
+	       (order && height * RADIX_TREE_MAP_SHIFT <= order))
 		height++;
 
 	if (root->rnode == NULL) {
@@ -275,7 +347,7 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 			return -ENOMEM;
 
 		/* Increase the height.  */
-		node->slots[0] = indirect_to_ptr(root->rnode);
+		node->slots[0] = root->rnode;
 
 		/* Propagate the aggregated tag info into the new root */
 		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
@@ -295,48 +367,65 @@ out:
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	__radix_tree_insert    -    insert into a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@order:		log2 of the number of indices covered by @item
  *	@item:		item to insert
  *
- *	Insert an item into the radix tree at position @index.
+ *	Insert an item into the radix tree at position @index, which must be
+ *	aligned to 1 << @order.  Until it is deleted, lookups of any index in
+ *	the range covered return @item.  Orders other than 0 need
+ *	CONFIG_RADIX_TREE_MULTIORDER.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int __radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+			unsigned int order, void *item)
 {
 	struct radix_tree_node *node = NULL, *slot;
-	unsigned int height, shift;
+	unsigned int height, shift, nr, i;
+	unsigned int level = order / RADIX_TREE_MAP_SHIFT;
+	unsigned long last = index + (1UL << order) - 1;
 	int offset;
 	int error;
 
 	BUG_ON(radix_tree_is_indirect_ptr(item));
+	BUG_ON(index & ((1UL << order) - 1));
+#ifndef CONFIG_RADIX_TREE_MULTIORDER
+	BUG_ON(order);
+#endif
 
 	/* Make sure the tree is high enough.  */
-	if (index > radix_tree_maxindex(root->height)) {
-		error = radix_tree_extend(root, index);
+	if (last > radix_tree_maxindex(root->height) ||
+	    (order && root->height <= level)) {
+		error = radix_tree_extend(root, last, order);
 		if (error)
 			return error;
 	}
 
-	slot = indirect_to_ptr(root->rnode);
+	slot = root->rnode;
 
 	height = root->height;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
 	offset = 0;			/* uninitialised var warning */
-	while (height > 0) {
+	while (height > level) {
 		if (slot == NULL) {
 			/* Have to add a child node.  */
 			if (!(slot = radix_tree_node_alloc(root)))
 				return -ENOMEM;
 			slot->height = height;
 			if (node) {
-				rcu_assign_pointer(node->slots[offset], slot);
+				rcu_assign_pointer(node->slots[offset],
+						   ptr_to_indirect(slot));
 				node->count++;
 			} else
 				rcu_assign_pointer(root->rnode, ptr_to_indirect(slot));
-		}
+		} else if (!radix_tree_is_indirect_ptr(slot) ||
+			   (node && is_sibling_entry(node, slot))) {
+			/* A multi-order entry already covers @index */
+			return -EEXIST;
+		} else
+			slot = indirect_to_ptr(slot);
 
 		/* Go a level down */
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
@@ -350,8 +439,15 @@ int radix_tree_insert(struct radix_tree_root *root,
 		return -EEXIST;
 
 	if (node) {
-		node->count++;
+		nr = 1 << (order - level * RADIX_TREE_MAP_SHIFT);
+		for (i = 1; i < nr; i++)
+			if (node->slots[offset + i])
+				return -EEXIST;
+		node->count += nr;
 		rcu_assign_pointer(node->slots[offset], item);
+		for (i = 1; i < nr; i++)
+			rcu_assign_pointer(node->slots[offset + i],
+					   ptr_to_indirect(&node->slots[offset]));
 		BUG_ON(tag_get(node, 0, offset));
 		BUG_ON(tag_get(node, 1, offset));
 	} else {
@@ -362,7 +458,7 @@ int radix_tree_insert(struct radix_tree_root *root,
 
 	return 0;
 }
-EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(__radix_tree_insert);
 
 /*
  * is_slot == 1 : search for the slot.
@@ -372,18 +468,20 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
 				unsigned long index, int is_slot)
 {
 	unsigned int height, shift;
-	struct radix_tree_node *node, **slot;
+	struct radix_tree_node *node;
+	unsigned long offset;
+	void *entry;
 
-	node = rcu_dereference_raw(root->rnode);
-	if (node == NULL)
+	entry = rcu_dereference_raw(root->rnode);
+	if (entry == NULL)
 		return NULL;
 
-	if (!radix_tree_is_indirect_ptr(node)) {
+	if (!radix_tree_is_indirect_ptr(entry)) {
 		if (index > 0)
 			return NULL;
-		return is_slot ? (void *)&root->rnode : node;
+		return is_slot ? (void *)&root->rnode : entry;
 	}
-	node = indirect_to_ptr(node);
+	node = indirect_to_ptr(entry);
 
 	height = node->height;
 	if (index > radix_tree_maxindex(height))
@@ -391,18 +489,77 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
-	do {
-		slot = (struct radix_tree_node **)
-			(node->slots + ((index>>shift) & RADIX_TREE_MAP_MASK));
-		node = rcu_dereference_raw(*slot);
-		if (node == NULL)
+	for (;;) {
+		entry = radix_tree_descend(node, index, shift, &offset);
+		if (entry == NULL)
+			return NULL;
+		if (!entry_is_node(entry, height))
+			break;
+
+		node = indirect_to_ptr(entry);
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	return is_slot ? (void *)&node->slots[offset] : indirect_to_ptr(entry);
+}
+
+/**
+ *	__radix_tree_lookup	-	lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns the bottom-level node of the item, if any
+ *	@slotp:		returns the slot of the item
+ *
+ *	Lookup the item at the position @index in the radix tree @root, and
+ *	return it together with its slot and the node that slot lives in.
+ *	@nodep is set to NULL if the item is stored directly in the root.
+ *
+ *	Unlike radix_tree_lookup(), the caller must hold the tree write
+ *	locked: the node is only stable as long as the tree is not modified.
+ */
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
+{
+	struct radix_tree_node *node;
+	unsigned int height, shift;
+	unsigned long offset;
+	void *entry;
+
+	entry = rcu_dereference_raw(root->rnode);
+	if (entry == NULL)
+		return NULL;
+
+	if (!radix_tree_is_indirect_ptr(entry)) {
+		if (index > 0)
+			return NULL;
+		*nodep = NULL;
+		*slotp = (void **)&root->rnode;
+		return entry;
+	}
+	node = indirect_to_ptr(entry);
+
+	height = node->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+
+	for (;;) {
+		entry = radix_tree_descend(node, index, shift, &offset);
+		if (entry == NULL)
 			return NULL;
+		if (!entry_is_node(entry, height))
+			break;
 
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
-	} while (height > 0);
+	}
 
-	return is_slot ? (void *)slot : indirect_to_ptr(node);
+	*nodep = node;
+	*slotp = (void **)&node->slots[offset];
+	return entry;
 }
 
 /**
@@ -429,7 +586,8 @@ EXPORT_SYMBOL(radix_tree_lookup_slot);
  *	@root:		radix tree root
  *	@index:		index key
  *
- *	Lookup the item at the position @index in the radix tree @root.
+ *	Lookup the item at the position @index in the radix tree @root.  If
+ *	a multi-order item covers @index, that item is returned.
  *
  *	This function can be called under rcu_read_lock, however the caller
  *	must manage lifetimes of leaf nodes (eg. RCU may also be used to free
@@ -464,17 +622,19 @@ void *radix_tree_tag_set(struct radix_tree_root *root,
 	height = root->height;
 	BUG_ON(index > radix_tree_maxindex(height));
 
-	slot = indirect_to_ptr(root->rnode);
+	slot = root->rnode;
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 
 	while (height > 0) {
-		int offset;
+		struct radix_tree_node *node = indirect_to_ptr(slot);
+		unsigned long offset;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!tag_get(slot, tag, offset))
-			tag_set(slot, tag, offset);
-		slot = slot->slots[offset];
+		slot = radix_tree_descend(node, index, shift, &offset);
+		if (!tag_get(node, tag, offset))
+			tag_set(node, tag, offset);
 		BUG_ON(slot == NULL);
+		if (!entry_is_node(slot, height))
+			break;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -518,19 +678,22 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 	pathp->node = NULL;
-	slot = indirect_to_ptr(root->rnode);
+	slot = root->rnode;
 
 	while (height > 0) {
-		int offset;
+		struct radix_tree_node *node;
+		unsigned long offset;
 
 		if (slot == NULL)
 			goto out;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		node = indirect_to_ptr(slot);
+		slot = radix_tree_descend(node, index, shift, &offset);
 		pathp[1].offset = offset;
-		pathp[1].node = slot;
-		slot = slot->slots[offset];
+		pathp[1].node = node;
 		pathp++;
+		if (!entry_is_node(slot, height))
+			break;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -597,12 +760,10 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 
 	for ( ; ; ) {
-		int offset;
-
-		if (node == NULL)
-			return 0;
+		unsigned long offset;
+		void *entry;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		entry = radix_tree_descend(node, index, shift, &offset);
 
 		/*
 		 * This is just a debug check.  Later, we can bale as soon as
@@ -610,9 +771,9 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 		 */
 		if (!tag_get(node, tag, offset))
 			saw_unset_tag = 1;
-		if (height == 1)
+		if (!entry_is_node(entry, height))
 			return !!tag_get(node, tag, offset);
-		node = rcu_dereference_raw(node->slots[offset]);
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -685,20 +846,21 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 	path[height - 1].node = NULL;
 
 	for (;;) {
-		int offset;
+		unsigned long offset;
+		void *entry;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!slot->slots[offset])
+		entry = radix_tree_descend(slot, index, shift, &offset);
+		if (!entry)
 			goto next;
 		if (!tag_get(slot, iftag, offset))
 			goto next;
-		if (height > 1) {
+		if (entry_is_node(entry, height)) {
 			/* Go down one level */
 			height--;
 			shift -= RADIX_TREE_MAP_SHIFT;
 			path[height - 1].node = slot;
 			path[height - 1].offset = offset;
-			slot = slot->slots[offset];
+			slot = indirect_to_ptr(entry);
 			continue;
 		}
 
@@ -706,8 +868,12 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 		tagged++;
 		tag_set(slot, settag, offset);
 
+		/* Skip the rest of a multi-order entry */
+		index = (((index >> shift) & ~RADIX_TREE_MAP_MASK) |
+			 (offset + entry_slots(slot, offset) - 1)) << shift;
+
 		/* walk back up the path tagging interior nodes */
-		pathp = &path[0];
+		pathp = &path[height - 1];
 		while (pathp->node) {
 			/* stop if we find a node with the tag already set */
 			if (tag_get(pathp->node, settag, pathp->offset))
@@ -822,46 +988,51 @@ unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
 EXPORT_SYMBOL(radix_tree_prev_hole);
 
 static unsigned int
-__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index)
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long *indices,
+	unsigned long index, unsigned int max_items, unsigned long *next_index)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
-	unsigned long i;
 
 	height = slot->height;
 	if (height == 0)
 		goto out;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
-	for ( ; height > 1; height--) {
-		i = (index >> shift) & RADIX_TREE_MAP_MASK;
-		for (;;) {
-			if (slot->slots[i] != NULL)
-				break;
-			index &= ~((1UL << shift) - 1);
-			index += 1UL << shift;
-			if (index == 0)
-				goto out;	/* 32-bit wraparound */
-			i++;
-			if (i == RADIX_TREE_MAP_SIZE)
-				goto out;
-		}
-
-		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = rcu_dereference_raw(slot->slots[i]);
-		if (slot == NULL)
-			goto out;
-	}
+	for (;;) {
+		unsigned long offset, nr = 1;
+		void *entry;
 
-	/* Bottom level: grab some items */
-	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
-		index++;
-		if (slot->slots[i]) {
-			results[nr_found++] = &(slot->slots[i]);
-			if (nr_found == max_items)
-				goto out;
+		entry = radix_tree_descend(slot, index, shift, &offset);
+		if (entry == NULL)
+			goto next;
+		if (entry_is_node(entry, height)) {
+			/* Go a level down */
+			slot = indirect_to_ptr(entry);
+			shift -= RADIX_TREE_MAP_SHIFT;
+			height--;
+			continue;
 		}
+
+		/*
+		 * Grab the item, reporting a multi-order one at its first
+		 * index even if the lookup started in its middle.
+		 */
+		index = ((index >> shift) - ((index >> shift) &
+				RADIX_TREE_MAP_MASK) + offset) << shift;
+		nr = entry_slots(slot, offset);
+		results[nr_found] = &(slot->slots[offset]);
+		if (indices)
+			indices[nr_found] = index;
+		nr_found++;
+next:
+		index = ((index >> shift) + nr) << shift;
+		if (index == 0)
+			break;		/* 32-bit wraparound */
+		if (nr_found == max_items)
+			break;
+		if (((index >> shift) & RADIX_TREE_MAP_MASK) == 0)
+			break;		/* end of this node */
 	}
 out:
 	*next_index = index;
@@ -877,7 +1048,8 @@ out:
  *
  *	Performs an index-ascending scan of the tree for present items.  Places
  *	them at *@results and returns the number of items which were placed at
- *	*@results.
+ *	*@results.  A multi-order item is placed once, also when @first_index
+ *	is in its middle.
  *
  *	The implementation is naive.
  *
@@ -917,8 +1089,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, (void ***)results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, (void ***)results + ret, NULL,
+				cur_index, max_items - ret, &next_index);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
 			struct radix_tree_node *slot;
@@ -943,12 +1115,14 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  *	radix_tree_gang_lookup_slot - perform multiple slot lookup on radix tree
  *	@root:		radix tree root
  *	@results:	where the results of the lookup are placed
+ *	@indices:	where their indices should be placed (but usually NULL)
  *	@first_index:	start the lookup from this key
  *	@max_items:	place up to this many items at *results
  *
  *	Performs an index-ascending scan of the tree for present items.  Places
  *	their slots at *@results and returns the number of items which were
- *	placed at *@results.
+ *	placed at *@results.  The index of a multi-order item is the first
+ *	one it covers.
  *
  *	The implementation is naive.
  *
@@ -958,6 +1132,7 @@ EXPORT_SYMBOL(radix_tree_gang_lookup);
  */
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
+			unsigned long *indices,
 			unsigned long first_index, unsigned int max_items)
 {
 	unsigned long max_index;
@@ -973,6 +1148,8 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 		if (first_index > 0)
 			return 0;
 		results[0] = (void **)&root->rnode;
+		if (indices)
+			indices[0] = 0;
 		return 1;
 	}
 	node = indirect_to_ptr(node);
@@ -986,8 +1163,9 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, results + ret,
+				indices ? indices + ret : NULL,
+				cur_index, max_items - ret, &next_index);
 		ret += slots_found;
 		if (next_index == 0)
 			break;
@@ -998,10 +1176,6 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 }
 EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
 
-/*
- * FIXME: the two tag_get()s here should use find_next_bit() instead of
- * open-coding the search.
- */
 static unsigned int
 __lookup_tag(struct radix_tree_node *slot, void ***results, unsigned long index,
 	unsigned int max_items, unsigned long *next_index, unsigned int tag)
@@ -1014,49 +1188,46 @@ __lookup_tag(struct radix_tree_node *slot, void ***results, unsigned long index,
 		goto out;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
-	while (height > 0) {
-		unsigned long i = (index >> shift) & RADIX_TREE_MAP_MASK ;
+	for (;;) {
+		unsigned long offset, nr = 1;
+		void *entry;
 
-		for (;;) {
-			if (tag_get(slot, tag, i))
-				break;
-			index &= ~((1UL << shift) - 1);
-			index += 1UL << shift;
-			if (index == 0)
-				goto out;	/* 32-bit wraparound */
-			i++;
-			if (i == RADIX_TREE_MAP_SIZE)
-				goto out;
-		}
-		height--;
-		if (height == 0) {	/* Bottom level: grab some items */
-			unsigned long j = index & RADIX_TREE_MAP_MASK;
-
-			for ( ; j < RADIX_TREE_MAP_SIZE; j++) {
-				index++;
-				if (!tag_get(slot, tag, j))
-					continue;
-				/*
-				 * Even though the tag was found set, we need to
-				 * recheck that we have a non-NULL node, because
-				 * if this lookup is lockless, it may have been
-				 * subsequently deleted.
-				 *
-				 * Similar care must be taken in any place that
-				 * lookup ->slots[x] without a lock (ie. can't
-				 * rely on its value remaining the same).
-				 */
-				if (slot->slots[j]) {
-					results[nr_found++] = &(slot->slots[j]);
-					if (nr_found == max_items)
-						goto out;
-				}
-			}
+		entry = radix_tree_descend(slot, index, shift, &offset);
+		if (!tag_get(slot, tag, offset))
+			goto next;
+		/*
+		 * Even though the tag was found set, we need to
+		 * recheck that we have a non-NULL node, because
+		 * if this lookup is lockless, it may have been
+		 * subsequently deleted.
+		 *
+		 * Similar care must be taken in any place that
+		 * lookup ->slots[x] without a lock (ie. can't
+		 * rely on its value remaining the same).
+		 */
+		if (entry == NULL)
+			goto next;
+		if (entry_is_node(entry, height)) {
+			/* Go a level down */
+			slot = indirect_to_ptr(entry);
+			shift -= RADIX_TREE_MAP_SHIFT;
+			height--;
+			continue;
 		}
-		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = rcu_dereference_raw(slot->slots[i]);
-		if (slot == NULL)
+
+		/* Grab the item, as in __lookup() */
+		index = ((index >> shift) - ((index >> shift) &
+				RADIX_TREE_MAP_MASK) + offset) << shift;
+		nr = entry_slots(slot, offset);
+		results[nr_found++] = &(slot->slots[offset]);
+next:
+		index = ((index >> shift) + nr) << shift;
+		if (index == 0)
+			break;		/* 32-bit wraparound */
+		if (nr_found == max_items)
 			break;
+		if (((index >> shift) & RADIX_TREE_MAP_MASK) == 0)
+			break;		/* end of this node */
 	}
 out:
 	*next_index = index;
@@ -1216,6 +1387,10 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 			break;
 		if (!to_free->slots[0])
 			break;
+		/* An item above the bottom level must stay at its height */
+		if (root->height > 1 &&
+		    !radix_tree_is_indirect_ptr(to_free->slots[0]))
+			break;
 
 		/*
 		 * We don't need rcu_assign_pointer(), since we are simply
@@ -1225,8 +1400,6 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 * one (root->rnode) as far as dependent read barriers go.
 		 */
 		newptr = to_free->slots[0];
-		if (root->height > 1)
-			newptr = ptr_to_indirect(newptr);
 		root->rnode = newptr;
 		root->height--;
 
@@ -1261,7 +1434,8 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
  *	@root:		radix tree root
  *	@index:		index key
  *
- *	Remove the item at @index from the radix tree rooted at @root.
+ *	Remove the item at @index from the radix tree rooted at @root.  A
+ *	multi-order item may be removed by any index it covers.
  *
  *	Returns the address of the deleted item, or NULL if it was not present.
  */
@@ -1274,9 +1448,8 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 	struct radix_tree_path path[RADIX_TREE_MAX_PATH + 1], *pathp = path;
 	struct radix_tree_node *slot = NULL;
 	struct radix_tree_node *to_free;
-	unsigned int height, shift;
+	unsigned int height, shift, nr;
 	int tag;
-	int offset;
 
 	height = root->height;
 	if (index > radix_tree_maxindex(height))
@@ -1288,23 +1461,27 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 		root->rnode = NULL;
 		goto out;
 	}
-	slot = indirect_to_ptr(slot);
 
 	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
 	pathp->node = NULL;
 
-	do {
+	for (;;) {
+		struct radix_tree_node *node;
+		unsigned long offset;
+
 		if (slot == NULL)
 			goto out;
 
+		node = indirect_to_ptr(slot);
+		slot = radix_tree_descend(node, index, shift, &offset);
 		pathp++;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		pathp->offset = offset;
-		pathp->node = slot;
-		slot = slot->slots[offset];
+		pathp->node = node;
+		if (!entry_is_node(slot, height))
+			break;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
-	} while (height > 0);
+	}
 
 	if (slot == NULL)
 		goto out;
@@ -1319,9 +1496,12 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 
 	to_free = NULL;
 	/* Now free the nodes we do not need anymore */
+	nr = entry_slots(pathp->node, pathp->offset);
 	while (pathp->node) {
-		pathp->node->slots[pathp->offset] = NULL;
-		pathp->node->count--;
+		pathp->node->count -= nr;
+		while (nr--)
+			pathp->node->slots[pathp->offset + nr] = NULL;
+		nr = 1;
 		/*
 		 * Queue the node for deferred freeing after the
 		 * last reference to it disappears (set NULL, above).
@@ -1363,9 +1543,12 @@ int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag)
 EXPORT_SYMBOL(radix_tree_tagged);
 
 static void
-radix_tree_node_ctor(void *node)
+radix_tree_node_ctor(void *arg)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *node = arg;
+
+	memset(node, 0, sizeof(*node));
+	INIT_LIST_HEAD(&node->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
@@ -198,6 +198,24 @@ static void __init __free_pages_memory(unsigned long start, unsigned long end)
 		__free_pages_bootmem(pfn_to_page(i), 0);
 }
 
+/*
+ * Pages whose struct page initialisation was deferred are left for
+ * pgdatinit to free: hand over only the runs of the range before that.
+ */
+static void __init __free_pages_memory_early(unsigned long start,
+					     unsigned long end)
+{
+	while (start < end) {
+		unsigned long next;
+		int nid;
+
+		next = deferred_pfn_run(start, end, &nid);
+		if (nid < 0)
+			__free_pages_memory(start, next);
+		start = next;
+	}
+}
+
 unsigned long __init free_all_memory_core_early(int nodeid)
 {
 	int i;
@@ -206,13 +224,36 @@ unsigned long __init free_all_memory_core_early(int nodeid)
 	struct range *range = NULL;
 	int nr_range;
 
+	/*
+	 * Reserved memory keeps its struct pages, and they may be looked
+	 * at before the deferred ones are initialised: do them now, only
+	 * those of this node unless we are releasing all of them.
+	 */
+	for (i = 0; i < memblock.reserved.cnt; i++) {
+		struct memblock_region *r = &memblock.reserved.regions[i];
+
+		start = r->base;
+		end = r->base + r->size;
+		if (nodeid != MAX_NUMNODES) {
+			pg_data_t *pgdat = NODE_DATA(nodeid);
+			unsigned long pfn = pgdat->node_start_pfn;
+
+			start = max_t(u64, start, PFN_PHYS(pfn));
+			pfn += pgdat->node_spanned_pages;
+			end = min_t(u64, end, PFN_PHYS(pfn));
+			if (start >= end)
+				continue;
+		}
+		reserve_bootmem_region(start, end);
+	}
+
 	nr_range = get_free_all_memory_range(&range, nodeid);
 
 	for (i = 0; i < nr_range; i++) {
 		start = range[i].start;
 		end = range[i].end;
 		count += end - start;
-		__free_pages_memory(start, end);
+		__free_pages_memory_early(start, end);
 	}
 
 	return count;
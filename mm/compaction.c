@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 /*
@@ -37,6 +39,7 @@ struct compact_control {
 
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
+	unsigned long nr_target;	/* free blocks of order kcompactd wants */
 	struct zone *zone;
 };
 
@@ -340,6 +343,18 @@ static void update_nr_listpages(struct compact_control *cc)
 	cc->nr_freepages = nr_freepages;
 }
 
+/* Number of free blocks of at least the given order in a zone */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr_blocks = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr_blocks += zone->free_area[o].nr_free << (o - order);
+
+	return nr_blocks;
+}
+
 static int compact_finished(struct zone *zone,
 						struct compact_control *cc)
 {
@@ -360,6 +375,13 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/* Background compactor: Are there enough free blocks? */
+	if (cc->nr_target) {
+		if (zone_free_blocks(zone, cc->order) >= cc->nr_target)
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
 		/* Job done if page is free of the right migratetype */
@@ -582,6 +604,285 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * Background compaction. Each node with memory has a kcompactd thread that
+ * is woken by kswapd when it finishes reclaiming for a high-order
+ * allocation, so that the allocation finds a free block next time instead
+ * of stalling in direct compaction. In addition, every
+ * compaction_proactive_centisecs the thread checks whether the number of
+ * free blocks of compaction_proactive_order in each zone has fallen below
+ * compaction_proactive_blocks. If the shortage is due to fragmentation
+ * rather than a lack of free memory, as judged by the fragmentation index
+ * and extfrag_threshold, the zone is compacted until the target is met.
+ */
+int sysctl_compaction_proactive_order __read_mostly;
+int sysctl_compaction_proactive_blocks __read_mostly = 8;
+int sysctl_compaction_proactive_centisecs __read_mostly = 500;
+
+/* Bumped to make sleeping kcompactd threads re-read the tunables */
+static unsigned long kcompactd_tunables_seq;
+
+static bool kcompactd_work_requested(pg_data_t *pgdat, unsigned long seq)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop() ||
+		seq != ACCESS_ONCE(kcompactd_tunables_seq);
+}
+
+static long kcompactd_timeout(pg_data_t *pgdat)
+{
+	unsigned long interval;
+
+	if (!sysctl_compaction_proactive_blocks ||
+	    !sysctl_compaction_proactive_centisecs)
+		return MAX_SCHEDULE_TIMEOUT;
+
+	interval = msecs_to_jiffies(sysctl_compaction_proactive_centisecs * 10);
+	return interval << pgdat->kcompactd_backoff;
+}
+
+/* Compact the zones of a node on behalf of a high-order kswapd wakeup */
+static void kcompactd_do_work(pg_data_t *pgdat, int order)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.zone = zone,
+		};
+		unsigned long watermark;
+		int fragindex;
+		int status;
+
+		if (!populated_zone(zone))
+			continue;
+
+		/* Nothing to do if the allocation can already succeed */
+		if (zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0))
+			continue;
+
+		/* Leave zones that are short of memory to reclaim */
+		watermark = low_wmark_pages(zone) + (2UL << order);
+		if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+			continue;
+
+		fragindex = fragmentation_index(zone, order);
+		if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+			continue;
+
+		if (compaction_deferred(zone))
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		status = compact_zone(zone, &cc);
+
+		if (zone_watermark_ok(zone, order, low_wmark_pages(zone), 0, 0)) {
+			zone->compact_considered = 0;
+			zone->compact_defer_shift = 0;
+		} else if (status == COMPACT_COMPLETE) {
+			defer_compaction(zone);
+		}
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
+/*
+ * Compact the zones of a node that are short of free high-order blocks
+ * because of fragmentation. Blocks that are freed up are credited to the
+ * zone so that costly allocations finding them can be accounted as direct
+ * compaction stalls that were avoided. Passes that cannot make progress
+ * back off the polling interval exponentially.
+ */
+static void kcompactd_proactive(pg_data_t *pgdat)
+{
+	unsigned int order = sysctl_compaction_proactive_order;
+	unsigned long target = sysctl_compaction_proactive_blocks;
+	bool attempted = false, progress = false;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.nr_target = target,
+			.zone = zone,
+		};
+		unsigned long before, after, watermark;
+		int fragindex;
+
+		if (!populated_zone(zone))
+			continue;
+
+		before = zone_free_blocks(zone, order);
+		if (before >= target)
+			continue;
+
+		/*
+		 * There must be enough free memory to build the target
+		 * number of blocks on top of the usual migration overhead.
+		 */
+		watermark = low_wmark_pages(zone) + ((target + 2) << order);
+		if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+			continue;
+
+		fragindex = fragmentation_index(zone, order);
+		if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+			continue;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		attempted = true;
+		compact_zone(zone, &cc);
+
+		after = zone_free_blocks(zone, order);
+		if (after > before) {
+			progress = true;
+			spin_lock_irq(&zone->lock);
+			zone->compact_blocks_ready = min(target,
+				zone->compact_blocks_ready + after - before);
+			spin_unlock_irq(&zone->lock);
+		}
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+
+	if (!attempted || progress)
+		pgdat->kcompactd_backoff = 0;
+	else if (pgdat->kcompactd_backoff < COMPACT_MAX_DEFER_SHIFT)
+		pgdat->kcompactd_backoff++;
+}
+
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		unsigned long seq = ACCESS_ONCE(kcompactd_tunables_seq);
+		long remaining;
+		int order;
+
+		remaining = wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat, seq),
+				kcompactd_timeout(pgdat));
+		if (kthread_should_stop())
+			break;
+
+		order = pgdat->kcompactd_max_order;
+		pgdat->kcompactd_max_order = 0;
+
+		if (order > 0) {
+			count_vm_event(KCOMPACTD_WAKE);
+			kcompactd_do_work(pgdat, order);
+		} else if (!remaining && sysctl_compaction_proactive_blocks) {
+			count_vm_event(KCOMPACTD_WAKE);
+			kcompactd_proactive(pgdat);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - Ask the node's kcompactd to compact for an order
+ * @pgdat: The node kswapd has just balanced
+ * @order: The order kswapd was woken for
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order)
+{
+	if (order <= 0)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		pgdat->kcompactd = NULL;
+		ret = -1;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+int sysctl_compaction_proactive_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, nid;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	kcompactd_tunables_seq++;
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		pgdat->kcompactd_backoff = 0;
+		wake_up_interruptible(&pgdat->kcompactd_wait);
+	}
+
+	return 0;
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	if (!sysctl_compaction_proactive_order)
+		sysctl_compaction_proactive_order = pageblock_order;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
@@ -110,18 +110,114 @@
  *    ->i_mmap_lock
  */
 
+static int page_cache_tree_insert(struct address_space *mapping,
+				  struct page *page, void **shadowp)
+{
+	struct radix_tree_node *node = NULL;
+	void **slot;
+	void *p;
+	int error;
+
+	error = radix_tree_insert(&mapping->page_tree, page->index, page);
+	if (error != -EEXIST) {
+		/* A page in a node of shadow entries makes it unreclaimable */
+		if (!error && mapping->nrshadows) {
+			__radix_tree_lookup(&mapping->page_tree, page->index,
+					    &node, &slot);
+			if (node && !list_empty(&node->private_list))
+				workingset_forget_node(node);
+		}
+		return error;
+	}
+
+	/* The slot may hold the shadow entry of an evicted page */
+	p = __radix_tree_lookup(&mapping->page_tree, page->index, &node, &slot);
+	if (!radix_tree_exceptional_entry(p))
+		return -EEXIST;
+	if (shadowp)
+		*shadowp = p;
+	radix_tree_replace_slot(slot, page);
+	mapping->nrshadows--;
+	if (node) {
+		workingset_node_shadows_dec(node);
+		workingset_node_pages_inc(node);
+		if (!list_empty(&node->private_list))
+			workingset_forget_node(node);
+	}
+	return 0;
+}
+
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	struct radix_tree_node *node = NULL;
+	unsigned long index = page->index;
+	void **slot;
+	int tag;
+
+	if (!shadow && !mapping->nrshadows) {
+		radix_tree_delete(&mapping->page_tree, index);
+		mapping->nrpages--;
+		return;
+	}
+
+	__radix_tree_lookup(&mapping->page_tree, index, &node, &slot);
+
+	if (!shadow) {
+		/*
+		 * If only shadow entries remain in the node, it is
+		 * left for the shadow node shrinker to reclaim.
+		 */
+		bool shadows_only = node && workingset_node_pages(node) == 1 &&
+				    workingset_node_shadows(node);
+
+		radix_tree_delete(&mapping->page_tree, index);
+		mapping->nrpages--;
+		if (shadows_only)
+			workingset_remember_node(node, mapping, index);
+		return;
+	}
+
+	/* Clear tree tags for the removed page */
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+		if (node ? test_bit(index & RADIX_TREE_MAP_MASK, node->tags[tag]) :
+			   radix_tree_tagged(&mapping->page_tree, tag))
+			radix_tree_tag_clear(&mapping->page_tree, index, tag);
+	}
+
+	radix_tree_replace_slot(slot, shadow);
+	mapping->nrshadows++;
+	/*
+	 * Make sure the nrshadows update is committed before the nrpages
+	 * update so that a final truncate racing with reclaim does not see
+	 * both counters 0 at the same time and miss a shadow entry.
+	 */
+	smp_wmb();
+	mapping->nrpages--;
+
+	if (node) {
+		workingset_node_pages_dec(node);
+		workingset_node_shadows_inc(node);
+		if (!workingset_node_pages(node) &&
+		    list_empty(&node->private_list))
+			workingset_remember_node(node, mapping, index);
+	}
+}
+
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is not NULL, it is left behind in the page's slot so that
+ * a refault of the page can be recognized, see mm/workingset.c.
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
-	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	if (PageSwapBacked(page))
 		__dec_zone_page_state(page, NR_SHMEM);
@@ -135,6 +231,7 @@ void __remove_from_page_cache(struct page *page)
 	 * having removed the page entirely.
 	 */
 	if (PageDirty(page) && mapping_cap_account_dirty(mapping)) {
+		mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 		dec_zone_page_state(page, NR_FILE_DIRTY);
 		dec_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 	}
@@ -149,7 +246,7 @@ void remove_from_page_cache(struct page *page)
 
 	freepage = mapping->a_ops->freepage;
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -158,6 +255,32 @@ void remove_from_page_cache(struct page *page)
 }
 EXPORT_SYMBOL(remove_from_page_cache);
 
+/*
+ * Drop the shadow entry at @index, if it is still @shadow. The caller
+ * must hold the mapping's tree_lock.
+ */
+void __remove_shadow_from_page_cache(struct address_space *mapping,
+				     pgoff_t index, void *shadow)
+{
+	struct radix_tree_node *node = NULL;
+	void **slot;
+
+	if (__radix_tree_lookup(&mapping->page_tree, index,
+				&node, &slot) != shadow)
+		return;
+
+	mapping->nrshadows--;
+	if (node && workingset_node_shadows(node)) {
+		workingset_node_shadows_dec(node);
+		if (!workingset_node_shadows(node) &&
+		    !list_empty(&node->private_list))
+			workingset_forget_node(node);
+		/* Account it like a page, radix_tree_delete() drops it */
+		workingset_node_pages_inc(node);
+	}
+	radix_tree_delete(&mapping->page_tree, index);
+}
+
 static int sync_page(void *word)
 {
 	struct address_space *mapping;
@@ -389,18 +512,10 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 }
 EXPORT_SYMBOL(filemap_write_and_wait_range);
 
-/**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
- */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -418,7 +533,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -437,11 +552,29 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -453,13 +586,24 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+	} else if (page_is_file_cache(page)) {
+		/*
+		 * A page that is refaulting within the size of the active
+		 * list would have stayed cached had it been activated in
+		 * the first place: put it straight on the active list.
+		 */
+		if (shadow && workingset_refault(shadow)) {
+			lru_cache_add_lru(page, LRU_ACTIVE_FILE);
+			workingset_activation(page);
+		} else
 			lru_cache_add_file(page);
-		else
-			lru_cache_add_anon(page);
-	}
+	} else
+		lru_cache_add_anon(page);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
@@ -630,6 +774,95 @@ int __lock_page_or_retry(struct page *page, struct mm_struct *mm,
 	}
 }
 
+/**
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Like radix_tree_next_hole(), but shadow entries of evicted pages
+ * count as holes.
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
+/**
+ * page_cache_prev_hole - find the prev hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Like radix_tree_prev_hole(), but shadow entries of evicted pages
+ * count as holes.
+ */
+pgoff_t page_cache_prev_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index--;
+		if (index == ULONG_MAX)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_prev_hole);
+
+/*
+ * Advance *@start past a run of shadow entries to the next page in the
+ * mapping.  Returns false if there is none.  Called under rcu_read_lock.
+ */
+static bool page_cache_skip_shadows(struct address_space *mapping,
+				    pgoff_t *start)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	pgoff_t index = *start;
+	unsigned int i, nr;
+
+	for (;;) {
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		if (!nr)
+			return false;
+		for (i = 0; i < nr; i++) {
+			void *entry = radix_tree_deref_slot(slots[i]);
+
+			if (entry && !radix_tree_exceptional_entry(entry)) {
+				*start = indices[i];
+				return true;
+			}
+		}
+		index = indices[nr - 1] + 1;
+		if (!index)
+			return false;
+	}
+}
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
@@ -651,8 +884,13 @@ repeat:
 		page = radix_tree_deref_slot(pagep);
 		if (unlikely(!page))
 			goto out;
-		if (radix_tree_deref_retry(page))
-			goto repeat;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page))
+				goto repeat;
+			/* A shadow entry of an evicted page: not cached */
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -777,7 +1015,7 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
+				(void ***)pages, NULL, start, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -785,10 +1023,14 @@ repeat:
 		page = radix_tree_deref_slot((void **)pages[i]);
 		if (unlikely(!page))
 			continue;
-		if (radix_tree_deref_retry(page)) {
-			if (ret)
-				start = pages[ret-1]->index;
-			goto restart;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page)) {
+				if (ret)
+					start = pages[ret-1]->index;
+				goto restart;
+			}
+			/* A shadow entry of an evicted page: skip over it */
+			continue;
 		}
 
 		if (!page_cache_get_speculative(page))
@@ -803,6 +1045,14 @@ repeat:
 		pages[ret] = page;
 		ret++;
 	}
+
+	/*
+	 * Callers take 0 for the end of the mapping, so look past a batch
+	 * that held nothing but shadow entries.
+	 */
+	if (unlikely(!ret && nr_found &&
+		     page_cache_skip_shadows(mapping, &start)))
+		goto restart;
 	rcu_read_unlock();
 	return ret;
 }
@@ -829,7 +1079,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -837,8 +1087,12 @@ repeat:
 		page = radix_tree_deref_slot((void **)pages[i]);
 		if (unlikely(!page))
 			continue;
-		if (radix_tree_deref_retry(page))
-			goto restart;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page))
+				goto restart;
+			/* A shadow entry is a hole in the range */
+			break;
+		}
 
 		if (page->mapping == NULL || page->index != index)
 			break;
@@ -890,8 +1144,12 @@ repeat:
 		page = radix_tree_deref_slot((void **)pages[i]);
 		if (unlikely(!page))
 			continue;
-		if (radix_tree_deref_retry(page))
-			goto restart;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page))
+				goto restart;
+			/* Shadow entries are never tagged, but be safe */
+			continue;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -1649,8 +1907,95 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	struct vm_fault with ->pgoff, ->max_pgoff and ->pte set up
+ *
+ * Install ptes for pages in [->pgoff, ->max_pgoff] that are already
+ * uptodate in the page cache.  Pages that are locked, under readahead,
+ * beyond EOF or not present are skipped, they are left for ->fault.
+ * Called with the page table lock held, so this must not sleep.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	struct file_ra_state *ra = &file->f_ra;
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	pgoff_t index = vmf->pgoff;
+	unsigned long address;
+	unsigned int i, nr;
+	loff_t size;
+	struct page *page;
+
+	rcu_read_lock();
+restart:
+	nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots, indices,
+					 index, PAGEVEC_SIZE);
+	for (i = 0; i < nr; i++) {
+		index = indices[i];
+		if (index > vmf->max_pgoff)
+			goto out;
+repeat:
+		page = radix_tree_deref_slot(slots[i]);
+		if (unlikely(!page))
+			continue;
+		if (radix_tree_exception(page)) {
+			if (radix_tree_deref_retry(page))
+				goto restart;
+			continue;
+		}
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+
+		/* Has the page moved? */
+		if (unlikely(page != *slots[i])) {
+			page_cache_release(page);
+			goto repeat;
+		}
+
+		if (!PageUptodate(page) || PageReadahead(page) ||
+		    PageHWPoison(page))
+			goto skip;
+		if (!trylock_page(page))
+			goto skip;
+
+		if (page->mapping != mapping || !PageUptodate(page))
+			goto unlock;
+
+		size = i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1;
+		if (page->index >= size >> PAGE_CACHE_SHIFT)
+			goto unlock;
+
+		address = (unsigned long)vmf->virtual_address +
+			  ((index - vmf->pgoff) << PAGE_SHIFT);
+		if (!pte_none(vmf->pte[index - vmf->pgoff]))
+			goto unlock;
+
+		if (ra->mmap_miss > 0)
+			ra->mmap_miss--;
+		do_set_pte(vma, address, page, vmf->pte + index - vmf->pgoff);
+		unlock_page(page);
+		continue;
+unlock:
+		unlock_page(page);
+skip:
+		page_cache_release(page);
+	}
+	if (nr == PAGEVEC_SIZE && index < vmf->max_pgoff) {
+		index++;
+		goto restart;
+	}
+out:
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
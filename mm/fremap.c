@@ -211,6 +211,14 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 			}
 			goto out;
 		}
+		if (vma->vm_ops->pmd_fault) {
+			unsigned long addr;
+
+			/* nonlinear ptes are never gathered into huge pmds */
+			for (addr = vma->vm_start; addr < vma->vm_end;
+			     addr = (addr + HPAGE_PMD_SIZE) & HPAGE_PMD_MASK)
+				split_huge_page_address(vma, addr);
+		}
 		spin_lock(&mapping->i_mmap_lock);
 		flush_dcache_mmap_lock(mapping);
 		vma->vm_flags |= VM_NONLINEAR;
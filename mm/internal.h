@@ -39,6 +39,17 @@ static inline void __put_page(struct page *page)
 
 extern unsigned long highest_memmap_pfn;
 
+/*
+ * in mm/filemap.c:
+ */
+extern void __remove_shadow_from_page_cache(struct address_space *mapping,
+					    pgoff_t index, void *shadow);
+
+/*
+ * in mm/rmap.c:
+ */
+extern pgoff_t page_pgoff(struct page *page);
+
 /*
  * in mm/vmscan.c:
  */
@@ -53,6 +64,38 @@ extern void prep_compound_page(struct page *page, unsigned long order);
 #ifdef CONFIG_MEMORY_FAILURE
 extern bool is_free_buddy_page(struct page *page);
 #endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+extern void try_to_unmap_flush(void);
+extern void try_to_unmap_flush_dirty(void);
+extern void flush_tlb_batched_pending(struct mm_struct *mm);
+#else
+static inline void try_to_unmap_flush(void)
+{
+}
+static inline void try_to_unmap_flush_dirty(void)
+{
+}
+static inline void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+}
+#endif
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+extern unsigned long deferred_pfn_run(unsigned long pfn,
+				      unsigned long end_pfn, int *nid);
+extern void reserve_bootmem_region(phys_addr_t start, phys_addr_t end);
+#else
+static inline unsigned long deferred_pfn_run(unsigned long pfn,
+					     unsigned long end_pfn, int *nid)
+{
+	*nid = -1;
+	return end_pfn;
+}
+
+static inline void reserve_bootmem_region(phys_addr_t start, phys_addr_t end)
+{
+}
+#endif
 
 
 /*
@@ -0,0 +1,202 @@
+/*
+ * mm/interval_tree.c - interval tree for anon_vma rmap walks
+ *
+ * The anon_vma_chains of an anon_vma are kept in an augmented rbtree,
+ * ordered on the first page offset covered by their vma.  Each node
+ * also caches the highest last page offset found in its subtree, which
+ * lets a lookup for the vmas that can map a given page offset skip
+ * whole subtrees: the rmap walks then no longer visit every vma which
+ * was ever forked from the anon_vma's owner.
+ */
+
+#include <linux/mm.h>
+#include <linux/rmap.h>
+#include <linux/rbtree.h>
+
+static inline unsigned long avc_start_pgoff(struct anon_vma_chain *avc)
+{
+	return avc->vma->vm_pgoff;
+}
+
+static inline unsigned long avc_last_pgoff(struct anon_vma_chain *avc)
+{
+	struct vm_area_struct *vma = avc->vma;
+
+	return vma->vm_pgoff + ((vma->vm_end - vma->vm_start) >> PAGE_SHIFT) - 1;
+}
+
+static inline struct anon_vma_chain *avc_entry(struct rb_node *node)
+{
+	return rb_entry(node, struct anon_vma_chain, rb);
+}
+
+/* Update 'rb_subtree_last' for a node, based on node and its children */
+static void anon_vma_interval_tree_augment_cb(struct rb_node *node,
+					      void *__unused)
+{
+	struct anon_vma_chain *avc;
+	unsigned long last;
+
+	if (!node)
+		return;
+
+	avc = avc_entry(node);
+	last = avc_last_pgoff(avc);
+	if (node->rb_left && avc_entry(node->rb_left)->rb_subtree_last > last)
+		last = avc_entry(node->rb_left)->rb_subtree_last;
+	if (node->rb_right && avc_entry(node->rb_right)->rb_subtree_last > last)
+		last = avc_entry(node->rb_right)->rb_subtree_last;
+	avc->rb_subtree_last = last;
+}
+
+void anon_vma_interval_tree_insert(struct anon_vma_chain *node,
+				   struct rb_root *root)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	unsigned long start = avc_start_pgoff(node);
+
+	while (*link) {
+		parent = *link;
+		if (start < avc_start_pgoff(avc_entry(parent)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+
+	node->rb_subtree_last = avc_last_pgoff(node);
+	rb_link_node(&node->rb, parent, link);
+	rb_insert_color(&node->rb, root);
+	rb_augment_insert(&node->rb, anon_vma_interval_tree_augment_cb, NULL);
+}
+
+void anon_vma_interval_tree_remove(struct anon_vma_chain *node,
+				   struct rb_root *root)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&node->rb);
+	rb_erase(&node->rb, root);
+	rb_augment_erase_end(deepest, anon_vma_interval_tree_augment_cb, NULL);
+}
+
+/*
+ * Iterate over the chains intersecting [start;last]
+ *
+ * Note that a chain intersects [start;last] iff
+ *   Cond1: avc_start_pgoff(avc) <= last
+ * and
+ *   Cond2: start <= avc_last_pgoff(avc)
+ */
+static struct anon_vma_chain *
+anon_vma_interval_tree_subtree_search(struct anon_vma_chain *node,
+				      unsigned long start, unsigned long last)
+{
+	while (true) {
+		/*
+		 * Loop invariant: start <= node->rb_subtree_last
+		 * (Cond2 is satisfied by one of the subtree nodes)
+		 */
+		if (node->rb.rb_left) {
+			struct anon_vma_chain *left = avc_entry(node->rb.rb_left);
+
+			if (start <= left->rb_subtree_last) {
+				/*
+				 * Some nodes in left subtree satisfy Cond2.
+				 * Iterate to find the leftmost such node N.
+				 * If it also satisfies Cond1, that's the match
+				 * we are looking for.  Otherwise, there is no
+				 * matching interval as nodes to the right of N
+				 * can't satisfy Cond1 either.
+				 */
+				node = left;
+				continue;
+			}
+		}
+		if (avc_start_pgoff(node) <= last) {		/* Cond1 */
+			if (start <= avc_last_pgoff(node))	/* Cond2 */
+				return node;	/* node is leftmost match */
+			if (node->rb.rb_right) {
+				node = avc_entry(node->rb.rb_right);
+				if (start <= node->rb_subtree_last)
+					continue;
+			}
+		}
+		return NULL;	/* No match */
+	}
+}
+
+struct anon_vma_chain *
+anon_vma_interval_tree_iter_first(struct rb_root *root,
+				  unsigned long start, unsigned long last)
+{
+	struct anon_vma_chain *node;
+
+	if (!root->rb_node)
+		return NULL;
+	node = avc_entry(root->rb_node);
+	if (node->rb_subtree_last < start)
+		return NULL;
+	return anon_vma_interval_tree_subtree_search(node, start, last);
+}
+
+struct anon_vma_chain *
+anon_vma_interval_tree_iter_next(struct anon_vma_chain *node,
+				 unsigned long start, unsigned long last)
+{
+	struct rb_node *rb = node->rb.rb_right, *prev;
+
+	while (true) {
+		/*
+		 * Loop invariants:
+		 *   Cond1: avc_start_pgoff(node) <= last
+		 *   rb == node->rb.rb_right
+		 *
+		 * First, search right subtree if suitable
+		 */
+		if (rb) {
+			struct anon_vma_chain *right = avc_entry(rb);
+
+			if (start <= right->rb_subtree_last)
+				return anon_vma_interval_tree_subtree_search(
+							right, start, last);
+		}
+
+		/* Move up the tree until we come from a node's left child */
+		do {
+			rb = rb_parent(&node->rb);
+			if (!rb)
+				return NULL;
+			prev = &node->rb;
+			node = avc_entry(rb);
+			rb = node->rb.rb_right;
+		} while (prev == rb);
+
+		/* Check if the node intersects [start;last] */
+		if (last < avc_start_pgoff(node))		/* !Cond1 */
+			return NULL;
+		else if (start <= avc_last_pgoff(node))	/* Cond2 */
+			return node;
+	}
+}
+
+/*
+ * The chains of a vma are keyed on its vm_pgoff, vm_start and vm_end:
+ * take them out of their trees before changing any of those, and put
+ * them back afterwards.  All the anon_vmas of a vma share the same root,
+ * whose lock must be held across the update.
+ */
+void anon_vma_interval_tree_pre_update_vma(struct vm_area_struct *vma)
+{
+	struct anon_vma_chain *avc;
+
+	list_for_each_entry(avc, &vma->anon_vma_chain, same_vma)
+		anon_vma_interval_tree_remove(avc, &avc->anon_vma->rb_root);
+}
+
+void anon_vma_interval_tree_post_update_vma(struct vm_area_struct *vma)
+{
+	struct anon_vma_chain *avc;
+
+	list_for_each_entry(avc, &vma->anon_vma_chain, same_vma)
+		anon_vma_interval_tree_insert(avc, &avc->anon_vma->rb_root);
+}
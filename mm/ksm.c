@@ -38,6 +38,14 @@
 #include <asm/tlbflush.h>
 #include "internal.h"
 
+#ifdef CONFIG_NUMA
+#define NUMA(x)		(x)
+#define DO_NUMA(x)	do { (x); } while (0)
+#else
+#define NUMA(x)		(0)
+#define DO_NUMA(x)	do { } while (0)
+#endif
+
 /*
  * A few notes about the KSM scanning process,
  * to make it easier to understand the data structures below:
@@ -113,17 +121,22 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @nid: NUMA node id of the stable tree in which it is linked
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 /**
  * struct rmap_item - reverse mapping item for virtual addresses
  * @rmap_list: next rmap_item in mm_slot's singly-linked rmap_list
  * @anon_vma: pointer to anon_vma for this mm,address, when in stable tree
+ * @nid: NUMA node id of the unstable tree in which it is linked
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
@@ -133,7 +146,12 @@ struct stable_node {
  */
 struct rmap_item {
 	struct rmap_item *rmap_list;
-	struct anon_vma *anon_vma;	/* when stable */
+	union {
+		struct anon_vma *anon_vma;	/* when stable */
+#ifdef CONFIG_NUMA
+		int nid;		/* when node of unstable tree */
+#endif
+	};
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
@@ -150,9 +168,14 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/*
+ * The stable and unstable tree heads: one of each per NUMA node, unless
+ * merge_across_nodes is set, when only the first of each is used.
+ */
+static struct rb_root one_stable_tree[1] = { RB_ROOT };
+static struct rb_root one_unstable_tree[1] = { RB_ROOT };
+static struct rb_root *root_stable_tree = one_stable_tree;
+static struct rb_root *root_unstable_tree = one_unstable_tree;
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -187,6 +210,30 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * Percentage of one CPU which ksmd may use: when set, ksmd adjusts
+ * pages_to_scan itself after every batch, between the two limits below,
+ * going faster while scanning finds pages to merge.  0 keeps it fixed.
+ */
+static unsigned int ksm_advisor_max_cpu;
+static unsigned int ksm_advisor_min_pages_to_scan = 100;
+static unsigned int ksm_advisor_max_pages_to_scan = 30000;
+
+/* Pages merged per thousand scanned, decaying average over the batches */
+static unsigned int ksm_merge_yield;
+
+/* Total number of rmap_items added to the stable tree: for merge_yield */
+static unsigned long ksm_pages_merged;
+
+#ifdef CONFIG_NUMA
+/* Zero to merge only pages on the same NUMA node */
+static unsigned int ksm_merge_across_nodes;
+static int ksm_nr_node_ids = 1;
+#else
+#define ksm_merge_across_nodes	1U
+#define ksm_nr_node_ids		1
+#endif
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -300,6 +347,15 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 	return rmap_item->address & STABLE_FLAG;
 }
 
+/*
+ * The trees which a page with this pfn is to be looked up in.  A ksm page
+ * migrated to another node stays in the stable tree it was inserted in.
+ */
+static inline int get_kpfn_nid(unsigned long kpfn)
+{
+	return ksm_merge_across_nodes ? 0 : pfn_to_nid(kpfn);
+}
+
 static void hold_anon_vma(struct rmap_item *rmap_item,
 			  struct anon_vma *anon_vma)
 {
@@ -456,7 +512,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, root_stable_tree + NUMA(stable_node->nid));
 	free_stable_node(stable_node);
 }
 
@@ -554,7 +610,8 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 root_unstable_tree + NUMA(rmap_item->nid));
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -831,6 +888,14 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 	if (!PageAnon(page))
 		goto out;
 
+	/*
+	 * A transparent huge page has to be split before any of its
+	 * subpages can be write-protected and replaced by a ksm page.
+	 */
+	if (PageTransCompound(page) &&
+	    split_huge_page(compound_trans_head(page)))
+		goto out;
+
 	/*
 	 * We need the page lock to read a stable PageSwapCache in
 	 * write_protect_page().  We use trylock_page() instead of
@@ -855,6 +920,13 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 			 */
 			set_page_stable_node(page, NULL);
 			mark_page_accessed(page);
+			/*
+			 * The stable page is only referenced by clean,
+			 * write-protected ptes: make sure reclaim swaps
+			 * it out rather than dropping it as lazily freed.
+			 */
+			if (!PageDirty(page))
+				SetPageDirty(page);
 			err = 0;
 		} else if (pages_identical(page, kpage))
 			err = replace_page(vma, page, kpage, orig_pte);
@@ -899,6 +971,9 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 	if (err)
 		goto out;
 
+	/* Unstable nid is in union with stable anon_vma: remove first */
+	remove_rmap_item_from_tree(rmap_item);
+
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	hold_anon_vma(rmap_item, vma->anon_vma);
 out:
@@ -948,8 +1023,9 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  */
 static struct page *stable_tree_search(struct page *page)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node;
 	struct stable_node *stable_node;
+	int nid;
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {			/* ksm page forked */
@@ -957,6 +1033,9 @@ static struct page *stable_tree_search(struct page *page)
 		return page;
 	}
 
+	nid = get_kpfn_nid(page_to_pfn(page));
+	node = root_stable_tree[nid].rb_node;
+
 	while (node) {
 		struct page *tree_page;
 		int ret;
@@ -991,7 +1070,9 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = get_kpfn_nid(page_to_pfn(kpage));
+	struct rb_root *root = root_stable_tree + nid;
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
@@ -1028,9 +1109,10 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, root);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
+	DO_NUMA(stable_node->nid = nid);
 
 	stable_node->kpfn = page_to_pfn(kpage);
 	set_page_stable_node(kpage, stable_node);
@@ -1058,7 +1140,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	int nid = get_kpfn_nid(page_to_pfn(page));
+	struct rb_root *root = root_unstable_tree + nid;
+	struct rb_node **new = &root->rb_node;
 	struct rb_node *parent = NULL;
 
 	while (*new) {
@@ -1080,6 +1164,16 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * If tree_page has been migrated to another NUMA node since
+		 * it was inserted, don't merge with it: it will go into the
+		 * right unstable tree on the next scan.
+		 */
+		if (!ksm_merge_across_nodes && page_to_nid(tree_page) != nid) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
 		parent = *new;
@@ -1097,8 +1191,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, root);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1116,6 +1211,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	rmap_item->address |= STABLE_FLAG;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
+	ksm_pages_merged++;
 	if (rmap_item->hlist.next)
 		ksm_pages_sharing++;
 	else
@@ -1178,13 +1274,12 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 						tree_rmap_item, tree_page);
 		put_page(tree_page);
 		/*
-		 * As soon as we merge this page, we want to remove the
-		 * rmap_item of the page we have merged with from the unstable
-		 * tree, and insert it instead as new node in the stable tree.
+		 * As soon as we merge this page, the rmap_item of the page
+		 * we have merged with is removed from the unstable tree (by
+		 * try_to_merge_with_ksm_page), and we insert it instead as
+		 * new node in the stable tree.
 		 */
 		if (kpage) {
-			remove_rmap_item_from_tree(tree_rmap_item);
-
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
 			if (stable_node) {
@@ -1241,13 +1336,15 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	int nid;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
 
 	slot = ksm_scan.mm_slot;
 	if (slot == &ksm_mm_head) {
-		root_unstable_tree = RB_ROOT;
+		for (nid = 0; nid < ksm_nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1346,21 +1443,69 @@ next_mm:
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
+ *
+ * Returns the number of pages actually scanned.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static unsigned int ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int scanned = 0;
 
-	while (scan_npages--) {
+	while (scanned < scan_npages) {
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
-			return;
+			break;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		scanned++;
 	}
+	return scanned;
+}
+
+/* merge_yield above which ksmd speeds up, and below which it slows down */
+#define KSM_YIELD_HIGH	50
+#define KSM_YIELD_LOW	5
+
+/*
+ * Pick the size of the next batch from how much the last one merged and
+ * how long it took: double it while merging pays, shrink it by a quarter
+ * once it doesn't, and always keep ksmd within ksm_advisor_max_cpu percent
+ * of a CPU, counting the sleep between batches.
+ */
+static void ksm_advisor_adjust(unsigned int scanned, unsigned long merged,
+			       u64 busy_ns)
+{
+	unsigned long pages = ksm_thread_pages_to_scan;
+	unsigned int max_cpu = ksm_advisor_max_cpu;
+	unsigned int yield;
+
+	if (!max_cpu || !scanned)
+		return;
+
+	yield = min_t(unsigned long, merged * 1000 / scanned, 1000);
+	ksm_merge_yield = (ksm_merge_yield * 7 + yield) / 8;
+
+	if (ksm_merge_yield >= KSM_YIELD_HIGH)
+		pages *= 2;
+	else if (ksm_merge_yield < KSM_YIELD_LOW)
+		pages -= pages / 4;
+
+	if (max_cpu < 100 && busy_ns) {
+		u64 budget_ns, max_pages;
+
+		budget_ns = (u64)ksm_thread_sleep_millisecs * NSEC_PER_MSEC;
+		budget_ns = div_u64(budget_ns * max_cpu, 100 - max_cpu);
+		max_pages = div64_u64((u64)scanned * budget_ns, busy_ns);
+		if (pages > max_pages)
+			pages = max_pages;
+	}
+
+	pages = clamp_t(unsigned long, pages, ksm_advisor_min_pages_to_scan,
+			ksm_advisor_max_pages_to_scan);
+	ksm_thread_pages_to_scan = pages;
 }
 
 static int ksmd_should_run(void)
@@ -1374,8 +1519,15 @@ static int ksm_scan_thread(void *nothing)
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+		if (ksmd_should_run()) {
+			unsigned long merged = ksm_pages_merged;
+			u64 start = local_clock();
+			unsigned int scanned;
+
+			scanned = ksm_do_scan(ksm_thread_pages_to_scan);
+			ksm_advisor_adjust(scanned, ksm_pages_merged - merged,
+					   local_clock() - start);
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		if (ksmd_should_run()) {
@@ -1547,7 +1699,8 @@ again:
 		struct vm_area_struct *vma;
 
 		anon_vma_lock(anon_vma);
-		list_for_each_entry(vmac, &anon_vma->head, same_anon_vma) {
+		anon_vma_interval_tree_foreach(vmac, &anon_vma->rb_root,
+					       0, ULONG_MAX) {
 			vma = vmac->vma;
 			if (rmap_item->address < vma->vm_start ||
 			    rmap_item->address >= vma->vm_end)
@@ -1600,7 +1753,8 @@ again:
 		struct vm_area_struct *vma;
 
 		anon_vma_lock(anon_vma);
-		list_for_each_entry(vmac, &anon_vma->head, same_anon_vma) {
+		anon_vma_interval_tree_foreach(vmac, &anon_vma->rb_root,
+					       0, ULONG_MAX) {
 			vma = vmac->vma;
 			if (rmap_item->address < vma->vm_start ||
 			    rmap_item->address >= vma->vm_end)
@@ -1652,7 +1806,8 @@ again:
 		struct vm_area_struct *vma;
 
 		anon_vma_lock(anon_vma);
-		list_for_each_entry(vmac, &anon_vma->head, same_anon_vma) {
+		anon_vma_interval_tree_foreach(vmac, &anon_vma->rb_root,
+					       0, ULONG_MAX) {
 			vma = vmac->vma;
 			if (rmap_item->address < vma->vm_start ||
 			    rmap_item->address >= vma->vm_end)
@@ -1701,14 +1856,18 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	int nid;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
+		for (node = rb_first(root_stable_tree + nid); node;
+		     node = rb_next(node)) {
+			struct stable_node *stable_node;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1856,6 +2015,114 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	/*
+	 * The stable nodes would be looked up in the wrong trees: only
+	 * allow switching when nothing is merged (e.g. after run=2).
+	 */
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		if (ksm_pages_shared)
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
+static ssize_t advisor_max_cpu_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_advisor_max_cpu);
+}
+
+static ssize_t advisor_max_cpu_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	unsigned long percent;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percent);
+	if (err || percent > 100)
+		return -EINVAL;
+
+	ksm_advisor_max_cpu = percent;
+
+	return count;
+}
+KSM_ATTR(advisor_max_cpu);
+
+static ssize_t advisor_min_pages_to_scan_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_advisor_min_pages_to_scan);
+}
+
+static ssize_t advisor_min_pages_to_scan_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || !nr_pages || nr_pages > ksm_advisor_max_pages_to_scan)
+		return -EINVAL;
+
+	ksm_advisor_min_pages_to_scan = nr_pages;
+
+	return count;
+}
+KSM_ATTR(advisor_min_pages_to_scan);
+
+static ssize_t advisor_max_pages_to_scan_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_advisor_max_pages_to_scan);
+}
+
+static ssize_t advisor_max_pages_to_scan_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned long nr_pages;
+	int err;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || nr_pages > UINT_MAX ||
+	    nr_pages < ksm_advisor_min_pages_to_scan)
+		return -EINVAL;
+
+	ksm_advisor_max_pages_to_scan = nr_pages;
+
+	return count;
+}
+KSM_ATTR(advisor_max_pages_to_scan);
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1901,15 +2168,29 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t merge_yield_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_yield);
+}
+KSM_ATTR_RO(merge_yield);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
+	&advisor_max_cpu_attr.attr,
+	&advisor_min_pages_to_scan_attr.attr,
+	&advisor_max_pages_to_scan_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&merge_yield_attr.attr,
 	NULL,
 };
 
@@ -1928,6 +2209,25 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
+#ifdef CONFIG_NUMA
+	if (nr_node_ids > 1) {
+		struct rb_root *buf;
+		int nid;
+
+		buf = kcalloc(nr_node_ids + nr_node_ids, sizeof(*buf),
+			      GFP_KERNEL);
+		if (!buf) {
+			err = -ENOMEM;
+			goto out_free;
+		}
+		for (nid = 0; nid < nr_node_ids + nr_node_ids; nid++)
+			buf[nid] = RB_ROOT;
+		root_stable_tree = buf;
+		root_unstable_tree = buf + nr_node_ids;
+		ksm_nr_node_ids = nr_node_ids;
+	}
+#endif
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		printk(KERN_ERR "ksm: creating kthread failed\n");
@@ -1957,6 +2257,8 @@ static int __init ksm_init(void)
 	return 0;
 
 out_free:
+	if (root_stable_tree != one_stable_tree)
+		kfree(root_stable_tree);
 	ksm_slab_free();
 out:
 	return err;
@@ -632,6 +632,9 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 		/* page was freed from under us. So we are done. */
 		goto move_newpage;
 	}
+	if (unlikely(PageTransHuge(page)))
+		if (unlikely(split_huge_page(page)))
+			goto move_newpage;
 
 	/* prepare cgroup just returns 0 or -ENOMEM */
 	rc = -EAGAIN;
@@ -849,7 +852,7 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
 
 	if (anon_vma && atomic_dec_and_lock(&anon_vma->external_refcount,
 					    &anon_vma->lock)) {
-		int empty = list_empty(&anon_vma->head);
+		int empty = RB_EMPTY_ROOT(&anon_vma->rb_root);
 		spin_unlock(&anon_vma->lock);
 		if (empty)
 			anon_vma_free(anon_vma);
@@ -1352,4 +1355,92 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Returns true if this is a safe migration target node for misplaced
+ * NUMA pages, i.e. migrating won't push it below its high watermark.
+ */
+static bool migrate_balanced_pgdat(struct pglist_data *pgdat,
+				   unsigned long nr_migrate_pages)
+{
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (zone->all_unreclaimable)
+			continue;
+
+		if (!zone_watermark_ok(zone, 0,
+				       high_wmark_pages(zone) +
+				       nr_migrate_pages, 0, 0))
+			continue;
+		return true;
+	}
+	return false;
+}
+
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data, int **result)
+{
+	int nid = (int) data;
+
+	return alloc_pages_exact_node(nid, GFP_HIGHUSER_MOVABLE |
+				      __GFP_THISNODE | __GFP_NOMEMALLOC |
+				      __GFP_NORETRY | __GFP_NOWARN, 0);
+}
+
+/**
+ * migrate_misplaced_page - move a page to the node accessing it
+ * @page: page which took a NUMA hinting fault from a remote node
+ * @node: node the fault came from
+ *
+ * The caller must hold a reference on @page which is dropped before
+ * returning.  Only pages mapped by a single process are moved, pages
+ * shared between tasks on different nodes would just bounce around.
+ *
+ * Returns 1 if the page was migrated, 0 otherwise.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(migratepages);
+
+	if (page_mapcount(page) != 1 || PageCompound(page))
+		goto out;
+
+	/* don't make the target node reclaim to make room */
+	if (!migrate_balanced_pgdat(NODE_DATA(node), 1))
+		goto out;
+
+	if (isolate_lru_page(page))
+		goto out;
+
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	list_add(&page->lru, &migratepages);
+	/* isolate_lru_page() took its own reference */
+	put_page(page);
+
+	/*
+	 * This is the fault path: make a single attempt which neither
+	 * waits for the page lock nor for writeback, unlike the passes
+	 * of migrate_pages().  A page which is not moved is left on the
+	 * list, or was put back already.
+	 */
+	if (unmap_and_move(alloc_misplaced_dst_page, node, page, 0, 0)) {
+		putback_lru_pages(&migratepages);
+		return 0;
+	}
+
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return 1;
+
+out:
+	put_page(page);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif
@@ -51,6 +51,7 @@
 #include <linux/kmemleak.h>
 #include <linux/memory.h>
 #include <linux/compaction.h>
+#include <linux/kthread.h>
 #include <trace/events/kmem.h>
 #include <linux/ftrace_event.h>
 
@@ -578,10 +579,21 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+static inline int order_to_pindex(int migratetype, unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of base pages to free, a high-order page may take
+ * it a little over.  pcp->count is updated to match.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -592,17 +604,19 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int nr_freed = 0;
 
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	count = min(count, pcp->count);
+	while (count > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -613,21 +627,25 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
+		order = pindex_to_order(pindex);
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			count -= 1 << order;
+			nr_freed += 1 << order;
+		} while (count > 0 && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	pcp->count -= nr_freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, nr_freed);
 	spin_unlock(&zone->lock);
 }
 
@@ -672,11 +690,76 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
-static void __free_pages_ok(struct page *page, unsigned int order)
+/*
+ * Free a page of order up to PAGE_ALLOC_COSTLY_ORDER to the pcp-lists
+ * cold == 1 ? free a cold page : free a hot page
+ */
+static void free_pcp_page(struct page *page, unsigned int order, int cold)
 {
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
 	unsigned long flags;
+	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
+	if (!free_pages_prepare(page, order))
+		return;
+
+	/*
+	 * __free_one_page() takes compound pages apart when they reach the
+	 * buddy lists, these have to be split up before the pcp-lists.
+	 */
+	if (order && PageCompound(page) && destroy_compound_page(page, order))
+		return;
+
+	migratetype = get_pageblock_migratetype(page);
+	set_page_private(page, migratetype);
+	local_irq_save(flags);
+	if (unlikely(wasMlocked))
+		free_page_mlock(page);
+	__count_vm_events(PGFREE, 1 << order);
+
+	/*
+	 * We only track unmovable, reclaimable and movable on pcp lists.
+	 * Free ISOLATE pages back to the allocator because they are being
+	 * offlined but treat RESERVE as movable pages so we can get those
+	 * areas back if necessary. Otherwise, we may have to free
+	 * excessively into the page allocator
+	 */
+	if (migratetype >= MIGRATE_PCPTYPES) {
+		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
+			free_one_page(zone, page, order, migratetype);
+			goto out;
+		}
+		migratetype = MIGRATE_MOVABLE;
+	}
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
+	if (cold)
+		list_add_tail(&page->lru, list);
+	else
+		list_add(&page->lru, list);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
+		free_pcppages_bulk(zone, pcp->batch, pcp);
+
+out:
+	local_irq_restore(flags);
+}
+
+static void __free_pages_ok(struct page *page, unsigned int order)
+{
+	unsigned long flags;
+	int wasMlocked;
+
+	if (order <= PAGE_ALLOC_COSTLY_ORDER) {
+		free_pcp_page(page, order, 0);
+		return;
+	}
+
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -700,13 +783,14 @@ void __meminit __free_pages_bootmem(struct page *page, unsigned int order)
 		set_page_refcounted(page);
 		__free_page(page);
 	} else {
-		int loop;
+		unsigned int nr_pages = 1 << order;
+		unsigned int loop;
 
 		prefetchw(page);
-		for (loop = 0; loop < BITS_PER_LONG; loop++) {
+		for (loop = 0; loop < nr_pages; loop++) {
 			struct page *p = &page[loop];
 
-			if (loop + 1 < BITS_PER_LONG)
+			if (loop + 1 < nr_pages)
 				prefetchw(p + 1);
 			__ClearPageReserved(p);
 			set_page_count(p, 0);
@@ -1070,7 +1154,6 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
@@ -1096,7 +1179,6 @@ static void drain_pages(unsigned int cpu)
 
 		pcp = &pset->pcp;
 		free_pcppages_bulk(zone, pcp->count, pcp);
-		pcp->count = 0;
 		local_irq_restore(flags);
 	}
 }
@@ -1159,50 +1241,7 @@ void mark_free_pages(struct zone *zone)
  */
 void free_hot_cold_page(struct page *page, int cold)
 {
-	struct zone *zone = page_zone(page);
-	struct per_cpu_pages *pcp;
-	unsigned long flags;
-	int migratetype;
-	int wasMlocked = __TestClearPageMlocked(page);
-
-	if (!free_pages_prepare(page, 0))
-		return;
-
-	migratetype = get_pageblock_migratetype(page);
-	set_page_private(page, migratetype);
-	local_irq_save(flags);
-	if (unlikely(wasMlocked))
-		free_page_mlock(page);
-	__count_vm_event(PGFREE);
-
-	/*
-	 * We only track unmovable, reclaimable and movable on pcp lists.
-	 * Free ISOLATE pages back to the allocator because they are being
-	 * offlined but treat RESERVE as movable pages so we can get those
-	 * areas back if necessary. Otherwise, we may have to free
-	 * excessively into the page allocator
-	 */
-	if (migratetype >= MIGRATE_PCPTYPES) {
-		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
-			goto out;
-		}
-		migratetype = MIGRATE_MOVABLE;
-	}
-
-	pcp = &this_cpu_ptr(zone->pageset)->pcp;
-	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
-
-out:
-	local_irq_restore(flags);
+	free_pcp_page(page, 0, cold);
 }
 
 /*
@@ -1292,21 +1331,40 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PAGE_ALLOC_COSTLY_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			/* refill with about pcp->batch base pages */
+			int batch = max(pcp->batch >> order, 1);
+
+			if (order)
+				pcp->high_order_miss++;
+			pcp->count += rmqueue_bulk(zone, order, batch, list,
+					migratetype, cold) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
-		}
+		} else if (order)
+			pcp->high_order_hit++;
 
 		if (cold)
 			page = list_entry(list->prev, struct page, lru);
@@ -1314,23 +1372,12 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
+		if (page)
+			compaction_account_alloc(zone, order, gfp_flags);
 		spin_unlock(&zone->lock);
 		if (!page)
 			goto failed;
@@ -2003,7 +2050,8 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 		goto nopage;
 
 restart:
-	wake_all_kswapd(order, zonelist, high_zoneidx);
+	if (!(gfp_mask & __GFP_NO_KSWAPD))
+		wake_all_kswapd(order, zonelist, high_zoneidx);
 
 	/*
 	 * OK, we're below the kswapd watermark and have kicked background
@@ -3229,6 +3277,86 @@ static void setup_zone_migrate_reserve(struct zone *zone)
 	}
 }
 
+static void __meminit __init_single_page(struct page *page, unsigned long pfn,
+					 unsigned long zone, int nid)
+{
+	struct zone *z = &NODE_DATA(nid)->node_zones[zone];
+
+	set_page_links(page, zone, nid, pfn);
+	mminit_verify_page_links(page, zone, nid, pfn);
+	init_page_count(page);
+	reset_page_mapcount(page);
+	SetPageReserved(page);
+	/*
+	 * Mark the block movable so that blocks are reserved for
+	 * movable at startup. This will force kernel allocations
+	 * to reserve their blocks rather than leaking throughout
+	 * the address space during boot when many long-lived
+	 * kernel allocations are made. Later some blocks near
+	 * the start are marked MIGRATE_RESERVE by
+	 * setup_zone_migrate_reserve()
+	 *
+	 * bitmap is created for zone's valid pfn range. but memmap
+	 * can be created for invalid pages (for alignment)
+	 * check here not to call set_pageblock_migratetype() against
+	 * pfn out of zone.
+	 */
+	if ((z->zone_start_pfn <= pfn)
+	    && (pfn < z->zone_start_pfn + z->spanned_pages)
+	    && !(pfn & (pageblock_nr_pages - 1)))
+		set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+
+	INIT_LIST_HEAD(&page->lru);
+#ifdef WANT_PAGE_VIRTUAL
+	/* The shift won't overflow because ZONE_NORMAL is below 4G. */
+	if (!is_highmem_idx(zone))
+		set_page_address(page, __va(pfn << PAGE_SHIFT));
+#endif
+}
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/*
+ * Only the highest zone of a node is deferred, the lower ones are there
+ * for address-limited allocations.  At least this much of the highest
+ * zone is still initialised at boot, for what is allocated before the
+ * pgdatinit threads get to run.
+ */
+#define DEFERRED_INIT_PAGES	(2UL << (30 - PAGE_SHIFT))
+
+static inline void reset_deferred_meminit(pg_data_t *pgdat)
+{
+	pgdat->first_deferred_pfn = ULONG_MAX;
+}
+
+/* Returns false once the rest of the zone is to be left to pgdatinit */
+static bool __meminit update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+					unsigned long zone_end,
+					unsigned long *nr_initialised)
+{
+	if (zone_end < pgdat->node_start_pfn + pgdat->node_spanned_pages)
+		return true;
+
+	(*nr_initialised)++;
+	if (*nr_initialised > DEFERRED_INIT_PAGES &&
+	    !(pfn & (PAGES_PER_SECTION - 1))) {
+		pgdat->first_deferred_pfn = pfn;
+		return false;
+	}
+	return true;
+}
+#else
+static inline void reset_deferred_meminit(pg_data_t *pgdat)
+{
+}
+
+static inline bool update_defer_init(pg_data_t *pgdat, unsigned long pfn,
+				     unsigned long zone_end,
+				     unsigned long *nr_initialised)
+{
+	return true;
+}
+#endif
+
 /*
  * Initially all pages are reserved - free ones are freed
  * up by free_all_bootmem() once the early boot process is
@@ -3237,15 +3365,14 @@ static void setup_zone_migrate_reserve(struct zone *zone)
 void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		unsigned long start_pfn, enum memmap_context context)
 {
-	struct page *page;
+	pg_data_t *pgdat = NODE_DATA(nid);
 	unsigned long end_pfn = start_pfn + size;
+	unsigned long nr_initialised = 0;
 	unsigned long pfn;
-	struct zone *z;
 
 	if (highest_memmap_pfn < end_pfn - 1)
 		highest_memmap_pfn = end_pfn - 1;
 
-	z = &NODE_DATA(nid)->node_zones[zone];
 	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
 		/*
 		 * There can be holes in boot-time mem_map[]s
@@ -3257,38 +3384,11 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 				continue;
 			if (!early_pfn_in_nid(pfn, nid))
 				continue;
+			if (!update_defer_init(pgdat, pfn, end_pfn,
+					       &nr_initialised))
+				break;
 		}
-		page = pfn_to_page(pfn);
-		set_page_links(page, zone, nid, pfn);
-		mminit_verify_page_links(page, zone, nid, pfn);
-		init_page_count(page);
-		reset_page_mapcount(page);
-		SetPageReserved(page);
-		/*
-		 * Mark the block movable so that blocks are reserved for
-		 * movable at startup. This will force kernel allocations
-		 * to reserve their blocks rather than leaking throughout
-		 * the address space during boot when many long-lived
-		 * kernel allocations are made. Later some blocks near
-		 * the start are marked MIGRATE_RESERVE by
-		 * setup_zone_migrate_reserve()
-		 *
-		 * bitmap is created for zone's valid pfn range. but memmap
-		 * can be created for invalid pages (for alignment)
-		 * check here not to call set_pageblock_migratetype() against
-		 * pfn out of zone.
-		 */
-		if ((z->zone_start_pfn <= pfn)
-		    && (pfn < z->zone_start_pfn + z->spanned_pages)
-		    && !(pfn & (pageblock_nr_pages - 1)))
-			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-
-		INIT_LIST_HEAD(&page->lru);
-#ifdef WANT_PAGE_VIRTUAL
-		/* The shift won't overflow because ZONE_NORMAL is below 4G. */
-		if (!is_highmem_idx(zone))
-			set_page_address(page, __va(pfn << PAGE_SHIFT));
-#endif
+		__init_single_page(pfn_to_page(pfn), pfn, zone, nid);
 	}
 }
 
@@ -3359,7 +3459,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3367,8 +3467,8 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -3715,6 +3815,212 @@ void * __init __alloc_memory_core_early(int nid, u64 size, u64 align,
 }
 #endif
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+static atomic_t pgdat_init_n_undone __initdata;
+static __initdata DECLARE_COMPLETION(pgdat_init_all_done_comp);
+
+/*
+ * Returns the end, at most @end_pfn, of the run of pfns from @pfn whose
+ * struct pages are either all deferred, those of node *@nid, or all
+ * initialised already, *@nid = -1.  This lets callers look up the node
+ * once per run of a range rather than for every pfn.
+ */
+unsigned long __init deferred_pfn_run(unsigned long pfn,
+				      unsigned long end_pfn, int *nid)
+{
+	int i;
+
+	*nid = -1;
+	for_each_online_node(i) {
+		pg_data_t *pgdat = NODE_DATA(i);
+		unsigned long node_end = pgdat->node_start_pfn +
+					 pgdat->node_spanned_pages;
+
+		if (pfn >= node_end)
+			continue;
+		if (pfn < pgdat->node_start_pfn) {
+			/* in a hole, which ends where this node starts */
+			end_pfn = min(end_pfn, pgdat->node_start_pfn);
+			continue;
+		}
+		if (pfn < pgdat->first_deferred_pfn)
+			return min3(end_pfn, node_end, pgdat->first_deferred_pfn);
+		*nid = i;
+		return min(end_pfn, node_end);
+	}
+	return end_pfn;
+}
+
+/* The zone whose tail is deferred, the highest populated one */
+static struct zone * __init deferred_zone(pg_data_t *pgdat)
+{
+	unsigned long pfn = pgdat->first_deferred_pfn;
+	struct zone *zone;
+
+	for (zone = pgdat->node_zones;
+	     zone < pgdat->node_zones + MAX_NR_ZONES - 1; zone++) {
+		if (pfn < zone->zone_start_pfn + zone->spanned_pages)
+			break;
+	}
+	return zone;
+}
+
+/*
+ * Initialise the struct pages of a memblock reserved range that lie in
+ * the deferred part of a node, so that they are usable from boot.  The
+ * pgdatinit threads then recognise them by their page->flags.
+ */
+void __init reserve_bootmem_region(phys_addr_t start, phys_addr_t end)
+{
+	unsigned long pfn = PFN_DOWN(start);
+	unsigned long end_pfn = PFN_UP(end);
+
+	while (pfn < end_pfn) {
+		unsigned long zid, next;
+		int nid;
+
+		next = deferred_pfn_run(pfn, end_pfn, &nid);
+		if (nid < 0) {
+			pfn = next;
+			continue;
+		}
+		zid = zone_idx(deferred_zone(NODE_DATA(nid)));
+		for (; pfn < next; pfn++) {
+			if (early_pfn_valid(pfn))
+				__init_single_page(pfn_to_page(pfn), pfn,
+						   zid, nid);
+		}
+	}
+}
+
+static void __init deferred_free_range(unsigned long pfn,
+				       unsigned long nr_pages)
+{
+	while (nr_pages) {
+		unsigned int order = __fls(nr_pages);
+
+		if (pfn && __ffs(pfn) < order)
+			order = __ffs(pfn);
+		if (order > MAX_ORDER - 1)
+			order = MAX_ORDER - 1;
+		__free_pages_bootmem(pfn_to_page(pfn), order);
+		pfn += 1UL << order;
+		nr_pages -= 1UL << order;
+	}
+}
+
+/*
+ * Initialise the struct pages of [pfn, end_pfn), and if @free hand the
+ * ones which are not reserved to the buddy allocator, a MAX_ORDER block
+ * at a time.  Returns the number of struct pages initialised.
+ */
+static unsigned long __init deferred_init_range(struct zone *zone, int nid,
+						unsigned long pfn,
+						unsigned long end_pfn,
+						bool free)
+{
+	unsigned long zid = zone_idx(zone);
+	unsigned long nr_init = 0, nr_free = 0, free_pfn = 0;
+
+	for (; pfn < end_pfn; pfn++) {
+		struct page *page = NULL;
+
+		if (early_pfn_valid(pfn) && early_pfn_in_nid(pfn, nid))
+			page = pfn_to_page(pfn);
+		/*
+		 * The memmap was handed out zeroed: anything in the flags
+		 * means reserve_bootmem_region() has been here already.
+		 */
+		if (page && !page->flags) {
+			__init_single_page(page, pfn, zid, nid);
+			nr_init++;
+			if (free && !nr_free++)
+				free_pfn = pfn;
+			if ((pfn + 1) & (MAX_ORDER_NR_PAGES - 1))
+				continue;
+		}
+		deferred_free_range(free_pfn, nr_free);
+		nr_free = 0;
+		cond_resched();
+	}
+	deferred_free_range(free_pfn, nr_free);
+
+	return nr_init;
+}
+
+/*
+ * Initialise the deferred struct pages of a node, from a kthread bound to
+ * that node.  Only the active ranges are freed: holes get their struct
+ * pages initialised as reserved, as memmap_init_zone() would.  They are
+ * already counted in totalram_pages by free_all_memory_core_early().
+ */
+static int __init deferred_init_memmap(void *data)
+{
+	pg_data_t *pgdat = data;
+	int nid = pgdat->node_id;
+	const struct cpumask *cpumask = cpumask_of_node(nid);
+	unsigned long first_pfn = pgdat->first_deferred_pfn;
+	unsigned long end_pfn = pgdat->node_start_pfn +
+				pgdat->node_spanned_pages;
+	struct zone *zone = deferred_zone(pgdat);
+	unsigned long start = jiffies;
+	unsigned long nr_pages = 0;
+	unsigned long pfn = first_pfn;
+	int i;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+
+	for_each_active_range_index_in_nid(i, nid) {
+		unsigned long range_start = max(early_node_map[i].start_pfn,
+						first_pfn);
+		unsigned long range_end = min(early_node_map[i].end_pfn,
+					      end_pfn);
+
+		if (range_start >= range_end)
+			continue;
+		nr_pages += deferred_init_range(zone, nid, pfn, range_start,
+						false);
+		nr_pages += deferred_init_range(zone, nid, range_start,
+						range_end, true);
+		pfn = range_end;
+	}
+	nr_pages += deferred_init_range(zone, nid, pfn, end_pfn, false);
+
+	printk(KERN_INFO "node %d initialised, %lu pages in %ums\n",
+	       nid, nr_pages, jiffies_to_msecs(jiffies - start));
+
+	if (atomic_dec_and_test(&pgdat_init_n_undone))
+		complete(&pgdat_init_all_done_comp);
+	return 0;
+}
+
+/*
+ * Called once SMP is up: start a pgdatinit thread on every node with
+ * deferred struct pages, and wait for all of them before init is run.
+ */
+void __init page_alloc_init_late(void)
+{
+	int nid;
+
+	atomic_set(&pgdat_init_n_undone, 1);
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+		struct task_struct *p;
+
+		if (pgdat->first_deferred_pfn == ULONG_MAX)
+			continue;
+		atomic_inc(&pgdat_init_n_undone);
+		p = kthread_run(deferred_init_memmap, pgdat,
+				"pgdatinit%d", nid);
+		if (IS_ERR(p))
+			deferred_init_memmap(pgdat);
+	}
+	if (!atomic_dec_and_test(&pgdat_init_n_undone))
+		wait_for_completion(&pgdat_init_all_done_comp);
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
+
 
 void __init work_with_active_regions(int nid, work_fn_t work_fn, void *data)
 {
@@ -4076,6 +4382,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -4139,6 +4448,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 		zone->reclaim_stat.recent_rotated[1] = 0;
 		zone->reclaim_stat.recent_scanned[0] = 0;
 		zone->reclaim_stat.recent_scanned[1] = 0;
+		lru_gen_init_zone(zone);
 		zap_zone_vm_stats(zone);
 		zone->flags = 0;
 		if (!size)
@@ -4203,6 +4513,7 @@ void __paginginit free_area_init_node(int nid, unsigned long *zones_size,
 	pgdat->node_id = nid;
 	pgdat->node_start_pfn = node_start_pfn;
 	calculate_node_totalpages(pgdat, zones_size, zholes_size);
+	reset_deferred_meminit(pgdat);
 
 	alloc_node_mem_map(pgdat);
 #ifdef CONFIG_FLAT_NODE_MEM_MAP
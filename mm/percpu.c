@@ -29,17 +29,22 @@
  *
  * There are usually many small percpu allocations many of them being
  * as small as 4 bytes.  The allocator organizes chunks into lists
- * according to free size and tries to allocate from the fullest one.
- * Each chunk keeps the maximum contiguous area size hint which is
- * guaranteed to be equal to or larger than the maximum contiguous
- * area in the chunk.  This helps the allocator not to iterate the
- * chunk maps unnecessarily.
- *
- * Allocation state in each chunk is kept using an array of integers
- * on chunk->map.  A positive value in the map represents a free
- * region and negative allocated.  Allocation inside a chunk is done
- * by scanning this map sequentially and serving the first matching
- * entry.  This is mostly copied from the percpu_modalloc() allocator.
+ * according to the largest contiguous free area and tries to allocate
+ * from the fullest one.  A bitmap of non-empty slots lets the
+ * allocator jump straight to the lists which can possibly serve a
+ * request instead of walking every slot.
+ *
+ * Allocation state in each chunk is kept in two bitmaps, each bit
+ * standing for PCPU_MIN_ALLOC_SIZE bytes.  chunk->alloc_map tracks
+ * which units are in use and chunk->bound_map marks the start of
+ * every allocation (and the end of the last one) so that free only
+ * needs the offset.  The bitmaps are split into PCPU_BITMAP_BLOCK_SIZE
+ * blocks, each with metadata describing its largest free area and the
+ * free areas touching its edges.  Allocation and free only rescan the
+ * blocks they touch and the chunk-wide contiguous hint is derived from
+ * the block metadata, so their cost no longer grows with the number
+ * of live allocations in the chunk.
+ *
  * Chunks can be determined from the address using the index field
  * in the page struct. The index field contains a pointer to the chunk.
  *
@@ -74,7 +79,15 @@
 #include <asm/io.h>
 
 #define PCPU_SLOT_BASE_SHIFT		5	/* 1-31 shares the same slot */
-#define PCPU_DFL_MAP_ALLOC		16	/* start a map with 16 ents */
+
+/* minimum allocation unit, one bit in the allocation bitmaps */
+#define PCPU_MIN_ALLOC_SHIFT		2
+#define PCPU_MIN_ALLOC_SIZE		(1 << PCPU_MIN_ALLOC_SHIFT)
+
+/* the bitmaps are managed in blocks of PCPU_BITMAP_BLOCK_SIZE bytes */
+#define PCPU_BITMAP_BLOCK_SIZE		PAGE_SIZE
+#define PCPU_BITMAP_BLOCK_BITS		(PCPU_BITMAP_BLOCK_SIZE >>	\
+					 PCPU_MIN_ALLOC_SHIFT)
 
 #ifdef CONFIG_SMP
 /* default addr <-> pcpu_ptr mapping, override in asm/percpu.h if necessary */
@@ -96,14 +109,30 @@
 #define __pcpu_ptr_to_addr(ptr)		(void __force *)(ptr)
 #endif	/* CONFIG_SMP */
 
+/*
+ * Per-block allocation metadata.  All values are in bits of the
+ * allocation bitmap and relative to the start of the block.
+ */
+struct pcpu_block_md {
+	int			contig_hint;	/* largest free area */
+	int			contig_hint_start; /* its start */
+	int			left_free;	/* free area at the start */
+	int			right_free;	/* free area at the end */
+	int			first_free;	/* first free bit */
+};
+
 struct pcpu_chunk {
 	struct list_head	list;		/* linked to pcpu_slot lists */
-	int			free_size;	/* free bytes in the chunk */
-	int			contig_hint;	/* max contiguous size hint */
+	int			free_bytes;	/* free bytes in the chunk */
+	int			contig_bits;	/* max contiguous free bits */
+	int			contig_bits_start; /* where contig_bits starts */
 	void			*base_addr;	/* base address of this chunk */
-	int			map_used;	/* # of map entries used */
-	int			map_alloc;	/* # of map entries allocated */
-	int			*map;		/* allocation map */
+	unsigned long		*alloc_map;	/* allocation bitmap */
+	unsigned long		*bound_map;	/* allocation boundaries */
+	struct pcpu_block_md	*md_blocks;	/* per-block metadata */
+	int			start_offset;	/* hidden head, first chunk */
+	int			end_offset;	/* hidden tail, first chunk */
+	int			nr_alloc;	/* # of live allocations */
 	void			*data;		/* chunk data */
 	bool			immutable;	/* no [de]population allowed */
 	unsigned long		populated[];	/* populated bitmap */
@@ -177,6 +206,7 @@ static DEFINE_MUTEX(pcpu_alloc_mutex);	/* protects whole alloc and reclaim */
 static DEFINE_SPINLOCK(pcpu_lock);	/* protects index data structures */
 
 static struct list_head *pcpu_slot __read_mostly; /* chunk list slots */
+static unsigned long *pcpu_slot_nonempty __read_mostly; /* non-empty slots */
 
 /* reclaim work to release fully free chunks, scheduled from free path */
 static void pcpu_reclaim(struct work_struct *work);
@@ -210,12 +240,28 @@ static int pcpu_size_to_slot(int size)
 	return __pcpu_size_to_slot(size);
 }
 
+/*
+ * Chunks are slotted by their largest contiguous free area, so any
+ * chunk sitting in a slot above pcpu_size_to_slot(size) can serve
+ * @size bytes as long as alignment permits.
+ */
 static int pcpu_chunk_slot(const struct pcpu_chunk *chunk)
 {
-	if (chunk->free_size < sizeof(int) || chunk->contig_hint < sizeof(int))
+	if (chunk->free_bytes < PCPU_MIN_ALLOC_SIZE || !chunk->contig_bits)
 		return 0;
 
-	return pcpu_size_to_slot(chunk->free_size);
+	return pcpu_size_to_slot(chunk->contig_bits << PCPU_MIN_ALLOC_SHIFT);
+}
+
+/* number of bits in the allocation bitmap of a chunk */
+static int pcpu_chunk_map_bits(void)
+{
+	return pcpu_unit_size >> PCPU_MIN_ALLOC_SHIFT;
+}
+
+static int pcpu_size_to_bits(size_t size)
+{
+	return DIV_ROUND_UP(size, PCPU_MIN_ALLOC_SIZE);
 }
 
 /* set the pointer to a chunk in a page struct */
@@ -316,6 +362,21 @@ static void pcpu_mem_free(void *ptr, size_t size)
 		vfree(ptr);
 }
 
+/**
+ * pcpu_slot_update - update the non-empty slot bitmap
+ * @slot: slot which just gained or lost a chunk
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static void pcpu_slot_update(int slot)
+{
+	if (list_empty(&pcpu_slot[slot]))
+		__clear_bit(slot, pcpu_slot_nonempty);
+	else
+		__set_bit(slot, pcpu_slot_nonempty);
+}
+
 /**
  * pcpu_chunk_relocate - put chunk in the appropriate chunk slot
  * @chunk: chunk of interest
@@ -338,141 +399,191 @@ static void pcpu_chunk_relocate(struct pcpu_chunk *chunk, int oslot)
 			list_move(&chunk->list, &pcpu_slot[nslot]);
 		else
 			list_move_tail(&chunk->list, &pcpu_slot[nslot]);
+		pcpu_slot_update(nslot);
+		if (oslot >= 0)
+			pcpu_slot_update(oslot);
 	}
 }
 
 /**
- * pcpu_need_to_extend - determine whether chunk area map needs to be extended
+ * pcpu_block_refresh_hint - rescan a block and update its metadata
  * @chunk: chunk of interest
+ * @index: index of the block
  *
- * Determine whether area map of @chunk needs to be extended to
- * accomodate a new allocation.
+ * Walk the free areas of block @index of @chunk's allocation bitmap and
+ * recompute its contig hint and edge free areas.
  *
  * CONTEXT:
  * pcpu_lock.
- *
- * RETURNS:
- * New target map allocation length if extension is necessary, 0
- * otherwise.
  */
-static int pcpu_need_to_extend(struct pcpu_chunk *chunk)
+static void pcpu_block_refresh_hint(struct pcpu_chunk *chunk, int index)
 {
-	int new_alloc;
-
-	if (chunk->map_alloc >= chunk->map_used + 2)
-		return 0;
-
-	new_alloc = PCPU_DFL_MAP_ALLOC;
-	while (new_alloc < chunk->map_used + 2)
-		new_alloc *= 2;
+	struct pcpu_block_md *block = &chunk->md_blocks[index];
+	int start = index * PCPU_BITMAP_BLOCK_BITS;
+	int end = start + PCPU_BITMAP_BLOCK_BITS;
+	int rs, re;
+
+	block->contig_hint = 0;
+	block->contig_hint_start = 0;
+	block->left_free = 0;
+	block->right_free = 0;
+	block->first_free = PCPU_BITMAP_BLOCK_BITS;
+
+	rs = find_next_zero_bit(chunk->alloc_map, end, start);
+	if (rs < end)
+		block->first_free = rs - start;
+
+	while (rs < end) {
+		re = find_next_bit(chunk->alloc_map, end, rs);
+
+		if (re - rs > block->contig_hint) {
+			block->contig_hint = re - rs;
+			block->contig_hint_start = rs - start;
+		}
+		if (rs == start)
+			block->left_free = re - rs;
+		if (re == end)
+			block->right_free = re - rs;
 
-	return new_alloc;
+		rs = find_next_zero_bit(chunk->alloc_map, end, re);
+	}
 }
 
 /**
- * pcpu_extend_area_map - extend area map of a chunk
+ * pcpu_block_update_hint - update metadata of the blocks spanning an area
  * @chunk: chunk of interest
- * @new_alloc: new target allocation length of the area map
+ * @bit_off: first bit of the area which was allocated or freed
+ * @bits: size of the area in bits
+ * @free: whether the area was freed
  *
- * Extend area map of @chunk to have @new_alloc entries.
+ * Blocks fully covered by the area are set directly; only the first
+ * and last blocks need rescanning.
  *
  * CONTEXT:
- * Does GFP_KERNEL allocation.  Grabs and releases pcpu_lock.
- *
- * RETURNS:
- * 0 on success, -errno on failure.
+ * pcpu_lock.
  */
-static int pcpu_extend_area_map(struct pcpu_chunk *chunk, int new_alloc)
+static void pcpu_block_update_hint(struct pcpu_chunk *chunk, int bit_off,
+				   int bits, bool free)
 {
-	int *old = NULL, *new = NULL;
-	size_t old_size = 0, new_size = new_alloc * sizeof(new[0]);
-	unsigned long flags;
+	int s_index = bit_off / PCPU_BITMAP_BLOCK_BITS;
+	int e_index = (bit_off + bits - 1) / PCPU_BITMAP_BLOCK_BITS;
+	int i;
 
-	new = pcpu_mem_alloc(new_size);
-	if (!new)
-		return -ENOMEM;
+	pcpu_block_refresh_hint(chunk, s_index);
+	if (e_index != s_index)
+		pcpu_block_refresh_hint(chunk, e_index);
 
-	/* acquire pcpu_lock and switch to new area map */
-	spin_lock_irqsave(&pcpu_lock, flags);
+	for (i = s_index + 1; i < e_index; i++) {
+		struct pcpu_block_md *block = &chunk->md_blocks[i];
+		int nr = free ? PCPU_BITMAP_BLOCK_BITS : 0;
 
-	if (new_alloc <= chunk->map_alloc)
-		goto out_unlock;
+		block->contig_hint = nr;
+		block->contig_hint_start = 0;
+		block->left_free = nr;
+		block->right_free = nr;
+		block->first_free = free ? 0 : PCPU_BITMAP_BLOCK_BITS;
+	}
+}
 
-	old_size = chunk->map_alloc * sizeof(chunk->map[0]);
-	old = chunk->map;
+/**
+ * pcpu_chunk_refresh_hint - recompute the chunk wide contig hint
+ * @chunk: chunk of interest
+ *
+ * Combine the per-block metadata, including free areas which span
+ * block boundaries, into @chunk->contig_bits.  This only looks at the
+ * block metadata and never at the bitmap itself.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static void pcpu_chunk_refresh_hint(struct pcpu_chunk *chunk)
+{
+	int nr_blocks = pcpu_chunk_map_bits() / PCPU_BITMAP_BLOCK_BITS;
+	int carry = 0, i;
 
-	memcpy(new, old, old_size);
+	chunk->contig_bits = 0;
+	chunk->contig_bits_start = 0;
 
-	chunk->map_alloc = new_alloc;
-	chunk->map = new;
-	new = NULL;
+	for (i = 0; i < nr_blocks; i++) {
+		struct pcpu_block_md *block = &chunk->md_blocks[i];
+		int block_off = i * PCPU_BITMAP_BLOCK_BITS;
 
-out_unlock:
-	spin_unlock_irqrestore(&pcpu_lock, flags);
+		if (block->contig_hint == PCPU_BITMAP_BLOCK_BITS) {
+			carry += PCPU_BITMAP_BLOCK_BITS;
+			continue;
+		}
 
-	/*
-	 * pcpu_mem_free() might end up calling vfree() which uses
-	 * IRQ-unsafe lock and thus can't be called under pcpu_lock.
-	 */
-	pcpu_mem_free(old, old_size);
-	pcpu_mem_free(new, new_size);
+		/* a free area running into this block from the left */
+		if (carry + block->left_free > chunk->contig_bits) {
+			chunk->contig_bits = carry + block->left_free;
+			chunk->contig_bits_start = block_off - carry;
+		}
+		if (block->contig_hint > chunk->contig_bits) {
+			chunk->contig_bits = block->contig_hint;
+			chunk->contig_bits_start = block_off +
+						   block->contig_hint_start;
+		}
+		carry = block->right_free;
+	}
 
-	return 0;
+	if (carry > chunk->contig_bits) {
+		chunk->contig_bits = carry;
+		chunk->contig_bits_start = nr_blocks * PCPU_BITMAP_BLOCK_BITS -
+					   carry;
+	}
 }
 
 /**
- * pcpu_split_block - split a map block
+ * pcpu_find_block_fit - find where to start searching for a free area
  * @chunk: chunk of interest
- * @i: index of map block to split
- * @head: head size in bytes (can be 0)
- * @tail: tail size in bytes (can be 0)
- *
- * Split the @i'th map block into two or three blocks.  If @head is
- * non-zero, @head bytes block is inserted before block @i moving it
- * to @i+1 and reducing its size by @head bytes.
- *
- * If @tail is non-zero, the target block, which can be @i or @i+1
- * depending on @head, is reduced by @tail bytes and @tail byte block
- * is inserted after the target block.
+ * @bits: size of the wanted area in bits
  *
- * @chunk->map must have enough free slots to accomodate the split.
+ * Use the block metadata to skip over the part of @chunk which can't
+ * possibly hold a free area of @bits.  The returned bit is at or
+ * before the first such area, so a bitmap search from it still
+ * serves the lowest fitting offset.
  *
  * CONTEXT:
  * pcpu_lock.
+ *
+ * RETURNS:
+ * Bit offset to start searching from, -1 if @chunk can't fit @bits.
  */
-static void pcpu_split_block(struct pcpu_chunk *chunk, int i,
-			     int head, int tail)
+static int pcpu_find_block_fit(struct pcpu_chunk *chunk, int bits)
 {
-	int nr_extra = !!head + !!tail;
+	int nr_blocks = pcpu_chunk_map_bits() / PCPU_BITMAP_BLOCK_BITS;
+	int carry = 0, i;
 
-	BUG_ON(chunk->map_alloc < chunk->map_used + nr_extra);
+	if (bits > chunk->contig_bits)
+		return -1;
 
-	/* insert new subblocks */
-	memmove(&chunk->map[i + nr_extra], &chunk->map[i],
-		sizeof(chunk->map[0]) * (chunk->map_used - i));
-	chunk->map_used += nr_extra;
+	for (i = 0; i < nr_blocks; i++) {
+		struct pcpu_block_md *block = &chunk->md_blocks[i];
+		int block_off = i * PCPU_BITMAP_BLOCK_BITS;
 
-	if (head) {
-		chunk->map[i + 1] = chunk->map[i] - head;
-		chunk->map[i++] = head;
-	}
-	if (tail) {
-		chunk->map[i++] -= tail;
-		chunk->map[i] = tail;
+		if (carry + block->left_free >= bits)
+			return block_off - carry;
+		if (block->contig_hint >= bits)
+			return block_off + block->first_free;
+
+		if (block->contig_hint == PCPU_BITMAP_BLOCK_BITS)
+			carry += PCPU_BITMAP_BLOCK_BITS;
+		else
+			carry = block->right_free;
 	}
+
+	return -1;
 }
 
 /**
  * pcpu_alloc_area - allocate area from a pcpu_chunk
  * @chunk: chunk of interest
- * @size: wanted size in bytes
- * @align: wanted align
- *
- * Try to allocate @size bytes area aligned at @align from @chunk.
- * Note that this function only allocates the offset.  It doesn't
- * populate or map the area.
+ * @bits: wanted size in bits
+ * @align: wanted align in bytes
  *
- * @chunk->map must have at least two free slots.
+ * Try to allocate an area of @bits bitmap units aligned at @align
+ * from @chunk.  Note that this function only allocates the offset.
+ * It doesn't populate or map the area.
  *
  * CONTEXT:
  * pcpu_lock.
@@ -481,81 +592,43 @@ static void pcpu_split_block(struct pcpu_chunk *chunk, int i,
  * Allocated offset in @chunk on success, -1 if no matching area is
  * found.
  */
-static int pcpu_alloc_area(struct pcpu_chunk *chunk, int size, int align)
+static int pcpu_alloc_area(struct pcpu_chunk *chunk, int bits, size_t align)
 {
 	int oslot = pcpu_chunk_slot(chunk);
-	int max_contig = 0;
-	int i, off;
-
-	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++])) {
-		bool is_last = i + 1 == chunk->map_used;
-		int head, tail;
+	unsigned long align_mask;
+	int map_bits = pcpu_chunk_map_bits();
+	int start, bit_off;
 
-		/* extra for alignment requirement */
-		head = ALIGN(off, align) - off;
-		BUG_ON(i == 0 && head != 0);
+	align_mask = (max_t(size_t, align, PCPU_MIN_ALLOC_SIZE) >>
+		      PCPU_MIN_ALLOC_SHIFT) - 1;
 
-		if (chunk->map[i] < 0)
-			continue;
-		if (chunk->map[i] < head + size) {
-			max_contig = max(chunk->map[i], max_contig);
-			continue;
-		}
+	start = pcpu_find_block_fit(chunk, bits);
+	if (start < 0)
+		return -1;
 
-		/*
-		 * If head is small or the previous block is free,
-		 * merge'em.  Note that 'small' is defined as smaller
-		 * than sizeof(int), which is very small but isn't too
-		 * uncommon for percpu allocations.
-		 */
-		if (head && (head < sizeof(int) || chunk->map[i - 1] > 0)) {
-			if (chunk->map[i - 1] > 0)
-				chunk->map[i - 1] += head;
-			else {
-				chunk->map[i - 1] -= head;
-				chunk->free_size -= head;
-			}
-			chunk->map[i] -= head;
-			off += head;
-			head = 0;
-		}
+	bit_off = bitmap_find_next_zero_area(chunk->alloc_map, map_bits,
+					     start, bits, align_mask);
+	if (bit_off >= map_bits)
+		return -1;
 
-		/* if tail is small, just keep it around */
-		tail = chunk->map[i] - head - size;
-		if (tail < sizeof(int))
-			tail = 0;
-
-		/* split if warranted */
-		if (head || tail) {
-			pcpu_split_block(chunk, i, head, tail);
-			if (head) {
-				i++;
-				off += head;
-				max_contig = max(chunk->map[i - 1], max_contig);
-			}
-			if (tail)
-				max_contig = max(chunk->map[i + 1], max_contig);
-		}
+	/* mark allocated and record the boundaries */
+	bitmap_set(chunk->alloc_map, bit_off, bits);
+	__set_bit(bit_off, chunk->bound_map);
+	bitmap_clear(chunk->bound_map, bit_off + 1, bits - 1);
+	__set_bit(bit_off + bits, chunk->bound_map);
 
-		/* update hint and mark allocated */
-		if (is_last)
-			chunk->contig_hint = max_contig; /* fully scanned */
-		else
-			chunk->contig_hint = max(chunk->contig_hint,
-						 max_contig);
+	chunk->free_bytes -= bits << PCPU_MIN_ALLOC_SHIFT;
+	chunk->nr_alloc++;
 
-		chunk->free_size -= chunk->map[i];
-		chunk->map[i] = -chunk->map[i];
+	pcpu_block_update_hint(chunk, bit_off, bits, false);
 
-		pcpu_chunk_relocate(chunk, oslot);
-		return off;
-	}
+	/* the chunk hint only changes if the allocation ate into it */
+	if (bit_off < chunk->contig_bits_start + chunk->contig_bits &&
+	    bit_off + bits > chunk->contig_bits_start)
+		pcpu_chunk_refresh_hint(chunk);
 
-	chunk->contig_hint = max_contig;	/* fully scanned */
 	pcpu_chunk_relocate(chunk, oslot);
-
-	/* tell the upper layer that this chunk has no matching area */
-	return -1;
+	return bit_off << PCPU_MIN_ALLOC_SHIFT;
 }
 
 /**
@@ -573,69 +646,275 @@ static int pcpu_alloc_area(struct pcpu_chunk *chunk, int size, int align)
 static void pcpu_free_area(struct pcpu_chunk *chunk, int freeme)
 {
 	int oslot = pcpu_chunk_slot(chunk);
-	int i, off;
+	int bit_off = freeme >> PCPU_MIN_ALLOC_SHIFT;
+	int end, bits;
 
-	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++]))
-		if (off == freeme)
-			break;
-	BUG_ON(off != freeme);
-	BUG_ON(chunk->map[i] > 0);
-
-	chunk->map[i] = -chunk->map[i];
-	chunk->free_size += chunk->map[i];
-
-	/* merge with previous? */
-	if (i > 0 && chunk->map[i - 1] >= 0) {
-		chunk->map[i - 1] += chunk->map[i];
-		chunk->map_used--;
-		memmove(&chunk->map[i], &chunk->map[i + 1],
-			(chunk->map_used - i) * sizeof(chunk->map[0]));
-		i--;
+	BUG_ON(freeme & (PCPU_MIN_ALLOC_SIZE - 1));
+	BUG_ON(!test_bit(bit_off, chunk->bound_map));
+
+	end = find_next_bit(chunk->bound_map, pcpu_chunk_map_bits(),
+			    bit_off + 1);
+	bits = end - bit_off;
+
+	/*
+	 * The boundary bits are left alone, @bit_off may be the end of
+	 * the area before.  Stale bits are cleaned up by the next
+	 * allocation covering them.
+	 */
+	bitmap_clear(chunk->alloc_map, bit_off, bits);
+
+	chunk->free_bytes += bits << PCPU_MIN_ALLOC_SHIFT;
+	chunk->nr_alloc--;
+
+	pcpu_block_update_hint(chunk, bit_off, bits, true);
+	pcpu_chunk_refresh_hint(chunk);
+	pcpu_chunk_relocate(chunk, oslot);
+}
+
+/**
+ * pcpu_chunk_init_hints - initialize allocation state of a fresh chunk
+ * @chunk: chunk of interest
+ *
+ * Hide [0, @chunk->start_offset) and [@chunk->end_offset,
+ * pcpu_unit_size) as if they were allocated and build the block and
+ * chunk hints.  The offsets are rounded inwards to the allocation
+ * unit.  The bitmaps must be zeroed.
+ */
+static void pcpu_chunk_init_hints(struct pcpu_chunk *chunk)
+{
+	int map_bits = pcpu_chunk_map_bits();
+	int start_bits = pcpu_size_to_bits(chunk->start_offset);
+	int end_bits = chunk->end_offset >> PCPU_MIN_ALLOC_SHIFT;
+	int i;
+
+	if (start_bits) {
+		bitmap_set(chunk->alloc_map, 0, start_bits);
+		__set_bit(0, chunk->bound_map);
+		__set_bit(start_bits, chunk->bound_map);
 	}
-	/* merge with next? */
-	if (i + 1 < chunk->map_used && chunk->map[i + 1] >= 0) {
-		chunk->map[i] += chunk->map[i + 1];
-		chunk->map_used--;
-		memmove(&chunk->map[i + 1], &chunk->map[i + 2],
-			(chunk->map_used - (i + 1)) * sizeof(chunk->map[0]));
+	if (end_bits < map_bits) {
+		bitmap_set(chunk->alloc_map, end_bits, map_bits - end_bits);
+		__set_bit(end_bits, chunk->bound_map);
 	}
+	__set_bit(map_bits, chunk->bound_map);
 
-	chunk->contig_hint = max(chunk->map[i], chunk->contig_hint);
-	pcpu_chunk_relocate(chunk, oslot);
+	chunk->free_bytes = (end_bits - start_bits) << PCPU_MIN_ALLOC_SHIFT;
+
+	for (i = 0; i < map_bits / PCPU_BITMAP_BLOCK_BITS; i++)
+		pcpu_block_refresh_hint(chunk, i);
+	pcpu_chunk_refresh_hint(chunk);
 }
 
 static struct pcpu_chunk *pcpu_alloc_chunk(void)
 {
+	int map_bits = pcpu_chunk_map_bits();
 	struct pcpu_chunk *chunk;
 
 	chunk = pcpu_mem_alloc(pcpu_chunk_struct_size);
 	if (!chunk)
 		return NULL;
 
-	chunk->map = pcpu_mem_alloc(PCPU_DFL_MAP_ALLOC * sizeof(chunk->map[0]));
-	if (!chunk->map) {
-		kfree(chunk);
-		return NULL;
-	}
-
-	chunk->map_alloc = PCPU_DFL_MAP_ALLOC;
-	chunk->map[chunk->map_used++] = pcpu_unit_size;
+	chunk->alloc_map = pcpu_mem_alloc(BITS_TO_LONGS(map_bits) *
+					  sizeof(unsigned long));
+	chunk->bound_map = pcpu_mem_alloc(BITS_TO_LONGS(map_bits + 1) *
+					  sizeof(unsigned long));
+	chunk->md_blocks = pcpu_mem_alloc(pcpu_unit_pages *
+					  sizeof(chunk->md_blocks[0]));
+	if (!chunk->alloc_map || !chunk->bound_map || !chunk->md_blocks)
+		goto err;
 
 	INIT_LIST_HEAD(&chunk->list);
-	chunk->free_size = pcpu_unit_size;
-	chunk->contig_hint = pcpu_unit_size;
+	chunk->start_offset = 0;
+	chunk->end_offset = pcpu_unit_size;
+	pcpu_chunk_init_hints(chunk);
 
 	return chunk;
+
+err:
+	pcpu_mem_free(chunk->md_blocks,
+		      pcpu_unit_pages * sizeof(chunk->md_blocks[0]));
+	pcpu_mem_free(chunk->bound_map,
+		      BITS_TO_LONGS(map_bits + 1) * sizeof(unsigned long));
+	pcpu_mem_free(chunk->alloc_map,
+		      BITS_TO_LONGS(map_bits) * sizeof(unsigned long));
+	pcpu_mem_free(chunk, pcpu_chunk_struct_size);
+	return NULL;
 }
 
 static void pcpu_free_chunk(struct pcpu_chunk *chunk)
 {
+	int map_bits = pcpu_chunk_map_bits();
+
 	if (!chunk)
 		return;
-	pcpu_mem_free(chunk->map, chunk->map_alloc * sizeof(chunk->map[0]));
-	kfree(chunk);
+	pcpu_mem_free(chunk->md_blocks,
+		      pcpu_unit_pages * sizeof(chunk->md_blocks[0]));
+	pcpu_mem_free(chunk->bound_map,
+		      BITS_TO_LONGS(map_bits + 1) * sizeof(unsigned long));
+	pcpu_mem_free(chunk->alloc_map,
+		      BITS_TO_LONGS(map_bits) * sizeof(unsigned long));
+	pcpu_mem_free(chunk, pcpu_chunk_struct_size);
+}
+
+#ifdef CONFIG_PERCPU_STATS
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/* global allocator statistics, protected by pcpu_lock */
+static struct {
+	u64		nr_alloc;	/* lifetime # of allocations */
+	u64		nr_dealloc;	/* lifetime # of deallocations */
+	int		nr_cur_alloc;	/* current # of allocations */
+	int		nr_max_alloc;	/* max # of live allocations */
+	int		nr_chunks;	/* current # of dynamic chunks */
+	int		nr_max_chunks;	/* max # of dynamic chunks */
+	size_t		min_alloc_size;	/* min allocation size */
+	size_t		max_alloc_size;	/* max allocation size */
+} pcpu_stats;
+
+static void pcpu_stats_area_alloc(size_t size)
+{
+	pcpu_stats.nr_alloc++;
+	pcpu_stats.nr_cur_alloc++;
+	pcpu_stats.nr_max_alloc = max(pcpu_stats.nr_max_alloc,
+				      pcpu_stats.nr_cur_alloc);
+	if (!pcpu_stats.min_alloc_size || size < pcpu_stats.min_alloc_size)
+		pcpu_stats.min_alloc_size = size;
+	pcpu_stats.max_alloc_size = max(pcpu_stats.max_alloc_size, size);
+}
+
+static void pcpu_stats_area_dealloc(void)
+{
+	pcpu_stats.nr_dealloc++;
+	pcpu_stats.nr_cur_alloc--;
+}
+
+static void pcpu_stats_chunk_alloc(void)
+{
+	pcpu_stats.nr_chunks++;
+	pcpu_stats.nr_max_chunks = max(pcpu_stats.nr_max_chunks,
+				       pcpu_stats.nr_chunks);
+}
+
+static void pcpu_stats_chunk_dealloc(void)
+{
+	pcpu_stats.nr_chunks--;
 }
 
+/*
+ * Walk the free areas of @chunk, skipping the hidden head and tail of
+ * the first chunk, and print how fragmented its free space is.
+ */
+static void pcpu_stats_show_chunk(struct seq_file *m,
+				  struct pcpu_chunk *chunk, const char *type)
+{
+	int start = pcpu_size_to_bits(chunk->start_offset);
+	int end = chunk->end_offset >> PCPU_MIN_ALLOC_SHIFT;
+	int nr_frag = 0, max_frag = 0, min_alloc = 0, max_alloc = 0;
+	int rs, re, as, ae;
+
+	for (rs = find_next_zero_bit(chunk->alloc_map, end, start); rs < end;
+	     rs = find_next_zero_bit(chunk->alloc_map, end, re)) {
+		re = find_next_bit(chunk->alloc_map, end, rs);
+		nr_frag++;
+		max_frag = max(max_frag, re - rs);
+	}
+
+	for (as = find_next_bit(chunk->bound_map, end, start); as < end;
+	     as = ae) {
+		ae = find_next_bit(chunk->bound_map, end + 1, as + 1);
+		if (!test_bit(as, chunk->alloc_map))
+			continue;
+		if (!min_alloc || ae - as < min_alloc)
+			min_alloc = ae - as;
+		max_alloc = max(max_alloc, ae - as);
+	}
+
+	seq_printf(m, "%-9s %8d %10d %10d %10d %8d %10d %10d %10d\n",
+		   type, chunk->nr_alloc, chunk->free_bytes,
+		   chunk->contig_bits << PCPU_MIN_ALLOC_SHIFT, nr_frag,
+		   chunk->free_bytes - (max_frag << PCPU_MIN_ALLOC_SHIFT),
+		   chunk->contig_bits_start << PCPU_MIN_ALLOC_SHIFT,
+		   min_alloc << PCPU_MIN_ALLOC_SHIFT,
+		   max_alloc << PCPU_MIN_ALLOC_SHIFT);
+}
+
+static int pcpu_stats_show(struct seq_file *m, void *v)
+{
+	struct pcpu_chunk *chunk;
+	int slot;
+
+	spin_lock_irq(&pcpu_lock);
+
+	seq_printf(m,
+		   "nr_alloc:         %8llu\n"
+		   "nr_dealloc:       %8llu\n"
+		   "nr_cur_alloc:     %8d\n"
+		   "nr_max_alloc:     %8d\n"
+		   "nr_chunks:        %8d\n"
+		   "nr_max_chunks:    %8d\n"
+		   "min_alloc_size:   %8zu\n"
+		   "max_alloc_size:   %8zu\n"
+		   "unit_size:        %8d\n"
+		   "nr_units:         %8d\n\n",
+		   (unsigned long long)pcpu_stats.nr_alloc,
+		   (unsigned long long)pcpu_stats.nr_dealloc,
+		   pcpu_stats.nr_cur_alloc, pcpu_stats.nr_max_alloc,
+		   pcpu_stats.nr_chunks, pcpu_stats.nr_max_chunks,
+		   pcpu_stats.min_alloc_size, pcpu_stats.max_alloc_size,
+		   pcpu_unit_size, pcpu_nr_units);
+
+	seq_printf(m, "%-9s %8s %10s %10s %10s %8s %10s %10s %10s\n",
+		   "chunk", "nr_alloc", "free_bytes", "contig", "nr_frag",
+		   "sum_frag", "contig_off", "min_alloc", "max_alloc");
+
+	if (pcpu_reserved_chunk)
+		pcpu_stats_show_chunk(m, pcpu_reserved_chunk, "reserved");
+
+	for (slot = 0; slot < pcpu_nr_slots; slot++)
+		list_for_each_entry(chunk, &pcpu_slot[slot], list)
+			pcpu_stats_show_chunk(m, chunk,
+					      chunk == pcpu_first_chunk ?
+					      "first" : "dynamic");
+
+	spin_unlock_irq(&pcpu_lock);
+	return 0;
+}
+
+static int pcpu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pcpu_stats_show, NULL);
+}
+
+static const struct file_operations pcpu_stats_fops = {
+	.open		= pcpu_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init pcpu_stats_debugfs_init(void)
+{
+	debugfs_create_file("percpu_stats", 0444, NULL, NULL,
+			    &pcpu_stats_fops);
+	return 0;
+}
+late_initcall(pcpu_stats_debugfs_init);
+#else
+static inline void pcpu_stats_area_alloc(size_t size)
+{
+}
+static inline void pcpu_stats_area_dealloc(void)
+{
+}
+static inline void pcpu_stats_chunk_alloc(void)
+{
+}
+static inline void pcpu_stats_chunk_dealloc(void)
+{
+}
+#endif	/* CONFIG_PERCPU_STATS */
+
 /*
  * Chunk management implementation.
  *
@@ -711,7 +990,7 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 	static int warn_limit = 10;
 	struct pcpu_chunk *chunk;
 	const char *err;
-	int slot, off, new_alloc;
+	int bits, slot, off;
 	unsigned long flags;
 
 	if (unlikely(!size || size > PCPU_MIN_UNIT_SIZE || align > PAGE_SIZE)) {
@@ -720,6 +999,8 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 		return NULL;
 	}
 
+	bits = pcpu_size_to_bits(size);
+
 	mutex_lock(&pcpu_alloc_mutex);
 	spin_lock_irqsave(&pcpu_lock, flags);
 
@@ -727,21 +1008,7 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 	if (reserved && pcpu_reserved_chunk) {
 		chunk = pcpu_reserved_chunk;
 
-		if (size > chunk->contig_hint) {
-			err = "alloc from reserved chunk failed";
-			goto fail_unlock;
-		}
-
-		while ((new_alloc = pcpu_need_to_extend(chunk))) {
-			spin_unlock_irqrestore(&pcpu_lock, flags);
-			if (pcpu_extend_area_map(chunk, new_alloc) < 0) {
-				err = "failed to extend area map of reserved chunk";
-				goto fail_unlock_mutex;
-			}
-			spin_lock_irqsave(&pcpu_lock, flags);
-		}
-
-		off = pcpu_alloc_area(chunk, size, align);
+		off = pcpu_alloc_area(chunk, bits, align);
 		if (off >= 0)
 			goto area_found;
 
@@ -750,29 +1017,22 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved)
 	}
 
 restart:
-	/* search through normal chunks */
-	for (slot = pcpu_size_to_slot(size); slot < pcpu_nr_slots; slot++) {
+	/*
+	 * Search through normal chunks.  Only walk the slots which have
+	 * chunks on them.  Chunks in slots above the one @size maps to
+	 * are guaranteed to have a large enough free area, so unless
+	 * alignment gets in the way the first chunk tried there wins.
+	 */
+	for (slot = find_next_bit(pcpu_slot_nonempty, pcpu_nr_slots,
+				  pcpu_size_to_slot(size));
+	     slot < pcpu_nr_slots;
+	     slot = find_next_bit(pcpu_slot_nonempty, pcpu_nr_slots,
+				  slot + 1)) {
 		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
-			if (size > chunk->contig_hint)
+			if (bits > chunk->contig_bits)
 				continue;
 
-			new_alloc = pcpu_need_to_extend(chunk);
-			if (new_alloc) {
-				spin_unlock_irqrestore(&pcpu_lock, flags);
-				if (pcpu_extend_area_map(chunk,
-							 new_alloc) < 0) {
-					err = "failed to extend area map";
-					goto fail_unlock_mutex;
-				}
-				spin_lock_irqsave(&pcpu_lock, flags);
-				/*
-				 * pcpu_lock has been dropped, need to
-				 * restart cpu_slot list walking.
-				 */
-				goto restart;
-			}
-
-			off = pcpu_alloc_area(chunk, size, align);
+			off = pcpu_alloc_area(chunk, bits, align);
 			if (off >= 0)
 				goto area_found;
 		}
@@ -789,14 +1049,17 @@ restart:
 
 	spin_lock_irqsave(&pcpu_lock, flags);
 	pcpu_chunk_relocate(chunk, -1);
+	pcpu_stats_chunk_alloc();
 	goto restart;
 
 area_found:
+	pcpu_stats_area_alloc(size);
 	spin_unlock_irqrestore(&pcpu_lock, flags);
 
 	/* populate, map and clear the area */
 	if (pcpu_populate_chunk(chunk, off, size)) {
 		spin_lock_irqsave(&pcpu_lock, flags);
+		pcpu_stats_area_dealloc();
 		pcpu_free_area(chunk, off);
 		err = "failed to populate";
 		goto fail_unlock;
@@ -888,7 +1151,9 @@ static void pcpu_reclaim(struct work_struct *work)
 			continue;
 
 		list_move(&chunk->list, &todo);
+		pcpu_stats_chunk_dealloc();
 	}
+	pcpu_slot_update(pcpu_nr_slots - 1);
 
 	spin_unlock_irq(&pcpu_lock);
 
@@ -926,10 +1191,11 @@ void free_percpu(void __percpu *ptr)
 	chunk = pcpu_chunk_addr_search(addr);
 	off = addr - chunk->base_addr;
 
+	pcpu_stats_area_dealloc();
 	pcpu_free_area(chunk, off);
 
 	/* if there are more than one fully free chunks, wake up grim reaper */
-	if (chunk->free_size == pcpu_unit_size) {
+	if (chunk->free_bytes == pcpu_unit_size) {
 		struct pcpu_chunk *pos;
 
 		list_for_each_entry(pos, &pcpu_slot[pcpu_nr_slots - 1], list)
@@ -1133,6 +1399,46 @@ static void pcpu_dump_alloc_info(const char *lvl,
 	printk("\n");
 }
 
+/**
+ * pcpu_alloc_first_chunk - allocate a chunk for the first chunk area
+ * @base_addr: base address of the first chunk
+ * @start_offset: offset where the area served by the chunk starts
+ * @end_offset: offset where the area served by the chunk ends
+ *
+ * The static, reserved and dynamic areas of the first chunk share the
+ * same address range but are served by different chunks.  Each one
+ * hides the parts of the unit it doesn't own.
+ *
+ * RETURNS:
+ * The initialized chunk.
+ */
+static struct pcpu_chunk * __init pcpu_alloc_first_chunk(void *base_addr,
+							 int start_offset,
+							 int end_offset)
+{
+	int map_bits = pcpu_chunk_map_bits();
+	struct pcpu_chunk *chunk;
+
+	chunk = alloc_bootmem(pcpu_chunk_struct_size);
+	INIT_LIST_HEAD(&chunk->list);
+	chunk->base_addr = base_addr;
+	chunk->immutable = true;
+	bitmap_fill(chunk->populated, pcpu_unit_pages);
+
+	chunk->alloc_map = alloc_bootmem(BITS_TO_LONGS(map_bits) *
+					 sizeof(unsigned long));
+	chunk->bound_map = alloc_bootmem(BITS_TO_LONGS(map_bits + 1) *
+					 sizeof(unsigned long));
+	chunk->md_blocks = alloc_bootmem(pcpu_unit_pages *
+					 sizeof(chunk->md_blocks[0]));
+
+	chunk->start_offset = start_offset;
+	chunk->end_offset = end_offset;
+	pcpu_chunk_init_hints(chunk);
+
+	return chunk;
+}
+
 /**
  * pcpu_setup_first_chunk - initialize the first percpu chunk
  * @ai: pcpu_alloc_info describing how to percpu area is shaped
@@ -1193,8 +1499,6 @@ int __init pcpu_setup_first_chunk(const struct pcpu_alloc_info *ai,
 				  void *base_addr)
 {
 	static char cpus_buf[4096] __initdata;
-	static int smap[PERCPU_DYNAMIC_EARLY_SLOTS] __initdata;
-	static int dmap[PERCPU_DYNAMIC_EARLY_SLOTS] __initdata;
 	size_t dyn_size = ai->dyn_size;
 	size_t size_sum = ai->static_size + ai->reserved_size + dyn_size;
 	struct pcpu_chunk *schunk, *dchunk = NULL;
@@ -1291,6 +1595,8 @@ int __init pcpu_setup_first_chunk(const struct pcpu_alloc_info *ai,
 	pcpu_slot = alloc_bootmem(pcpu_nr_slots * sizeof(pcpu_slot[0]));
 	for (i = 0; i < pcpu_nr_slots; i++)
 		INIT_LIST_HEAD(&pcpu_slot[i]);
+	pcpu_slot_nonempty = alloc_bootmem(BITS_TO_LONGS(pcpu_nr_slots) *
+					   sizeof(unsigned long));
 
 	/*
 	 * Initialize static chunk.  If reserved_size is zero, the
@@ -1299,42 +1605,24 @@ int __init pcpu_setup_first_chunk(const struct pcpu_alloc_info *ai,
 	 * covers static area + reserved area (mostly used for module
 	 * static percpu allocation).
 	 */
-	schunk = alloc_bootmem(pcpu_chunk_struct_size);
-	INIT_LIST_HEAD(&schunk->list);
-	schunk->base_addr = base_addr;
-	schunk->map = smap;
-	schunk->map_alloc = ARRAY_SIZE(smap);
-	schunk->immutable = true;
-	bitmap_fill(schunk->populated, pcpu_unit_pages);
-
 	if (ai->reserved_size) {
-		schunk->free_size = ai->reserved_size;
+		schunk = pcpu_alloc_first_chunk(base_addr, ai->static_size,
+						ai->static_size +
+						ai->reserved_size);
 		pcpu_reserved_chunk = schunk;
 		pcpu_reserved_chunk_limit = ai->static_size + ai->reserved_size;
 	} else {
-		schunk->free_size = dyn_size;
+		schunk = pcpu_alloc_first_chunk(base_addr, ai->static_size,
+						ai->static_size + dyn_size);
 		dyn_size = 0;			/* dynamic area covered */
 	}
-	schunk->contig_hint = schunk->free_size;
-
-	schunk->map[schunk->map_used++] = -ai->static_size;
-	if (schunk->free_size)
-		schunk->map[schunk->map_used++] = schunk->free_size;
 
 	/* init dynamic chunk if necessary */
-	if (dyn_size) {
-		dchunk = alloc_bootmem(pcpu_chunk_struct_size);
-		INIT_LIST_HEAD(&dchunk->list);
-		dchunk->base_addr = base_addr;
-		dchunk->map = dmap;
-		dchunk->map_alloc = ARRAY_SIZE(dmap);
-		dchunk->immutable = true;
-		bitmap_fill(dchunk->populated, pcpu_unit_pages);
-
-		dchunk->contig_hint = dchunk->free_size = dyn_size;
-		dchunk->map[dchunk->map_used++] = -pcpu_reserved_chunk_limit;
-		dchunk->map[dchunk->map_used++] = dchunk->free_size;
-	}
+	if (dyn_size)
+		dchunk = pcpu_alloc_first_chunk(base_addr,
+						pcpu_reserved_chunk_limit,
+						pcpu_reserved_chunk_limit +
+						dyn_size);
 
 	/* link the first chunk in */
 	pcpu_first_chunk = dchunk ?: schunk;
@@ -1871,33 +2159,3 @@ void __init setup_per_cpu_areas(void)
 }
 
 #endif	/* CONFIG_SMP */
-
-/*
- * First and reserved chunks are initialized with temporary allocation
- * map in initdata so that they can be used before slab is online.
- * This function is called after slab is brought up and replaces those
- * with properly allocated maps.
- */
-void __init percpu_init_late(void)
-{
-	struct pcpu_chunk *target_chunks[] =
-		{ pcpu_first_chunk, pcpu_reserved_chunk, NULL };
-	struct pcpu_chunk *chunk;
-	unsigned long flags;
-	int i;
-
-	for (i = 0; (chunk = target_chunks[i]); i++) {
-		int *map;
-		const size_t size = PERCPU_DYNAMIC_EARLY_SLOTS * sizeof(map[0]);
-
-		BUILD_BUG_ON(size > PAGE_SIZE);
-
-		map = pcpu_mem_alloc(size);
-		BUG_ON(!map);
-
-		spin_lock_irqsave(&pcpu_lock, flags);
-		memcpy(map, chunk->map, size);
-		chunk->map = map;
-		spin_unlock_irqrestore(&pcpu_lock, flags);
-	}
-}
@@ -0,0 +1,442 @@
+/*
+ *	linux/mm/process_vm_access.c
+ *
+ * The process_vm_readv() and process_vm_writev() system calls: copy data
+ * directly between the address spaces of two processes, without going
+ * through an intermediate buffer or pipe.
+ */
+
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/ptrace.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+
+#ifdef CONFIG_COMPAT
+#include <linux/compat.h>
+#endif
+
+/* Maximum number of page pointers we pin at a time */
+#define PVM_MAX_KMALLOC_PAGES	(PAGE_SIZE * 2)
+#define PVM_MAX_PP_ARRAY_COUNT	16
+
+/*
+ * process_vm_rw_pages - copy between pinned remote pages and local iovecs
+ * @pages: remote pages, pinned by get_user_pages()
+ * @offset: offset into the first page to start copying from/to
+ * @len: number of bytes to copy
+ * @lvec: local iovec array
+ * @lvec_cnt: number of elements in @lvec
+ * @lvec_current: index into @lvec we are up to, updated on return
+ * @lvec_offset: offset into the current local iovec, updated on return
+ * @vm_write: 0 copies from the remote pages, 1 copies to them
+ * @bytes_copied: incremented by the number of bytes copied
+ *
+ * Returns 0 on success or -EFAULT if the local iovecs could not be
+ * accessed.
+ */
+static int process_vm_rw_pages(struct page **pages,
+			       unsigned long offset,
+			       size_t len,
+			       const struct iovec *lvec,
+			       unsigned long lvec_cnt,
+			       unsigned long *lvec_current,
+			       size_t *lvec_offset,
+			       int vm_write,
+			       ssize_t *bytes_copied)
+{
+	while (len && *lvec_current < lvec_cnt) {
+		const struct iovec *iov = &lvec[*lvec_current];
+		void __user *buf = iov->iov_base + *lvec_offset;
+		struct page *page = *pages;
+		unsigned long left;
+		size_t copy;
+		void *kaddr;
+
+		/*
+		 * Copy the smallest of: what is left in this page, what is
+		 * left to copy, and what is left in the local iovec.
+		 */
+		copy = min_t(size_t, PAGE_SIZE - offset, len);
+		copy = min_t(size_t, copy, iov->iov_len - *lvec_offset);
+
+		kaddr = kmap(page);
+		if (vm_write)
+			left = copy_from_user(kaddr + offset, buf, copy);
+		else
+			left = copy_to_user(buf, kaddr + offset, copy);
+		kunmap(page);
+
+		if (vm_write && copy != left)
+			set_page_dirty_lock(page);
+
+		*bytes_copied += copy - left;
+		if (left)
+			return -EFAULT;
+
+		len -= copy;
+		offset += copy;
+		if (offset == PAGE_SIZE) {
+			offset = 0;
+			pages++;
+		}
+		*lvec_offset += copy;
+		if (*lvec_offset == iov->iov_len) {
+			(*lvec_current)++;
+			*lvec_offset = 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * process_vm_rw_single_vec - copy one remote iovec
+ * @addr: start address in the remote process
+ * @len: length of the remote iovec
+ * @lvec: local iovec array
+ * @lvec_cnt: number of elements in @lvec
+ * @lvec_current: index into @lvec we are up to
+ * @lvec_offset: offset into the current local iovec
+ * @process_pages: scratch array of @max_pages page pointers
+ * @max_pages: number of entries in @process_pages
+ * @mm: remote mm
+ * @task: remote task
+ * @vm_write: 0 copies from the remote process, 1 copies to it
+ * @bytes_copied: incremented by the number of bytes copied
+ *
+ * Returns 0 on success, error code otherwise.
+ */
+static int process_vm_rw_single_vec(unsigned long addr,
+				    unsigned long len,
+				    const struct iovec *lvec,
+				    unsigned long lvec_cnt,
+				    unsigned long *lvec_current,
+				    size_t *lvec_offset,
+				    struct page **process_pages,
+				    unsigned long max_pages,
+				    struct mm_struct *mm,
+				    struct task_struct *task,
+				    int vm_write,
+				    ssize_t *bytes_copied)
+{
+	unsigned long pa = addr & PAGE_MASK;
+	unsigned long start_offset = addr - pa;
+	unsigned long nr_pages;
+	int rc = 0;
+
+	if (len == 0)
+		return 0;
+	nr_pages = (addr + len - 1) / PAGE_SIZE - addr / PAGE_SIZE + 1;
+
+	while (nr_pages && *lvec_current < lvec_cnt) {
+		unsigned long nr = min(nr_pages, max_pages);
+		size_t bytes;
+		int pinned, i;
+
+		down_read(&mm->mmap_sem);
+		pinned = get_user_pages(task, mm, pa, nr, vm_write, 0,
+					process_pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (pinned <= 0)
+			return -EFAULT;
+
+		bytes = pinned * PAGE_SIZE - start_offset;
+		if (bytes > len)
+			bytes = len;
+
+		rc = process_vm_rw_pages(process_pages, start_offset, bytes,
+					 lvec, lvec_cnt, lvec_current,
+					 lvec_offset, vm_write, bytes_copied);
+		for (i = 0; i < pinned; i++)
+			put_page(process_pages[i]);
+		if (rc)
+			return rc;
+		if (pinned < nr)
+			return -EFAULT;
+
+		len -= bytes;
+		start_offset = 0;
+		nr_pages -= pinned;
+		pa += pinned * PAGE_SIZE;
+	}
+
+	return rc;
+}
+
+/*
+ * Take a reference on @task's mm, provided the caller would be allowed to
+ * ptrace it.  cred_guard_mutex keeps the task from exec'ing a
+ * setuid binary between the permission check and grabbing the mm.
+ */
+static struct mm_struct *process_vm_get_mm(struct task_struct *task)
+{
+	struct mm_struct *mm;
+	int err;
+
+	err = mutex_lock_killable(&task->signal->cred_guard_mutex);
+	if (err)
+		return ERR_PTR(err);
+
+	task_lock(task);
+	if (__ptrace_may_access(task, PTRACE_MODE_ATTACH)) {
+		mm = ERR_PTR(-EPERM);
+	} else {
+		mm = task->mm;
+		if (!mm || (task->flags & PF_KTHREAD))
+			mm = ERR_PTR(-EINVAL);
+		else
+			atomic_inc(&mm->mm_users);
+	}
+	task_unlock(task);
+	mutex_unlock(&task->signal->cred_guard_mutex);
+
+	return mm;
+}
+
+/*
+ * process_vm_rw_core - core of reading/writing pages from task specified
+ * @pid: PID of process to read/write from/to
+ * @lvec: iovec array specifying where to copy to/from locally
+ * @liovcnt: size of lvec array
+ * @rvec: iovec array specifying where to copy to/from in the other process
+ * @riovcnt: size of rvec array
+ * @flags: currently unused
+ * @vm_write: 0 if reading from other process, 1 if writing to other process
+ *
+ * Returns the number of bytes read/written or error code.  May return less
+ * bytes than expected if an error occurs during the copying process.
+ */
+static ssize_t process_vm_rw_core(pid_t pid, const struct iovec *lvec,
+				  unsigned long liovcnt,
+				  const struct iovec *rvec,
+				  unsigned long riovcnt,
+				  unsigned long flags, int vm_write)
+{
+	struct task_struct *task;
+	struct page *pp_stack[PVM_MAX_PP_ARRAY_COUNT];
+	struct page **process_pages = pp_stack;
+	struct mm_struct *mm;
+	unsigned long i;
+	ssize_t rc = 0;
+	ssize_t bytes_copied = 0;
+	unsigned long nr_pages = 0;
+	unsigned long max_pages;
+	unsigned long iov_l_curr_idx = 0;
+	size_t iov_l_curr_offset = 0;
+
+	/*
+	 * Work out how many struct page pointers we need at most for a
+	 * single get_user_pages() call.
+	 */
+	for (i = 0; i < riovcnt; i++) {
+		unsigned long start = (unsigned long)rvec[i].iov_base;
+		size_t len = rvec[i].iov_len;
+
+		if (len > 0)
+			nr_pages = max(nr_pages, (start + len - 1) / PAGE_SIZE -
+					start / PAGE_SIZE + 1);
+	}
+
+	if (nr_pages == 0)
+		return 0;
+
+	max_pages = PVM_MAX_PP_ARRAY_COUNT;
+	if (nr_pages > PVM_MAX_PP_ARRAY_COUNT) {
+		/* For reliability don't try to kmalloc more than 2 pages worth */
+		max_pages = min_t(unsigned long, nr_pages,
+				  PVM_MAX_KMALLOC_PAGES / sizeof(struct page *));
+		process_pages = kmalloc(max_pages * sizeof(struct page *),
+					GFP_KERNEL);
+		if (!process_pages)
+			return -ENOMEM;
+	}
+
+	/* Get process information */
+	rcu_read_lock();
+	task = find_task_by_vpid(pid);
+	if (task)
+		get_task_struct(task);
+	rcu_read_unlock();
+	if (!task) {
+		rc = -ESRCH;
+		goto free_proc_pages;
+	}
+
+	mm = process_vm_get_mm(task);
+	if (IS_ERR(mm)) {
+		rc = PTR_ERR(mm);
+		goto put_task_struct;
+	}
+
+	for (i = 0; i < riovcnt && iov_l_curr_idx < liovcnt; i++) {
+		rc = process_vm_rw_single_vec(
+			(unsigned long)rvec[i].iov_base, rvec[i].iov_len,
+			lvec, liovcnt, &iov_l_curr_idx, &iov_l_curr_offset,
+			process_pages, max_pages, mm, task, vm_write,
+			&bytes_copied);
+		if (rc < 0)
+			break;
+	}
+
+	/*
+	 * If we have managed to copy any data at all then we return the
+	 * number of bytes copied.  Otherwise we return the error code.
+	 */
+	if (bytes_copied)
+		rc = bytes_copied;
+
+	mmput(mm);
+
+put_task_struct:
+	put_task_struct(task);
+
+free_proc_pages:
+	if (process_pages != pp_stack)
+		kfree(process_pages);
+	return rc;
+}
+
+/*
+ * process_vm_rw - check iovecs before calling core routine
+ * @pid: PID of process to read/write from/to
+ * @lvec: iovec array specifying where to copy to/from locally
+ * @liovcnt: size of lvec array
+ * @rvec: iovec array specifying where to copy to/from in the other process
+ * @riovcnt: size of rvec array
+ * @flags: currently unused
+ * @vm_write: 0 if reading from other process, 1 if writing to other process
+ *
+ * Returns the number of bytes read/written or error code.  May return less
+ * bytes than expected if an error occurs during the copying process.
+ */
+static ssize_t process_vm_rw(pid_t pid,
+			     const struct iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	/* Check iovecs */
+	rc = rw_copy_check_uvector(vm_write ? WRITE : READ, lvec, liovcnt,
+				   UIO_FASTIOV, iovstack_l, &iov_l);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	/* The remote addresses are only checked against the remote mm */
+	rc = rw_copy_check_uvector(CHECK_IOVEC_ONLY, rvec, riovcnt,
+				   UIO_FASTIOV, iovstack_r, &iov_r);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt, flags,
+				vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+
+	return rc;
+}
+
+SYSCALL_DEFINE6(process_vm_readv, pid_t, pid, const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 0);
+}
+
+SYSCALL_DEFINE6(process_vm_writev, pid_t, pid,
+		const struct iovec __user *, lvec,
+		unsigned long, liovcnt, const struct iovec __user *, rvec,
+		unsigned long, riovcnt,	unsigned long, flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 1);
+}
+
+#ifdef CONFIG_COMPAT
+
+static ssize_t
+compat_process_vm_rw(compat_pid_t pid,
+		     const struct compat_iovec __user *lvec,
+		     unsigned long liovcnt,
+		     const struct compat_iovec __user *rvec,
+		     unsigned long riovcnt,
+		     unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc = -EFAULT;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	if (!access_ok(VERIFY_READ, lvec, liovcnt * sizeof(*lvec)))
+		goto out;
+
+	if (!access_ok(VERIFY_READ, rvec, riovcnt * sizeof(*rvec)))
+		goto out;
+
+	rc = compat_rw_copy_check_uvector(vm_write ? WRITE : READ, lvec,
+					  liovcnt, UIO_FASTIOV, iovstack_l,
+					  &iov_l);
+	if (rc <= 0)
+		goto free_iovecs;
+	rc = compat_rw_copy_check_uvector(CHECK_IOVEC_ONLY, rvec, riovcnt,
+					  UIO_FASTIOV, iovstack_r, &iov_r);
+	if (rc <= 0)
+		goto free_iovecs;
+
+	rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt, flags,
+				vm_write);
+
+free_iovecs:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+
+out:
+	return rc;
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_readv(compat_pid_t pid,
+			    const struct compat_iovec __user *lvec,
+			    unsigned long liovcnt,
+			    const struct compat_iovec __user *rvec,
+			    unsigned long riovcnt,
+			    unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 0);
+}
+
+asmlinkage ssize_t
+compat_sys_process_vm_writev(compat_pid_t pid,
+			     const struct compat_iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct compat_iovec __user *rvec,
+			     unsigned long riovcnt,
+			     unsigned long flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec,
+				    riovcnt, flags, 1);
+}
+
+#endif
@@ -241,6 +241,28 @@ static void shmem_free_blocks(struct inode *inode, long pages)
 	}
 }
 
+/*
+ * Account one more data page to the inode: called under info->lock,
+ * undone by shmem_unacct_blocks() and shmem_free_blocks().
+ */
+static int shmem_alloc_block(struct inode *inode)
+{
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+
+	if (sbinfo->max_blocks) {
+		if ((percpu_counter_compare(&sbinfo->used_blocks, sbinfo->max_blocks) > 0) ||
+		    shmem_acct_block(info->flags))
+			return -ENOSPC;
+		percpu_counter_inc(&sbinfo->used_blocks);
+		spin_lock(&inode->i_lock);
+		inode->i_blocks += BLOCKS_PER_PAGE;
+		spin_unlock(&inode->i_lock);
+	} else if (shmem_acct_block(info->flags))
+		return -ENOSPC;
+	return 0;
+}
+
 static int shmem_reserve_inode(struct super_block *sb)
 {
 	struct shmem_sb_info *sbinfo = SHMEM_SB(sb);
@@ -1029,6 +1051,76 @@ out:
 	return (found < 0) ? found : 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Huge pages in shmem are "teams": a huge page allocation is split into
+ * HPAGE_PMD_NR ordinary pages, which go into the page cache at the
+ * naturally aligned indices of a file, each with its own count, lru,
+ * dirty and swap state - so the swap vector, truncation and reclaim
+ * need not know about them.  PageTeam marks them while the team is
+ * complete, and then it may be mapped by a single pmd.  Removing any
+ * of its pages from the page cache (truncation, hole punch, swapout,
+ * migration) disbands the team first.  page_private of each page of a
+ * team points to the shmem_sb_info, for its count of huge pages.
+ */
+int sysctl_shmem_huge __read_mostly;
+
+static int shmem_huge_policy(struct super_block *sb)
+{
+	/* SysV shm and shared anonymous memory follow vm.shmem_huge */
+	if (shm_mnt && sb == shm_mnt->mnt_sb)
+		return sysctl_shmem_huge;
+	return SHMEM_SB(sb)->huge;
+}
+
+/*
+ * Serializes disbanding: two pages of a team may be leaving it at once,
+ * and neither may go on to use its page_private until both the private
+ * and PageTeam of its page have been cleared.
+ */
+static DEFINE_SPINLOCK(shmem_team_lock);
+
+static void shmem_disband_team(struct page *page)
+{
+	struct shmem_sb_info *sbinfo;
+	struct page *head;
+	int i;
+
+	/* page_private is cleared before PageTeam: see below */
+	if (!PageTeam(page))
+		return;
+
+	spin_lock(&shmem_team_lock);
+	if (!PageTeam(page)) {
+		spin_unlock(&shmem_team_lock);
+		return;		/* somebody else got here first */
+	}
+	head = page - (page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+	sbinfo = (struct shmem_sb_info *)page_private(head);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		set_page_private(head + i, 0);
+		smp_mb__before_clear_bit();
+		ClearPageTeam(head + i);
+	}
+	spin_unlock(&shmem_team_lock);
+
+	spin_lock(&sbinfo->stat_lock);
+	sbinfo->nr_huge--;
+	spin_unlock(&sbinfo->stat_lock);
+	dec_zone_page_state(head, NR_SHMEM_HUGEPAGES);
+	count_vm_event(THP_FILE_SPLIT);
+}
+#else
+static inline int shmem_huge_policy(struct super_block *sb)
+{
+	return SHMEM_HUGE_NEVER;
+}
+
+static inline void shmem_disband_team(struct page *page)
+{
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 /*
  * Move the page from the page cache to the swap cache.
  */
@@ -1063,6 +1155,9 @@ static int shmem_writepage(struct page *page, struct writeback_control *wbc)
 		swap = get_swap_page();
 	else
 		swap.val = 0;
+	/* the page is going its own way, and needs page_private for swap */
+	if (swap.val)
+		shmem_disband_team(page);
 
 	spin_lock(&info->lock);
 	if (index >= info->next_index) {
@@ -1181,6 +1276,22 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = idx;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, idx);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0);
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *p)
@@ -1199,6 +1310,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, unsigned long idx)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -1208,6 +1327,189 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Should shmem_getpage() try to allocate a whole team around idx?
+ * Faults cannot go beyond i_size, but a write may extend the file.
+ */
+static bool shmem_want_team(struct inode *inode, unsigned long idx,
+			    enum sgp_type sgp)
+{
+	unsigned long end = (idx | (HPAGE_PMD_NR - 1)) + 1;
+
+	switch (shmem_huge_policy(inode->i_sb)) {
+	case SHMEM_HUGE_ALWAYS:
+		if (sgp == SGP_WRITE)
+			return true;
+		/* fall through */
+	case SHMEM_HUGE_WITHIN_SIZE:
+		return ((loff_t)end << PAGE_CACHE_SHIFT) <= i_size_read(inode);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Is there nothing yet, neither in page cache nor on swap, in the
+ * HPAGE_PMD_NR pages from start?
+ */
+static bool shmem_team_range_empty(struct inode *inode, unsigned long start)
+{
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct page *page;
+	swp_entry_t *entry;
+	unsigned long idx;
+	bool empty = true;
+
+	if (find_get_pages(inode->i_mapping, start, 1, &page)) {
+		empty = page->index >= start + HPAGE_PMD_NR;
+		page_cache_release(page);
+		if (!empty)
+			return false;
+	}
+
+	spin_lock(&info->lock);
+	for (idx = start; info->swapped && idx < start + HPAGE_PMD_NR; idx++) {
+		entry = shmem_swp_entry(info, idx, NULL);
+		if (!entry)
+			continue;
+		empty = !entry->val;
+		shmem_swp_unmap(entry);
+		if (!empty)
+			break;
+	}
+	spin_unlock(&info->lock);
+	return empty;
+}
+
+/*
+ * Allocate a team for the naturally aligned HPAGE_PMD_NR pages around
+ * idx, and insert all of them into the page cache, zeroed.  Returns 0
+ * on success, or an error if shmem_getpage() should go on with a single
+ * page: whatever pages got inserted before the failure stay there.
+ */
+static int shmem_alloc_team(struct inode *inode, unsigned long idx,
+			    enum sgp_type sgp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	unsigned long start = idx & ~(HPAGE_PMD_NR - 1);
+	struct page *head;
+	swp_entry_t *entry;
+	gfp_t gfp;
+	int error = 0;
+	int i, nr;
+
+	if (start + HPAGE_PMD_NR > SHMEM_MAX_INDEX)
+		return -EFBIG;
+	if (sbinfo->max_blocks &&
+	    percpu_counter_compare(&sbinfo->used_blocks,
+				   sbinfo->max_blocks - HPAGE_PMD_NR) > 0)
+		return -ENOSPC;
+	if (!shmem_team_range_empty(inode, start))
+		return -EEXIST;
+
+	gfp = mapping_gfp_mask(mapping) | __GFP_NOMEMALLOC | __GFP_NORETRY |
+		__GFP_NOWARN | __GFP_NO_KSWAPD;
+	if (!(transparent_hugepage_flags &
+	      (1 << TRANSPARENT_HUGEPAGE_DEFRAG_FLAG)))
+		gfp &= ~__GFP_WAIT;
+	head = shmem_alloc_hugepage(gfp, info, start);
+	if (!head) {
+		count_vm_event(THP_FILE_FALLBACK);
+		return -ENOMEM;
+	}
+	split_page(head, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_highpage(head + i);
+		flush_dcache_page(head + i);
+		SetPageUptodate(head + i);
+		SetPageSwapBacked(head + i);
+	}
+
+	/* As in shmem_getpage(), but all pages are left locked */
+	gfp = mapping_gfp_mask(mapping);
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		struct page *page = head + nr;
+
+		error = mem_cgroup_cache_charge(page, current->mm, GFP_KERNEL);
+		if (error)
+			break;
+		error = radix_tree_preload(gfp & ~__GFP_HIGHMEM);
+		if (error) {
+			mem_cgroup_uncharge_cache_page(page);
+			break;
+		}
+		radix_tree_preload_end();
+
+		spin_lock(&info->lock);
+		entry = shmem_swp_alloc(info, start + nr, sgp);
+		if (IS_ERR(entry))
+			error = PTR_ERR(entry);
+		else {
+			if (entry->val)
+				error = -EEXIST;
+			shmem_swp_unmap(entry);
+		}
+		if (!error)
+			error = shmem_alloc_block(inode);
+		if (error) {
+			spin_unlock(&info->lock);
+			mem_cgroup_uncharge_cache_page(page);
+			break;
+		}
+		/* At failure, uncharge will be done automatically */
+		error = add_to_page_cache_lru(page, mapping, start + nr,
+					      GFP_NOWAIT);
+		if (error) {
+			spin_unlock(&info->lock);
+			shmem_unacct_blocks(info->flags, 1);
+			shmem_free_blocks(inode, 1);
+			break;
+		}
+		info->flags |= SHMEM_PAGEIN;
+		info->alloced++;
+		spin_unlock(&info->lock);
+	}
+
+	if (nr == HPAGE_PMD_NR) {
+		for (i = 0; i < HPAGE_PMD_NR; i++) {
+			set_page_private(head + i, (unsigned long)sbinfo);
+			SetPageTeam(head + i);
+		}
+		spin_lock(&sbinfo->stat_lock);
+		sbinfo->nr_huge++;
+		spin_unlock(&sbinfo->stat_lock);
+		inc_zone_page_state(head, NR_SHMEM_HUGEPAGES);
+		count_vm_event(THP_FILE_ALLOC);
+	} else {
+		for (i = nr; i < HPAGE_PMD_NR; i++)
+			page_cache_release(head + i);
+		count_vm_event(THP_FILE_FALLBACK);
+	}
+
+	for (i = 0; i < nr; i++) {
+		unlock_page(head + i);
+		page_cache_release(head + i);
+	}
+	return error;
+}
+#else
+static inline bool shmem_want_team(struct inode *inode, unsigned long idx,
+				   enum sgp_type sgp)
+{
+	return false;
+}
+
+static inline int shmem_alloc_team(struct inode *inode, unsigned long idx,
+				   enum sgp_type sgp)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 /*
  * shmem_getpage - either get the page from swap or allocate a new one
  *
@@ -1220,7 +1522,6 @@ static int shmem_getpage(struct inode *inode, unsigned long idx,
 {
 	struct address_space *mapping = inode->i_mapping;
 	struct shmem_inode_info *info = SHMEM_I(inode);
-	struct shmem_sb_info *sbinfo;
 	struct page *filepage = *pagep;
 	struct page *swappage;
 	struct page *prealloc_page = NULL;
@@ -1258,6 +1559,10 @@ repeat:
 		if (error)
 			goto failed;
 		radix_tree_preload_end();
+		if ((sgp == SGP_CACHE || sgp == SGP_WRITE) &&
+		    shmem_want_team(inode, idx, sgp) &&
+		    !shmem_alloc_team(inode, idx, sgp))
+			goto repeat;
 		if (sgp != SGP_READ && !prealloc_page) {
 			/* We don't care if this fails */
 			prealloc_page = shmem_alloc_page(gfp, info, idx);
@@ -1284,7 +1589,7 @@ repeat:
 
 	if (swap.val) {
 		/* Look it up and read it in.. */
-		swappage = lookup_swap_cache(swap);
+		swappage = lookup_swap_cache(swap, NULL, 0);
 		if (!swappage) {
 			shmem_swp_unmap(entry);
 			/* here we actually do the io */
@@ -1397,21 +1702,9 @@ repeat:
 		spin_unlock(&info->lock);
 	} else {
 		shmem_swp_unmap(entry);
-		sbinfo = SHMEM_SB(inode->i_sb);
-		if (sbinfo->max_blocks) {
-			if ((percpu_counter_compare(&sbinfo->used_blocks, sbinfo->max_blocks) > 0) ||
-			    shmem_acct_block(info->flags)) {
-				spin_unlock(&info->lock);
-				error = -ENOSPC;
-				goto failed;
-			}
-			percpu_counter_inc(&sbinfo->used_blocks);
-			spin_lock(&inode->i_lock);
-			inode->i_blocks += BLOCKS_PER_PAGE;
-			spin_unlock(&inode->i_lock);
-		} else if (shmem_acct_block(info->flags)) {
+		error = shmem_alloc_block(inode);
+		if (error) {
 			spin_unlock(&info->lock);
-			error = -ENOSPC;
 			goto failed;
 		}
 
@@ -1522,6 +1815,82 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret | VM_FAULT_LOCKED;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	unsigned long start;
+	struct page *head;
+	int ret = VM_FAULT_FALLBACK;
+	int nr;
+
+	switch (shmem_huge_policy(inode->i_sb)) {
+	case SHMEM_HUGE_NEVER:
+		return VM_FAULT_FALLBACK;
+	case SHMEM_HUGE_ADVISE:
+		if (!(vma->vm_flags & VM_HUGEPAGE))
+			return VM_FAULT_FALLBACK;
+		break;
+	}
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return VM_FAULT_FALLBACK;
+	/* private mappings copy on write single pages */
+	if ((vma->vm_flags & (VM_SHARED | VM_NONLINEAR)) != VM_SHARED)
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	start = vma->vm_pgoff + ((haddr - vma->vm_start) >> PAGE_SHIFT);
+	if (start & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	if (((loff_t)(start + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT) >
+	    i_size_read(inode))
+		return VM_FAULT_FALLBACK;
+
+	head = find_get_page(mapping, start);
+	if (!head) {
+		if (shmem_alloc_team(inode, start, SGP_CACHE))
+			return VM_FAULT_FALLBACK;
+		head = find_get_page(mapping, start);
+		if (!head)
+			return VM_FAULT_FALLBACK;
+	}
+
+	/*
+	 * Each page of the team may be taken out of the page cache
+	 * independently: get and lock all of them, and check that they
+	 * still form the team, before mapping them.
+	 */
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		struct page *page = head + nr;
+
+		if (nr && !get_page_unless_zero(page))
+			break;
+		if (!trylock_page(page)) {
+			page_cache_release(page);
+			break;
+		}
+		if (!PageTeam(page) || page->mapping != mapping ||
+		    page->index != start + nr || !PageUptodate(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+	}
+
+	if (nr == HPAGE_PMD_NR)
+		ret = map_team_by_pmd(vma, haddr, pmd, head, flags);
+
+	while (nr--) {
+		unlock_page(head + nr);
+		page_cache_release(head + nr);
+	}
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *new)
 {
@@ -1574,6 +1943,89 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Move the area found for a mapping which may be huge, so that its file
+ * offsets and virtual addresses are congruent modulo HPAGE_PMD_SIZE:
+ * search again for an area HPAGE_PMD_SIZE - PAGE_SIZE larger, and slide
+ * to the right alignment within it.
+ */
+static unsigned long shmem_huge_unmapped_area(struct file *file,
+		unsigned long uaddr, unsigned long addr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	struct super_block *sb;
+	unsigned long offset, inflated_len;
+	unsigned long inflated_addr, inflated_offset;
+
+	if (IS_ERR_VALUE(addr) || (addr & ~PAGE_MASK))
+		return addr;
+	if ((flags & MAP_FIXED) || (uaddr && uaddr == addr))
+		return addr;
+	if (len < HPAGE_PMD_SIZE)
+		return addr;
+
+	/* shared anonymous memory gets its file from shmem_zero_setup() */
+	sb = file ? file->f_path.dentry->d_inode->i_sb : shm_mnt->mnt_sb;
+	if (shmem_huge_policy(sb) == SHMEM_HUGE_NEVER)
+		return addr;
+
+	offset = (pgoff << PAGE_SHIFT) & (HPAGE_PMD_SIZE - 1);
+	if (offset && offset + len < 2 * HPAGE_PMD_SIZE)
+		return addr;
+	if ((addr & (HPAGE_PMD_SIZE - 1)) == offset)
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len > TASK_SIZE || inflated_len < len)
+		return addr;
+
+	inflated_addr = current->mm->get_unmapped_area(NULL, 0, inflated_len,
+						       0, flags);
+	if (IS_ERR_VALUE(inflated_addr) || (inflated_addr & ~PAGE_MASK))
+		return addr;
+
+	inflated_offset = inflated_addr & (HPAGE_PMD_SIZE - 1);
+	inflated_addr += offset - inflated_offset;
+	if (inflated_offset > offset)
+		inflated_addr += HPAGE_PMD_SIZE;
+
+	if (inflated_addr > TASK_SIZE - len)
+		return addr;
+	return inflated_addr;
+}
+
+static void shmem_freepage(struct page *page)
+{
+	shmem_disband_team(page);
+}
+
+static int shmem_migratepage(struct address_space *mapping,
+			     struct page *newpage, struct page *page)
+{
+	/* the new page cannot take the old one's place in its team */
+	shmem_disband_team(page);
+	return migrate_page(mapping, newpage, page);
+}
+#else
+static inline unsigned long shmem_huge_unmapped_area(struct file *file,
+		unsigned long uaddr, unsigned long addr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	return addr;
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long uaddr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	unsigned long addr;
+
+	addr = current->mm->get_unmapped_area(file, uaddr, len, pgoff, flags);
+	return shmem_huge_unmapped_area(file, uaddr, addr, len, pgoff, flags);
+}
+
 static struct inode *shmem_get_inode(struct super_block *sb, const struct inode *dir,
 				     int mode, dev_t dev, unsigned long flags)
 {
@@ -2175,6 +2627,44 @@ static const struct export_operations shmem_export_ops = {
 	.fh_to_dentry	= shmem_fh_to_dentry,
 };
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+static const char *shmem_huge_names[] = {
+	[SHMEM_HUGE_NEVER]		= "never",
+	[SHMEM_HUGE_ALWAYS]		= "always",
+	[SHMEM_HUGE_WITHIN_SIZE]	= "within_size",
+	[SHMEM_HUGE_ADVISE]		= "advise",
+};
+
+static int shmem_parse_huge(const char *str)
+{
+	int huge;
+
+	for (huge = 0; huge < ARRAY_SIZE(shmem_huge_names); huge++)
+		if (!strcmp(str, shmem_huge_names[huge]))
+			return huge;
+	return -EINVAL;
+}
+
+static void shmem_show_huge(struct seq_file *seq, int huge)
+{
+	if (huge != SHMEM_HUGE_NEVER)
+		seq_printf(seq, ",huge=%s", shmem_huge_names[huge]);
+}
+
+/* Shown in /proc/<pid>/mountstats */
+static int shmem_show_stats(struct seq_file *seq, struct vfsmount *vfs)
+{
+	struct shmem_sb_info *sbinfo = SHMEM_SB(vfs->mnt_sb);
+
+	seq_printf(seq, " huge_pages=%lu", sbinfo->nr_huge);
+	return 0;
+}
+#else
+static inline void shmem_show_huge(struct seq_file *seq, int huge)
+{
+}
+#endif /* CONFIG_TRANSPARENT_HUGE_PAGECACHE */
+
 static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 			       bool remount)
 {
@@ -2250,6 +2740,13 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+			if (huge < 0)
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2296,6 +2793,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2320,6 +2818,7 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
 	shmem_show_mpol(seq, sbinfo->mpol);
+	shmem_show_huge(seq, sbinfo->huge);
 	return 0;
 }
 #endif /* CONFIG_TMPFS */
@@ -2452,12 +2951,18 @@ static const struct address_space_operations shmem_aops = {
 	.write_begin	= shmem_write_begin,
 	.write_end	= shmem_write_end,
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	.freepage	= shmem_freepage,
+	.migratepage	= shmem_migratepage,
+#else
 	.migratepage	= migrate_page,
+#endif
 	.error_remove_page = generic_error_remove_page,
 };
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+	.get_unmapped_area = shmem_get_unmapped_area,
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2523,6 +3028,9 @@ static const struct super_operations shmem_ops = {
 	.statfs		= shmem_statfs,
 	.remount_fs	= shmem_remount_fs,
 	.show_options	= shmem_show_options,
+#endif
+#if defined(CONFIG_TMPFS) && defined(CONFIG_TRANSPARENT_HUGE_PAGECACHE)
+	.show_stats	= shmem_show_stats,
 #endif
 	.evict_inode	= shmem_evict_inode,
 	.drop_inode	= generic_delete_inode,
@@ -2531,6 +3039,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2667,6 +3178,15 @@ int shmem_lock(struct file *file, int lock, struct user_struct *user)
 	return 0;
 }
 
+#ifdef CONFIG_MMU
+unsigned long shmem_get_unmapped_area(struct file *file,
+				      unsigned long addr, unsigned long len,
+				      unsigned long pgoff, unsigned long flags)
+{
+	return current->mm->get_unmapped_area(file, addr, len, pgoff, flags);
+}
+#endif
+
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 /**
  * mem_cgroup_get_shmem_target - find a page or entry assigned to the shmem file
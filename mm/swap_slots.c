@@ -0,0 +1,226 @@
+/*
+ * mm/swap_slots.c
+ *
+ * Per-CPU caches of swap slots, for allocation and for freeing.
+ *
+ * Swap slots are handed out by scan_swap_map() and released by
+ * swap_range_free(), both under the global swap_lock.  With fast swap
+ * devices, swapout from many CPUs ends up serialised on that lock.  Each
+ * CPU therefore keeps a small cache of slots, refilled from the swap
+ * areas in batches of SWAP_SLOTS_CACHE_SIZE, and a cache of freed slots,
+ * which are given back to the swap areas in batches too.
+ *
+ * A slot in either cache has only SWAP_HAS_CACHE set in its swap_map,
+ * with no page in the swap cache.
+ *
+ * The caches are only used while there is plenty of free swap, so that
+ * slots parked on some CPUs don't starve the others.  swapoff disables
+ * them, so that try_to_unuse() doesn't have to chase cached slots.
+ */
+
+#include <linux/swap.h>
+#include <linux/cpu.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+#define SWAP_SLOTS_CACHE_SIZE			64
+#define THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE	(5 * SWAP_SLOTS_CACHE_SIZE)
+#define THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE	(2 * SWAP_SLOTS_CACHE_SIZE)
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr and cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret and n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/* Cleared while swapoff runs */
+bool swap_slot_cache_enabled;
+static int swap_slot_cache_disabled;
+/* Set while there is enough free swap for the caches to be worthwhile */
+static bool swap_slot_cache_active;
+/* Serialises the above, and draining the caches */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+
+static inline bool use_swap_slot_cache(void)
+{
+	return swap_slot_cache_enabled && swap_slot_cache_active;
+}
+
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+	unsigned long flags;
+
+	mutex_lock(&cache->alloc_lock);
+	swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+	cache->cur = 0;
+	cache->nr = 0;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock_irqsave(&cache->free_lock, flags);
+	swapcache_free_entries(cache->slots_ret, cache->n_ret);
+	cache->n_ret = 0;
+	spin_unlock_irqrestore(&cache->free_lock, flags);
+}
+
+/*
+ * Return the cached slots of all CPUs, including offline ones, to the
+ * swap areas.  Callers must have made use_swap_slot_cache() false, so
+ * that nothing is cached again behind our back: both cache paths check
+ * it with the respective lock held.
+ */
+static void drain_slots_caches(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+}
+
+/*
+ * Turn the caches on when free swap is plentiful, and off (returning
+ * their slots) when it runs low.
+ */
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled)
+		return false;
+
+	pages = nr_swap_pages;
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+			    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE) {
+			mutex_lock(&swap_slots_cache_mutex);
+			swap_slot_cache_active = true;
+			mutex_unlock(&swap_slots_cache_mutex);
+		}
+	} else if (pages < num_online_cpus() *
+			   THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE) {
+		mutex_lock(&swap_slots_cache_mutex);
+		if (swap_slot_cache_active) {
+			swap_slot_cache_active = false;
+			drain_slots_caches();
+		}
+		mutex_unlock(&swap_slots_cache_mutex);
+	}
+	return use_swap_slot_cache();
+}
+
+void disable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_disabled++;
+	swap_slot_cache_enabled = false;
+	drain_slots_caches();
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+void reenable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	if (!--swap_slot_cache_disabled)
+		swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/* Called with cache->alloc_lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache() || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+	return cache->nr;
+}
+
+/*
+ * Give back a swap entry whose last reference has been dropped.  May be
+ * called with interrupts disabled, from under the mapping's tree_lock.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+	unsigned long flags;
+
+	/*
+	 * We may migrate to another CPU from here on: that is fine, the
+	 * cache we picked is protected by its lock, not by preemption.
+	 */
+	cache = __this_cpu_ptr(&swp_slots);
+	if (likely(use_swap_slot_cache())) {
+		spin_lock_irqsave(&cache->free_lock, flags);
+		/* The caches may have been drained before we got the lock */
+		if (!use_swap_slot_cache()) {
+			spin_unlock_irqrestore(&cache->free_lock, flags);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			swapcache_free_entries(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock_irqrestore(&cache->free_lock, flags);
+		return;
+	}
+direct_free:
+	swapcache_free_entries(&entry, 1);
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+	if (check_cache_active()) {
+		/* As in free_swap_slot(), the mutex protects the cache */
+		cache = __this_cpu_ptr(&swp_slots);
+		mutex_lock(&cache->alloc_lock);
+		if (cache->nr || refill_swap_slots_cache(cache)) {
+			entry = cache->slots[cache->cur];
+			cache->slots[cache->cur++].val = 0;
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	swap_slot_cache_enabled = true;
+	return 0;
+}
+subsys_initcall(swap_slots_cache_init);
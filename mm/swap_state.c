@@ -19,6 +19,8 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/vmstat.h>
+#include <linux/pfn.h>
 
 #include <asm/pgtable.h>
 
@@ -50,6 +52,51 @@ struct address_space swapper_space = {
 
 #define INC_CACHE_INFO(x)	do { swap_cache_info.x++; } while (0)
 
+/*
+ * VMA based swap readahead state, kept in vma->swap_readahead_info: the
+ * page aligned address of the last fault, with the readahead window of
+ * that fault and the readahead hits seen since in the low bits.
+ */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Start with a few hits, to open with a small window */
+#define GET_SWAP_RA_VAL(vma)					\
+	(atomic_long_read(&(vma)->swap_readahead_info) ? : 4)
+
+/* The window is bounded by the PTEs copied on the stack */
+#ifdef CONFIG_64BIT
+#define SWAP_RA_ORDER_CEILING	5
+#else
+#define SWAP_RA_ORDER_CEILING	3
+#endif
+#define SWAP_RA_PTE_MAX		(1 << SWAP_RA_ORDER_CEILING)
+
+static bool enable_vma_readahead __read_mostly = true;
+static unsigned int vma_ra_max_order __read_mostly = SWAP_RA_ORDER_CEILING;
+
+/*
+ * Readahead by swap offset only makes sense on a rotating disk, where
+ * slots allocated together are read cheaply together.  Otherwise, read
+ * ahead the swap entries of neighbouring PTEs.
+ */
+bool swap_use_vma_readahead(void)
+{
+	return ACCESS_ONCE(enable_vma_readahead) &&
+		!atomic_read(&nr_rotate_swap);
+}
+
 static struct {
 	unsigned long add_total;
 	unsigned long del_total;
@@ -157,6 +204,12 @@ int add_to_swap(struct page *page)
 	if (!entry.val)
 		return 0;
 
+	if (unlikely(PageTransHuge(page)))
+		if (unlikely(split_huge_page(page))) {
+			swapcache_free(entry, NULL);
+			return 0;
+		}
+
 	/*
 	 * Radix-tree node allocations from PF_MEMALLOC contexts could
 	 * completely exhaust the page allocator. __GFP_NOMEMALLOC
@@ -257,31 +310,53 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page *lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma,
+			       unsigned long addr)
 {
 	struct page *page;
+	unsigned long ra_val;
+	unsigned int win, hits;
+	int readahead;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
 
+		readahead = TestClearPageReadahead(page);
+		if (readahead)
+			count_vm_event(SWAP_RA_HIT);
+		if (vma && swap_use_vma_readahead()) {
+			ra_val = GET_SWAP_RA_VAL(vma);
+			win = SWAP_RA_WIN(ra_val);
+			hits = SWAP_RA_HITS(ra_val);
+			if (readahead)
+				hits = min_t(unsigned int, hits + 1,
+					     SWAP_RA_HITS_MAX);
+			atomic_long_set(&vma->swap_readahead_info,
+					SWAP_RA_VAL(addr, win, hits));
+		}
+	}
+
 	INC_CACHE_INFO(find_total);
 	return page;
 }
 
-/* 
+/*
  * Locate a page of swap in physical memory, reserving swap cache space
- * and reading the disk if it is not already cached.
+ * for it if it is not already cached.  A newly added page is returned
+ * locked and with *new_page_allocated set, for the caller to read in.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -314,6 +389,17 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * An entry with no references left may be parked
+			 * in a per-CPU slot cache, and will not show up in
+			 * the swap cache until reallocated: don't wait for
+			 * it.  While swapoff runs the caches are disabled,
+			 * and such an entry is only racing with an
+			 * allocation or a free.
+			 */
+			if (swap_slot_cache_enabled && !__swp_swapcount(entry))
+				break;
+			cond_resched();
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
@@ -327,11 +413,8 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = __add_to_swap_cache(new_page, entry);
 		if (likely(!err)) {
 			radix_tree_preload_end();
-			/*
-			 * Initiate read into locked page and return.
-			 */
 			lru_cache_add_anon(new_page);
-			swap_readpage(new_page);
+			*new_page_allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -349,6 +432,45 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+/*
+ * Locate a page of swap in physical memory, reserving swap cache space
+ * and reading the disk if it is not already cached.
+ * A failure return means that either the page allocation failed or that
+ * the swap entry is no longer in use.
+ */
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+	bool page_allocated;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+				       &page_allocated);
+	if (page_allocated)
+		swap_readpage(page);	/* Initiate read into locked page */
+	return page;
+}
+
+/*
+ * Read in a page which is not the target of the fault, and mark it so
+ * that a later hit on it is counted.
+ */
+static struct page *swap_readahead_page(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+	bool page_allocated;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr,
+				       &page_allocated);
+	if (page_allocated) {
+		swap_readpage(page);
+		SetPageReadahead(page);
+		count_vm_event(SWAP_RA);
+	}
+	return page;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -385,9 +507,11 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	 */
 	nr_pages = valid_swaphandles(entry, &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
+		if (offset == swp_offset(entry))
+			continue;
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
+		page = swap_readahead_page(swp_entry(swp_type(entry), offset),
+					   gfp_mask, vma, addr);
 		if (!page)
 			break;
 		page_cache_release(page);
@@ -395,3 +519,210 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/*
+ * Size the readahead window from the hits on the previous window, and
+ * from whether this fault is next to the previous one.
+ */
+static unsigned int __swapin_nr_pages(unsigned long prev_pfn,
+				      unsigned long pfn, unsigned int hits,
+				      unsigned int max_pages,
+				      unsigned int prev_win)
+{
+	unsigned int pages, last_ra;
+
+	/*
+	 * This heuristic has been found to work well on both sequential and
+	 * random loads: start from the hits plus two, rounded up to a power
+	 * of two.
+	 */
+	pages = hits + 2;
+	if (pages == 2) {
+		/*
+		 * With no hits to judge by, don't get stuck without
+		 * readahead forever: look for an adjacent fault instead.
+		 */
+		if (pfn != prev_pfn + 1 && pfn != prev_pfn - 1)
+			pages = 1;
+	} else {
+		unsigned int roundup = 4;
+		while (roundup < pages)
+			roundup <<= 1;
+		pages = roundup;
+	}
+
+	if (pages > max_pages)
+		pages = max_pages;
+
+	/* Don't shrink readahead too fast */
+	last_ra = prev_win / 2;
+	if (pages < last_ra)
+		pages = last_ra;
+
+	return pages;
+}
+
+/**
+ * swap_vma_readahead - swap in pages in hope we need them soon
+ * @fentry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: target address
+ * @pmd: pmd mapping the page table of @addr
+ *
+ * Returns the struct page for fentry and addr, after queueing swapin.
+ *
+ * Once swap is fragmented, slots next to each other on the swap device
+ * belong to unrelated pages.  Instead, read in the swap entries of PTEs
+ * around the faulting address, in the same VMA and page table.  The
+ * window follows the direction of sequential faults, and is sized by
+ * the readahead hits seen on this VMA since the last fault (recorded by
+ * lookup_swap_cache()).
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
+				struct vm_area_struct *vma, unsigned long addr,
+				pmd_t *pmd)
+{
+	pte_t ptes[SWAP_RA_PTE_MAX];
+	unsigned long faddr, fpfn, pfn, ra_val;
+	unsigned long start, end, back;
+	unsigned int max_win, hits, prev_win, win, i;
+	swp_entry_t entry;
+	struct page *page;
+	pte_t *pte;
+
+	faddr = addr & PAGE_MASK;
+	fpfn = PFN_DOWN(faddr);
+	max_win = 1 << min_t(unsigned int, ACCESS_ONCE(vma_ra_max_order),
+			     SWAP_RA_ORDER_CEILING);
+
+	ra_val = GET_SWAP_RA_VAL(vma);
+	pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
+	prev_win = SWAP_RA_WIN(ra_val);
+	hits = SWAP_RA_HITS(ra_val);
+	win = __swapin_nr_pages(pfn, fpfn, hits, max_win, prev_win);
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+
+	if (win == 1)
+		goto skip;
+
+	/* Read ahead in the direction of the faults, else around this one */
+	if (fpfn == pfn + 1)
+		back = 0;
+	else if (pfn == fpfn + 1)
+		back = win - 1;
+	else
+		back = (win - 1) / 2;
+	start = fpfn - min(fpfn, back);
+	end = start + win;
+
+	/* Stay within the vma and the page table */
+	start = max3(start, PFN_DOWN(vma->vm_start), PFN_DOWN(faddr & PMD_MASK));
+	end = min3(end, PFN_DOWN(vma->vm_end),
+		   PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
+
+	/* Copy the PTEs, as the page table can't stay mapped while we read */
+	pte = pte_offset_map(pmd, start << PAGE_SHIFT);
+	for (i = 0; i < end - start; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	for (i = 0; i < end - start; i++) {
+		if (start + i == fpfn)
+			continue;
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+		    pte_file(ptes[i]))
+			continue;
+		entry = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(entry)))
+			continue;
+		page = swap_readahead_page(entry, gfp_mask, vma, faddr);
+		if (!page)
+			continue;
+		page_cache_release(page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(fentry, gfp_mask, vma, addr);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t vma_ra_enabled_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", enable_vma_readahead ? "true" : "false");
+}
+static ssize_t vma_ra_enabled_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		enable_vma_readahead = true;
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		enable_vma_readahead = false;
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute vma_ra_enabled_attr =
+	__ATTR(vma_ra_enabled, 0644, vma_ra_enabled_show,
+	       vma_ra_enabled_store);
+
+static ssize_t vma_ra_max_order_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", vma_ra_max_order);
+}
+static ssize_t vma_ra_max_order_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	int err;
+	unsigned long order;
+
+	err = strict_strtoul(buf, 10, &order);
+	if (err || order > SWAP_RA_ORDER_CEILING)
+		return -EINVAL;
+
+	vma_ra_max_order = order;
+
+	return count;
+}
+static struct kobj_attribute vma_ra_max_order_attr =
+	__ATTR(vma_ra_max_order, 0644, vma_ra_max_order_show,
+	       vma_ra_max_order_store);
+
+static struct attribute *swap_attrs[] = {
+	&vma_ra_enabled_attr.attr,
+	&vma_ra_max_order_attr.attr,
+	NULL,
+};
+
+static struct attribute_group swap_attr_group = {
+	.attrs = swap_attrs,
+};
+
+static int __init swap_init_sysfs(void)
+{
+	int err;
+	struct kobject *swap_kobj;
+
+	swap_kobj = kobject_create_and_add("swap", mm_kobj);
+	if (!swap_kobj) {
+		printk(KERN_ERR "failed to create swap kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(swap_kobj, &swap_attr_group);
+	if (err) {
+		printk(KERN_ERR "failed to register swap group\n");
+		kobject_put(swap_kobj);
+		return err;
+	}
+	return 0;
+}
+module_init(swap_init_sysfs);
+#endif /* CONFIG_SYSFS */
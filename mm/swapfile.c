@@ -46,6 +46,7 @@ static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
 long nr_swap_pages;
 long total_swap_pages;
+atomic_t nr_rotate_swap = ATOMIC_INIT(0);
 static int least_priority;
 
 static const char Bad_file[] = "Bad swap file entry ";
@@ -203,23 +204,295 @@ static void discard_swap_cluster(struct swap_info_struct *si,
 	}
 }
 
-static int wait_for_discard(void *word)
+#define SWAPFILE_CLUSTER	256
+#define LATENCY_LIMIT		256
+
+static inline void cluster_set_flag(struct swap_cluster_info *info,
+	unsigned int flag)
 {
-	schedule();
-	return 0;
+	info->flags = flag;
 }
 
-#define SWAPFILE_CLUSTER	256
-#define LATENCY_LIMIT		256
+static inline unsigned int cluster_count(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_count(struct swap_cluster_info *info,
+				     unsigned int c)
+{
+	info->data = c;
+}
+
+static inline void cluster_set_count_flag(struct swap_cluster_info *info,
+					 unsigned int c, unsigned int f)
+{
+	info->flags = f;
+	info->data = c;
+}
+
+static inline unsigned int cluster_next(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_next(struct swap_cluster_info *info,
+				    unsigned int n)
+{
+	info->data = n;
+}
+
+static inline void cluster_set_next_flag(struct swap_cluster_info *info,
+					 unsigned int n, unsigned int f)
+{
+	info->flags = f;
+	info->data = n;
+}
+
+static inline bool cluster_is_free(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_FREE;
+}
+
+static inline bool cluster_is_null(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_NEXT_NULL;
+}
+
+static inline void cluster_set_null(struct swap_cluster_info *info)
+{
+	info->flags = CLUSTER_FLAG_NEXT_NULL;
+	info->data = 0;
+}
+
+/* Append cluster @idx to the list between @head and @tail */
+static void cluster_list_add_tail(struct swap_info_struct *si,
+				  struct swap_cluster_info *head,
+				  struct swap_cluster_info *tail,
+				  unsigned int idx)
+{
+	if (cluster_is_null(head)) {
+		cluster_set_next_flag(head, idx, 0);
+		cluster_set_next_flag(tail, idx, 0);
+	} else {
+		cluster_set_next(&si->cluster_info[cluster_next(tail)], idx);
+		cluster_set_next_flag(tail, idx, 0);
+	}
+}
 
-static inline unsigned long scan_swap_map(struct swap_info_struct *si,
-					  unsigned char usage)
+/* Remove and return the first cluster of a non-empty list */
+static unsigned int cluster_list_del_first(struct swap_info_struct *si,
+					   struct swap_cluster_info *head,
+					   struct swap_cluster_info *tail)
+{
+	unsigned int idx = cluster_next(head);
+
+	if (cluster_next(tail) == idx) {
+		cluster_set_null(head);
+		cluster_set_null(tail);
+	} else
+		cluster_set_next_flag(head,
+				cluster_next(&si->cluster_info[idx]), 0);
+	return idx;
+}
+
+/*
+ * Queue a free cluster for discard, instead of putting it straight back
+ * on the free list.  Its swap_map entries are marked bad meanwhile, so
+ * that the fallback linear scan in scan_swap_map() can't hand them out.
+ */
+static void swap_cluster_schedule_discard(struct swap_info_struct *si,
+					  unsigned int idx)
+{
+	memset(si->swap_map + idx * SWAPFILE_CLUSTER,
+			SWAP_MAP_BAD, SWAPFILE_CLUSTER);
+	cluster_list_add_tail(si, &si->discard_cluster_head,
+			      &si->discard_cluster_tail, idx);
+	schedule_work(&si->discard_work);
+}
+
+/*
+ * Discard all clusters queued for discard, and put them back on the free
+ * cluster list.  Runs of adjacent clusters are discarded with a single
+ * request.  Called with swap_lock held, which is dropped around the
+ * discards themselves.
+ */
+static void swap_do_scheduled_discard(struct swap_info_struct *si)
+{
+	struct swap_cluster_info *info = si->cluster_info;
+	unsigned int idx, first, nr, i;
+
+	while (!cluster_is_null(&si->discard_cluster_head)) {
+		first = cluster_list_del_first(si, &si->discard_cluster_head,
+					       &si->discard_cluster_tail);
+		nr = 1;
+		while (!cluster_is_null(&si->discard_cluster_head) &&
+		       cluster_next(&si->discard_cluster_head) == first + nr) {
+			cluster_list_del_first(si, &si->discard_cluster_head,
+					       &si->discard_cluster_tail);
+			nr++;
+		}
+		spin_unlock(&swap_lock);
+
+		discard_swap_cluster(si, first * SWAPFILE_CLUSTER,
+				     nr * SWAPFILE_CLUSTER);
+
+		spin_lock(&swap_lock);
+		for (i = 0; i < nr; i++) {
+			idx = first + i;
+			cluster_set_flag(&info[idx], CLUSTER_FLAG_FREE);
+			cluster_list_add_tail(si, &si->free_cluster_head,
+					      &si->free_cluster_tail, idx);
+			memset(si->swap_map + idx * SWAPFILE_CLUSTER,
+					0, SWAPFILE_CLUSTER);
+		}
+	}
+}
+
+static void swap_discard_work(struct work_struct *work)
+{
+	struct swap_info_struct *si;
+
+	si = container_of(work, struct swap_info_struct, discard_work);
+
+	spin_lock(&swap_lock);
+	swap_do_scheduled_discard(si);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Account a page allocated in its cluster, taking the cluster off the
+ * free list if it was free.  A free cluster is only ever allocated from
+ * when it is at the head of the list.
+ */
+static void inc_cluster_info_page(struct swap_info_struct *p,
+	struct swap_cluster_info *cluster_info, unsigned long page_nr)
+{
+	unsigned long idx = page_nr / SWAPFILE_CLUSTER;
+
+	if (!cluster_info)
+		return;
+	if (cluster_is_free(&cluster_info[idx])) {
+		VM_BUG_ON(cluster_next(&p->free_cluster_head) != idx);
+		cluster_list_del_first(p, &p->free_cluster_head,
+				       &p->free_cluster_tail);
+		cluster_set_count_flag(&cluster_info[idx], 0, 0);
+	}
+
+	VM_BUG_ON(cluster_count(&cluster_info[idx]) >= SWAPFILE_CLUSTER);
+	cluster_set_count(&cluster_info[idx],
+		cluster_count(&cluster_info[idx]) + 1);
+}
+
+/*
+ * Account a page freed in its cluster.  A cluster with no pages left in
+ * use goes back on the free list, or is queued for discard first if the
+ * swap area is discardable.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *p,
+	struct swap_cluster_info *cluster_info, unsigned long page_nr)
+{
+	unsigned long idx = page_nr / SWAPFILE_CLUSTER;
+
+	if (!cluster_info)
+		return;
+
+	VM_BUG_ON(cluster_count(&cluster_info[idx]) == 0);
+	cluster_set_count(&cluster_info[idx],
+		cluster_count(&cluster_info[idx]) - 1);
+
+	if (cluster_count(&cluster_info[idx]) == 0) {
+		if ((p->flags & (SWP_WRITEOK | SWP_DISCARDABLE)) ==
+				(SWP_WRITEOK | SWP_DISCARDABLE)) {
+			swap_cluster_schedule_discard(p, idx);
+			return;
+		}
+
+		cluster_set_flag(&cluster_info[idx], CLUSTER_FLAG_FREE);
+		cluster_list_add_tail(p, &p->free_cluster_head,
+				      &p->free_cluster_tail, idx);
+	}
+}
+
+/*
+ * The linear scan in scan_swap_map() may stumble on a free cluster in
+ * the middle of the free list.  Allocating from it would corrupt the
+ * list, so make this CPU pick a new cluster instead.
+ */
+static bool scan_swap_map_ssd_cluster_conflict(struct swap_info_struct *si,
+					       unsigned long offset)
+{
+	struct percpu_cluster *percpu_cluster;
+	bool conflict;
+
+	offset /= SWAPFILE_CLUSTER;
+	conflict = !cluster_is_null(&si->free_cluster_head) &&
+		offset != cluster_next(&si->free_cluster_head) &&
+		cluster_is_free(&si->cluster_info[offset]);
+
+	if (!conflict)
+		return false;
+
+	percpu_cluster = this_cpu_ptr(si->percpu_cluster);
+	cluster_set_null(&percpu_cluster->index);
+	return true;
+}
+
+/*
+ * Find a free slot in this CPU's cluster, taking a new cluster from the
+ * free list when it is used up.  If there are no free clusters left,
+ * *offset is left alone for the linear scan to start from.
+ */
+static void scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+	unsigned long *offset, unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	unsigned long tmp, max;
+
+new_cluster:
+	cluster = this_cpu_ptr(si->percpu_cluster);
+	if (cluster_is_null(&cluster->index)) {
+		if (!cluster_is_null(&si->free_cluster_head)) {
+			cluster->index = si->free_cluster_head;
+			cluster->next = cluster_next(&cluster->index) *
+					SWAPFILE_CLUSTER;
+		} else if (!cluster_is_null(&si->discard_cluster_head)) {
+			/*
+			 * No free cluster, but some are waiting to be
+			 * discarded: do that now and reclaim them.
+			 */
+			swap_do_scheduled_discard(si);
+			*scan_base = *offset = si->cluster_next;
+			goto new_cluster;
+		} else
+			return;
+	}
+
+	/*
+	 * Other CPUs can allocate from our cluster when they fall back to
+	 * the linear scan, so check that there is still a free entry in it.
+	 */
+	tmp = cluster->next;
+	max = min_t(unsigned long, si->max,
+		    (cluster_next(&cluster->index) + 1) * SWAPFILE_CLUSTER);
+	while (tmp < max && si->swap_map[tmp])
+		tmp++;
+	if (tmp >= max) {
+		cluster_set_null(&cluster->index);
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*offset = tmp;
+	*scan_base = tmp;
+}
+
+static unsigned long scan_swap_map(struct swap_info_struct *si,
+				   unsigned char usage)
 {
 	unsigned long offset;
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
 	int latency_ration = LATENCY_LIMIT;
-	int found_free_cluster = 0;
 
 	/*
 	 * We try to cluster swap pages by allocating them sequentially
@@ -230,41 +503,31 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
 	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * On SSD, each CPU now allocates from an aligned cluster of
+	 * its own, tracked in si->cluster_info.
 	 */
 
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	/* SSD algorithm */
+	if (si->cluster_info) {
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
 			goto checks;
 		}
-		if (si->flags & SWP_DISCARDABLE) {
-			/*
-			 * Start range check on racing allocations, in case
-			 * they overlap the cluster we eventually decide on
-			 * (we scan without swap_lock to allow preemption).
-			 * It's hardly conceivable that cluster_nr could be
-			 * wrapped during our scan, but don't depend on it.
-			 */
-			if (si->lowest_alloc)
-				goto checks;
-			si->lowest_alloc = si->max;
-			si->highest_alloc = 0;
-		}
 		spin_unlock(&swap_lock);
 
 		/*
 		 * If seek is expensive, start searching for new cluster from
 		 * start of partition, to minimize the span of allocated swap.
-		 * But if seek is cheap, search from our current position, so
-		 * that swap is allocated from all over the partition: if the
-		 * Flash Translation Layer only remaps within limited zones,
-		 * we don't want to wear out the first zone too quickly.
 		 */
-		if (!(si->flags & SWP_SOLIDSTATE))
-			scan_base = offset = si->lowest_bit;
+		scan_base = offset = si->lowest_bit;
 		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
 
 		/* Locate the first empty (unaligned) cluster */
@@ -276,28 +539,6 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
-				goto checks;
-			}
-			if (unlikely(--latency_ration < 0)) {
-				cond_resched();
-				latency_ration = LATENCY_LIMIT;
-			}
-		}
-
-		offset = si->lowest_bit;
-		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
-
-		/* Locate the first empty (unaligned) cluster */
-		for (; last_in_cluster < scan_base; offset++) {
-			if (si->swap_map[offset])
-				last_in_cluster = offset + SWAPFILE_CLUSTER;
-			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
-				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
 				goto checks;
 			}
 			if (unlikely(--latency_ration < 0)) {
@@ -309,10 +550,13 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 		offset = scan_base;
 		spin_lock(&swap_lock);
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
-		si->lowest_alloc = 0;
 	}
 
 checks:
+	if (si->cluster_info) {
+		while (scan_swap_map_ssd_cluster_conflict(si, offset))
+			scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+	}
 	if (!(si->flags & SWP_WRITEOK))
 		goto no_page;
 	if (!si->highest_bit)
@@ -345,62 +589,10 @@ checks:
 		si->highest_bit = 0;
 	}
 	si->swap_map[offset] = usage;
+	inc_cluster_info_page(si, si->cluster_info, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
-	if (si->lowest_alloc) {
-		/*
-		 * Only set when SWP_DISCARDABLE, and there's a scan
-		 * for a free cluster in progress or just completed.
-		 */
-		if (found_free_cluster) {
-			/*
-			 * To optimize wear-levelling, discard the
-			 * old data of the cluster, taking care not to
-			 * discard any of its pages that have already
-			 * been allocated by racing tasks (offset has
-			 * already stepped over any at the beginning).
-			 */
-			if (offset < si->highest_alloc &&
-			    si->lowest_alloc <= last_in_cluster)
-				last_in_cluster = si->lowest_alloc - 1;
-			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
-
-			if (offset < last_in_cluster)
-				discard_swap_cluster(si, offset,
-					last_in_cluster - offset + 1);
-
-			spin_lock(&swap_lock);
-			si->lowest_alloc = 0;
-			si->flags &= ~SWP_DISCARDING;
-
-			smp_mb();	/* wake_up_bit advises this */
-			wake_up_bit(&si->flags, ilog2(SWP_DISCARDING));
-
-		} else if (si->flags & SWP_DISCARDING) {
-			/*
-			 * Delay using pages allocated by racing tasks
-			 * until the whole discard has been issued. We
-			 * could defer that delay until swap_writepage,
-			 * but it's easier to keep this self-contained.
-			 */
-			spin_unlock(&swap_lock);
-			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
-				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
-		} else {
-			/*
-			 * Note pages allocated by racing tasks while
-			 * scan for a free cluster is in progress, so
-			 * that its final discard can exclude them.
-			 */
-			if (offset < si->lowest_alloc)
-				si->lowest_alloc = offset;
-			if (offset > si->highest_alloc)
-				si->highest_alloc = offset;
-		}
-	}
 	return offset;
 
 scan:
@@ -441,17 +633,24 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to @n swap entries for the swap cache, taking swap_lock
+ * only once for the batch.  Returns the number of entries allocated.
+ */
+int get_swap_pages(int n, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int n_ret = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n > nr_swap_pages)
+		n = nr_swap_pages;
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -469,18 +668,21 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (n_ret < n) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			swp_entries[n_ret++] = swp_entry(type, offset);
 		}
+		if (n_ret == n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n - n_ret;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return n_ret;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -575,28 +777,59 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
-
-	/* free if no reference */
-	if (!usage) {
-		struct gendisk *disk = p->bdev->bd_disk;
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (swap_list.next >= 0 &&
-		    p->prio > swap_info[swap_list.next]->prio)
-			swap_list.next = p->type;
-		nr_swap_pages++;
-		p->inuse_pages--;
-		if ((p->flags & SWP_BLKDEV) &&
-				disk->fops->swap_slot_free_notify)
-			disk->fops->swap_slot_free_notify(p->bdev, offset);
-	}
+	/*
+	 * An entry left without references is not released here: it
+	 * stays pinned as SWAP_HAS_CACHE until the caller, after dropping
+	 * swap_lock, hands it to free_swap_slot() for a batched release.
+	 */
+	p->swap_map[offset] = usage ? : SWAP_HAS_CACHE;
 
 	return usage;
 }
 
+static void swap_range_free(struct swap_info_struct *p, unsigned long offset)
+{
+	struct gendisk *disk = p->bdev->bd_disk;
+
+	p->swap_map[offset] = 0;
+	dec_cluster_info_page(p, p->cluster_info, offset);
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	if (swap_list.next >= 0 &&
+	    p->prio > swap_info[swap_list.next]->prio)
+		swap_list.next = p->type;
+	nr_swap_pages++;
+	p->inuse_pages--;
+	if ((p->flags & SWP_BLKDEV) &&
+			disk->fops->swap_slot_free_notify)
+		disk->fops->swap_slot_free_notify(p->bdev, offset);
+}
+
+/*
+ * Release swap entries which are left with only SWAP_HAS_CACHE and no
+ * swap cache page: either freed by swap_entry_free() or allocated by
+ * get_swap_pages() and never used.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p;
+	int i;
+
+	if (!n)
+		return;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++) {
+		p = swap_info[swp_type(entries[i])];
+		VM_BUG_ON(p->swap_map[swp_offset(entries[i])] !=
+			  SWAP_HAS_CACHE);
+		swap_range_free(p, swp_offset(entries[i]));
+	}
+	spin_unlock(&swap_lock);
+}
+
 /*
  * Caller has made sure that the swapdevice corresponding to entry
  * is still around or has not been recycled.
@@ -604,11 +837,14 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	unsigned char usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
+		usage = swap_entry_free(p, entry, 1);
 		spin_unlock(&swap_lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
@@ -626,6 +862,8 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
 		spin_unlock(&swap_lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
@@ -649,6 +887,28 @@ static inline int page_swapcount(struct page *page)
 	return count;
 }
 
+/*
+ * How many references to @entry are currently swapped out?  Like
+ * page_swapcount(), but for an entry which may well be free.
+ */
+int __swp_swapcount(swp_entry_t entry)
+{
+	struct swap_info_struct *si;
+	unsigned long type = swp_type(entry);
+	unsigned long offset = swp_offset(entry);
+	int count = 0;
+
+	if (type >= nr_swapfiles)
+		return 0;
+
+	spin_lock(&swap_lock);
+	si = swap_info[type];
+	if ((si->flags & SWP_USED) && offset < si->max)
+		count = swap_count(si->swap_map[offset]);
+	spin_unlock(&swap_lock);
+	return count;
+}
+
 /*
  * We can write to an anon page without COW if there are no other references
  * to it.  And as a side-effect, free up its swap: because the old content
@@ -719,13 +979,15 @@ int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	struct page *page = NULL;
+	unsigned char usage;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		usage = swap_entry_free(p, entry, 1);
+		if (usage == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
@@ -733,6 +995,8 @@ int free_swap_and_cache(swp_entry_t entry)
 			}
 		}
 		spin_unlock(&swap_lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -964,6 +1228,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (unlikely(pmd_trans_huge(*pmd)))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
@@ -1552,6 +1818,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1614,6 +1881,12 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	/*
+	 * Slots parked in the per-CPU caches would never be brought back
+	 * by try_to_unuse(): return them, and free directly until done.
+	 */
+	disable_swap_slots_cache();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
@@ -1638,9 +1911,13 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 		total_swap_pages += p->pages;
 		p->flags |= SWP_WRITEOK;
 		spin_unlock(&swap_lock);
+		reenable_swap_slots_cache();
 		goto out_dput;
 	}
 
+	reenable_swap_slots_cache();
+	flush_work(&p->discard_work);
+
 	/* wait for any unplug function to finish */
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
@@ -1666,10 +1943,17 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_dec(&nr_rotate_swap);
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	vfree(swap_map);
+	vfree(cluster_info);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1864,9 +2148,12 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
+	unsigned long nr_clusters = 0, ci;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
+	int cpu;
 
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
@@ -1905,6 +2192,11 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		 */
 	}
 	INIT_LIST_HEAD(&p->first_swap_extent.list);
+	cluster_set_null(&p->free_cluster_head);
+	cluster_set_null(&p->free_cluster_tail);
+	cluster_set_null(&p->discard_cluster_head);
+	cluster_set_null(&p->discard_cluster_tail);
+	INIT_WORK(&p->discard_work, swap_discard_work);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -2053,6 +2345,24 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	memset(swap_map, 0, maxpages);
 	nr_good_pages = maxpages - 1;	/* omit header page */
 
+	if (p->bdev && blk_queue_nonrot(bdev_get_queue(p->bdev))) {
+		nr_clusters = DIV_ROUND_UP(maxpages, SWAPFILE_CLUSTER);
+		cluster_info = vzalloc(nr_clusters * sizeof(*cluster_info));
+		p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+		if (!cluster_info || !p->percpu_cluster) {
+			error = -ENOMEM;
+			goto bad_swap;
+		}
+		p->cluster_info = cluster_info;
+		for_each_possible_cpu(cpu) {
+			struct percpu_cluster *cluster;
+
+			cluster = per_cpu_ptr(p->percpu_cluster, cpu);
+			cluster_set_null(&cluster->index);
+		}
+	}
+
+	/* The free cluster list is not built yet: no list operations */
 	for (i = 0; i < swap_header->info.nr_badpages; i++) {
 		unsigned int page_nr = swap_header->info.badpages[i];
 		if (page_nr == 0 || page_nr > swap_header->info.last_page) {
@@ -2062,6 +2372,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (page_nr < maxpages) {
 			swap_map[page_nr] = SWAP_MAP_BAD;
 			nr_good_pages--;
+			inc_cluster_info_page(p, cluster_info, page_nr);
 		}
 	}
 
@@ -2071,6 +2382,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 
 	if (nr_good_pages) {
 		swap_map[0] = SWAP_MAP_BAD;
+		inc_cluster_info_page(p, cluster_info, 0);
 		p->max = maxpages;
 		p->pages = nr_good_pages;
 		nr_extents = setup_swap_extents(p, &span);
@@ -2080,6 +2392,23 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		}
 		nr_good_pages = p->pages;
 	}
+
+	if (cluster_info) {
+		/*
+		 * Pages past the end of the area (which setup_swap_extents()
+		 * may have shrunk) keep the last cluster from ever counting
+		 * as free.  All other empty clusters go on the free list.
+		 */
+		for (ci = p->max; ci < nr_clusters * SWAPFILE_CLUSTER; ci++)
+			inc_cluster_info_page(p, cluster_info, ci);
+		for (ci = 0; ci < nr_clusters; ci++) {
+			if (cluster_count(&cluster_info[ci]))
+				continue;
+			cluster_set_flag(&cluster_info[ci], CLUSTER_FLAG_FREE);
+			cluster_list_add_tail(p, &p->free_cluster_head,
+					      &p->free_cluster_tail, ci);
+		}
+	}
 	if (!nr_good_pages) {
 		printk(KERN_WARNING "Empty swap-file\n");
 		error = -EINVAL;
@@ -2094,6 +2423,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (discard_swap(p) == 0 && (swap_flags & SWAP_FLAG_DISCARD))
 			p->flags |= SWP_DISCARDABLE;
 	}
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_inc(&nr_rotate_swap);
 
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
@@ -2143,9 +2474,13 @@ bad_swap:
 bad_swap_2:
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
+	p->cluster_info = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	vfree(swap_map);
+	vfree(cluster_info);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -40,6 +40,9 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/compaction.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -449,7 +452,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -495,10 +499,21 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
 
-		__remove_from_page_cache(page);
+		/*
+		 * Remember when a reclaimed page was evicted, so that a
+		 * refault can be told apart from a first access.  Shadow
+		 * entries are only left in regular files, whose page
+		 * cache is always torn down by truncation before the
+		 * inode goes away.
+		 */
+		if (reclaimed && page_is_file_cache(page) && mapping->host &&
+		    S_ISREG(mapping->host->i_mode))
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -521,7 +536,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -703,6 +718,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct address_space *mapping;
 		struct page *page;
 		int may_enter_fs;
+		int lazyfree = 0;
 
 		cond_resched();
 
@@ -759,11 +775,17 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Anonymous pages freed with MADV_FREE are discarded rather
+		 * than swapped out, unless they were written to again.
+		 */
+		lazyfree = PageAnon(page) && !PageSwapBacked(page);
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page)) {
+		if (PageAnon(page) && !lazyfree && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
 			if (!add_to_swap(page))
@@ -777,8 +799,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, TTU_UNMAP)) {
+		if (page_mapped(page) && (mapping || lazyfree)) {
+			switch (try_to_unmap(page, TTU_UNMAP | TTU_BATCH_FLUSH)) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -790,6 +812,22 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+		if (lazyfree) {
+			/* Dirtied through a reference other than a pte */
+			if (PageDirty(page))
+				goto activate_locked;
+			/* Like __remove_mapping(), minus the page cache */
+			if (!page_freeze_refs(page, 1))
+				goto keep_locked;
+			if (unlikely(PageDirty(page))) {
+				page_unfreeze_refs(page, 1);
+				goto keep_locked;
+			}
+			count_vm_event(PGLAZYFREED);
+			__clear_page_locked(page);
+			goto free_it;
+		}
+
 		if (PageDirty(page)) {
 			nr_dirty++;
 
@@ -800,7 +838,11 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
-			/* Page is dirty, try to write it out here */
+			/*
+			 * Page is dirty, try to write it out here.  Any
+			 * batched flush of writable ptes must go first.
+			 */
+			try_to_unmap_flush_dirty();
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
 				nr_congested++;
@@ -869,7 +911,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -899,6 +941,9 @@ cull_mlocked:
 		continue;
 
 activate_locked:
+		/* A lazily freed page that was written to is needed again */
+		if (lazyfree && PageDirty(page))
+			SetPageSwapBacked(page);
 		/* Not a candidate for swapping, so reclaim swap space. */
 		if (PageSwapCache(page) && vm_swap_full())
 			try_to_free_swap(page);
@@ -923,6 +968,7 @@ keep_lumpy:
 	if (nr_dirty == nr_congested && nr_dirty != 0)
 		zone_set_flag(zone, ZONE_CONGESTED);
 
+	try_to_unmap_flush();
 	free_page_list(&free_pages);
 
 	list_splice(&ret_pages, page_list);
@@ -976,6 +1022,7 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 		 * page release code relies on it.
 		 */
 		ClearPageLRU(page);
+		lru_gen_isolate_page(page_zone(page), page);
 		ret = 0;
 	}
 
@@ -1028,7 +1075,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		case 0:
 			list_move(&page->lru, dst);
 			mem_cgroup_del_lru(page);
-			nr_taken++;
+			nr_taken += hpage_nr_pages(page);
 			break;
 
 		case -EBUSY:
@@ -1086,7 +1133,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			if (__isolate_lru_page(cursor_page, mode, file) == 0) {
 				list_move(&cursor_page->lru, dst);
 				mem_cgroup_del_lru(cursor_page);
-				nr_taken++;
+				nr_taken += hpage_nr_pages(cursor_page);
 				nr_lumpy_taken++;
 				if (PageDirty(cursor_page))
 					nr_lumpy_dirty++;
@@ -1141,14 +1188,15 @@ static unsigned long clear_active_flags(struct list_head *page_list,
 	struct page *page;
 
 	list_for_each_entry(page, page_list, lru) {
+		int numpages = hpage_nr_pages(page);
 		lru = page_lru_base_type(page);
 		if (PageActive(page)) {
 			lru += LRU_ACTIVE;
 			ClearPageActive(page);
-			nr_active++;
+			nr_active += numpages;
 		}
 		if (count)
-			count[lru]++;
+			count[lru] += numpages;
 	}
 
 	return nr_active;
@@ -1258,7 +1306,8 @@ putback_lru_pages(struct zone *zone, struct scan_control *sc,
 		add_page_to_lru_list(zone, page, lru);
 		if (is_active_lru(lru)) {
 			int file = is_file_lru(lru);
-			reclaim_stat->recent_rotated[file]++;
+			int numpages = hpage_nr_pages(page);
+			reclaim_stat->recent_rotated[file] += numpages;
 		}
 		if (!pagevec_add(&pvec, page)) {
 			spin_unlock_irq(&zone->lru_lock);
@@ -1464,9 +1513,12 @@ static void move_active_pages_to_lru(struct zone *zone,
 		VM_BUG_ON(PageLRU(page));
 		SetPageLRU(page);
 
-		list_move(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_add_lru_list(page, lru);
-		pgmoved++;
+		list_del(&page->lru);
+		if (!lru_gen_add_page(zone, page)) {
+			list_add(&page->lru, &zone->lru[lru].list);
+			mem_cgroup_add_lru_list(page, lru);
+			pgmoved += hpage_nr_pages(page);
+		}
 
 		if (!pagevec_add(&pvec, page) || list_empty(list)) {
 			spin_unlock_irq(&zone->lru_lock);
@@ -1534,7 +1586,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 		}
 
 		if (page_referenced(page, 0, sc->mem_cgroup, &vm_flags)) {
-			nr_rotated++;
+			nr_rotated += hpage_nr_pages(page);
 			/*
 			 * Identify referenced, file-backed active pages and
 			 * give them one more trip around the active list. So
@@ -1804,6 +1856,787 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multi-generational LRU
+ *
+ * The evictable pages of a zone are kept on MAX_NR_GENS generations per
+ * type instead of the active and inactive lists, see struct
+ * lru_gen_struct.  Aging does not look at pages on the LRU at all: it
+ * opens a new generation, then walks the page tables of all processes
+ * and moves the pages found young to it, clearing the accessed bits in
+ * batches as it goes.  Eviction isolates pages from the tail of the
+ * oldest generation and hands them to shrink_page_list(); once that is
+ * empty, the oldest generation is retired.  Pages shrink_page_list()
+ * finds referenced after all, and file pages which refault, are fed
+ * back to balance eviction between anon and file.
+ *
+ * Reclaim on behalf of a memory cgroup still uses its own lists, on
+ * which all the pages of the generations are inactive.
+ */
+
+#ifdef CONFIG_LRU_GEN_ENABLED
+static bool lru_gen_enabled = true;
+#else
+static bool lru_gen_enabled;
+#endif
+
+/* serializes aging, and aging against switching the generations */
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+/* the mm being walked, and where the walk goes on after it */
+static struct mm_struct *lru_gen_mm_walking;
+static struct list_head *lru_gen_mm_next;
+static DECLARE_WAIT_QUEUE_HEAD(lru_gen_mm_wait);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+/*
+ * Called before the page tables of @mm are torn down: wait for a walk
+ * of them to finish, it never sleeps on anything but mmap_sem.
+ */
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	if (lru_gen_mm_next == &mm->lru_gen_list)
+		lru_gen_mm_next = mm->lru_gen_list.next;
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+
+	wait_event(lru_gen_mm_wait, ACCESS_ONCE(lru_gen_mm_walking) != mm);
+}
+
+struct lru_gen_walk {
+	struct zone *zone;
+	struct vm_area_struct *vma;
+	struct pagevec pvec;
+};
+
+/* Move the pages found young to the youngest generation */
+static void lru_gen_promote(struct zone *zone, struct pagevec *pvec)
+{
+	int i, new_gen;
+
+	spin_lock_irq(&zone->lru_lock);
+	new_gen = lru_gen_from_seq(zone->lrugen.max_seq);
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+		int gen = page_lru_gen(page);
+
+		/* isolated pages are off their generation */
+		if (gen >= 0)
+			lru_gen_move_page(zone, page, gen, new_gen, false);
+	}
+	spin_unlock_irq(&zone->lru_lock);
+
+	release_pages(pvec->pages, pagevec_count(pvec), pvec->cold);
+	pagevec_reinit(pvec);
+}
+
+static void lru_gen_walk_add(struct lru_gen_walk *walk, struct page *page)
+{
+	get_page(page);
+	if (!pagevec_add(&walk->pvec, page))
+		lru_gen_promote(walk->zone, &walk->pvec);
+}
+
+static void lru_gen_walk_pte_range(struct lru_gen_walk *walk, pmd_t *pmd,
+				   unsigned long addr, unsigned long end)
+{
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || !pte_young(ptent))
+			continue;
+
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || page_zone(page) != walk->zone)
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_walk_add(walk, page);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static void lru_gen_walk_pmd_huge(struct lru_gen_walk *walk, pmd_t *pmd,
+				  unsigned long addr)
+{
+	struct vm_area_struct *vma = walk->vma;
+	struct page *page;
+	int i, nr;
+
+	spin_lock(&vma->vm_mm->page_table_lock);
+	if (!pmd_trans_huge(*pmd) || pmd_trans_splitting(*pmd) ||
+	    !pmd_young(*pmd))
+		goto unlock;
+
+	page = pmd_page(*pmd);
+	if (page_zone(page) != walk->zone ||
+	    !pmdp_test_and_clear_young(vma, addr, pmd))
+		goto unlock;
+
+	/* a team of small pages mapped by the pmd is on the LRU page by page */
+	nr = PageTransHuge(page) ? 1 : HPAGE_PMD_NR;
+	for (i = 0; i < nr; i++)
+		lru_gen_walk_add(walk, page + i);
+unlock:
+	spin_unlock(&vma->vm_mm->page_table_lock);
+}
+#endif
+
+static void lru_gen_walk_pmd_range(struct lru_gen_walk *walk, pud_t *pud,
+				   unsigned long addr, unsigned long end)
+{
+	pmd_t *pmd;
+	unsigned long next;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		pmd_t pmdval = *pmd;
+
+		next = pmd_addr_end(addr, end);
+		/*
+		 * Page faults may populate the pmd under us, but with
+		 * mmap_sem held nothing can turn a page table into a huge
+		 * pmd, or take it away.
+		 */
+		barrier();
+		if (pmd_none(pmdval))
+			continue;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		if (pmd_trans_huge(pmdval)) {
+			lru_gen_walk_pmd_huge(walk, pmd, addr);
+			continue;
+		}
+#endif
+		if (unlikely(pmd_bad(pmdval)))
+			continue;
+		lru_gen_walk_pte_range(walk, pmd, addr, next);
+		cond_resched();
+	} while (pmd++, addr = next, addr != end);
+}
+
+static void lru_gen_walk_pud_range(struct lru_gen_walk *walk, pgd_t *pgd,
+				   unsigned long addr, unsigned long end)
+{
+	pud_t *pud;
+	unsigned long next;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		lru_gen_walk_pmd_range(walk, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+}
+
+static void lru_gen_walk_vma(struct lru_gen_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	unsigned long addr = vma->vm_start, end = vma->vm_end, next;
+	pgd_t *pgd;
+
+	pgd = pgd_offset(vma->vm_mm, addr);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		lru_gen_walk_pud_range(walk, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+}
+
+/* Accessed bits of these are not worth harvesting, or cannot be */
+#define LRU_GEN_VM_SKIP	(VM_LOCKED | VM_HUGETLB | VM_PFNMAP | VM_IO | \
+			 VM_SEQ_READ)
+
+static void lru_gen_walk_mm(struct lru_gen_walk *walk, struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+
+	/* an exiting mm is not worth the wait, nor a busy one */
+	if (!atomic_read(&mm->mm_users) || !down_read_trylock(&mm->mmap_sem))
+		return;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & LRU_GEN_VM_SKIP)
+			continue;
+		walk->vma = vma;
+		lru_gen_walk_vma(walk);
+	}
+	up_read(&mm->mmap_sem);
+}
+
+static void lru_gen_walk_mms(struct zone *zone)
+{
+	struct lru_gen_walk walk = { .zone = zone };
+	struct list_head *pos;
+
+	pagevec_init(&walk.pvec, 0);
+
+	spin_lock(&lru_gen_mm_lock);
+	pos = lru_gen_mm_list.next;
+	while (pos != &lru_gen_mm_list) {
+		struct mm_struct *mm;
+
+		mm = list_entry(pos, struct mm_struct, lru_gen_list);
+		lru_gen_mm_walking = mm;
+		lru_gen_mm_next = pos->next;
+		spin_unlock(&lru_gen_mm_lock);
+
+		lru_gen_walk_mm(&walk, mm);
+
+		spin_lock(&lru_gen_mm_lock);
+		lru_gen_mm_walking = NULL;
+		pos = lru_gen_mm_next;
+		wake_up_all(&lru_gen_mm_wait);
+	}
+	lru_gen_mm_next = NULL;
+	spin_unlock(&lru_gen_mm_lock);
+
+	if (pagevec_count(&walk.pvec))
+		lru_gen_promote(zone, &walk.pvec);
+}
+
+/*
+ * Retire the oldest generation of @type by folding it into the next
+ * one.  Drops zone->lru_lock now and then, and returns early if
+ * eviction retired the generation meanwhile.
+ */
+static void lru_gen_inc_min_seq(struct zone *zone, int type)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long seq = lrugen->min_seq[type];
+	int gen = lru_gen_from_seq(seq);
+	int new_gen = lru_gen_from_seq(seq + 1);
+	struct list_head *head = &lrugen->lists[gen][type];
+	int batch = 0;
+
+	while (!list_empty(head)) {
+		/* from the young end, to keep the order at the old end */
+		struct page *page = list_entry(head->next, struct page, lru);
+
+		lru_gen_move_page(zone, page, gen, new_gen, true);
+		if (++batch < SWAP_CLUSTER_MAX)
+			continue;
+		batch = 0;
+		spin_unlock_irq(&zone->lru_lock);
+		cond_resched();
+		spin_lock_irq(&zone->lru_lock);
+		if (lrugen->min_seq[type] != seq)
+			return;
+	}
+	lrugen->min_seq[type]++;
+}
+
+static void lru_gen_inc_max_seq(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int type, prev, next;
+
+	spin_lock_irq(&zone->lru_lock);
+	for (type = 0; type < 2; type++) {
+		while (lrugen->max_seq - lrugen->min_seq[type] + 1 >=
+		       MAX_NR_GENS)
+			lru_gen_inc_min_seq(zone, type);
+	}
+
+	/* the second youngest generation is about to turn inactive */
+	prev = lru_gen_from_seq(lrugen->max_seq - 1);
+	next = lru_gen_from_seq(lrugen->max_seq + 1);
+	for (type = 0; type < 2; type++) {
+		long delta = lrugen->nr_pages[prev][type];
+
+		__mod_zone_page_state(zone, NR_LRU_BASE + type * LRU_FILE +
+				      LRU_ACTIVE, -delta);
+		__mod_zone_page_state(zone, NR_LRU_BASE + type * LRU_FILE,
+				      delta);
+		lrugen->avg_total[type] /= 2;
+		lrugen->avg_refaulted[type] /= 2;
+	}
+	lrugen->timestamps[next] = jiffies;
+	lrugen->max_seq++;
+	spin_unlock_irq(&zone->lru_lock);
+}
+
+static void lru_gen_age_zone(struct zone *zone, unsigned long max_seq)
+{
+	mutex_lock(&lru_gen_walk_mutex);
+	/* somebody else may have aged the zone while we waited */
+	if (zone->lrugen.enabled && zone->lrugen.max_seq == max_seq) {
+		lru_gen_inc_max_seq(zone);
+		lru_gen_walk_mms(zone);
+	}
+	mutex_unlock(&lru_gen_walk_mutex);
+}
+
+static bool lru_gen_can_evict(struct lru_gen_struct *lrugen, int type)
+{
+	return lrugen->min_seq[type] + MIN_NR_GENS <= lrugen->max_seq;
+}
+
+static bool lru_gen_can_swap(struct scan_control *sc)
+{
+	return sc->may_swap && nr_swap_pages > 0;
+}
+
+/*
+ * Age when eviction has run out of old generations, when most pages
+ * sit in the youngest one, or when the old ones are about to run out.
+ */
+static bool lru_gen_should_age(struct zone *zone, struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long young = 0, old = 0, total = 0;
+	bool can_evict = false;
+	int type = lru_gen_can_swap(sc) ? 0 : 1;
+
+	for (; type < 2; type++) {
+		unsigned long seq;
+
+		if (lru_gen_can_evict(lrugen, type))
+			can_evict = true;
+		for (seq = lrugen->min_seq[type]; seq <= lrugen->max_seq; seq++) {
+			long size = lrugen->nr_pages[lru_gen_from_seq(seq)][type];
+
+			if (size <= 0)
+				continue;
+			if (seq == lrugen->max_seq)
+				young += size;
+			else if (seq + MIN_NR_GENS <= lrugen->max_seq)
+				old += size;
+			total += size;
+		}
+	}
+
+	if (!can_evict)
+		return true;
+	return young * MIN_NR_GENS > total || old * (MIN_NR_GENS + 2) < total;
+}
+
+/*
+ * Pick the type to evict from: compare the fractions of the pages
+ * recently evicted of each type which turned out to be in use, weighed
+ * by swappiness like get_scan_count() does.  Returns -1 if there are
+ * no old generations to evict from.
+ */
+static int lru_gen_get_type(struct zone *zone, struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	unsigned long activate;
+	u64 anon_cost, file_cost;
+	int type;
+
+	if (!lru_gen_can_swap(sc))
+		return lru_gen_can_evict(lrugen, 1) ? 1 : -1;
+
+	spin_lock_irq(&zone->lru_lock);
+	/* file refaults are found by the workingset code */
+	activate = zone_page_state(zone, WORKINGSET_ACTIVATE);
+	if (activate > lrugen->nr_activate)
+		lrugen->avg_refaulted[1] += activate - lrugen->nr_activate;
+	lrugen->nr_activate = activate;
+
+	anon_cost = (u64)(lrugen->avg_refaulted[0] + 1) *
+		    (lrugen->avg_total[1] + 1) * (200 - sc->swappiness);
+	file_cost = (u64)(lrugen->avg_refaulted[1] + 1) *
+		    (lrugen->avg_total[0] + 1) * sc->swappiness;
+	spin_unlock_irq(&zone->lru_lock);
+
+	type = anon_cost < file_cost ? 0 : 1;
+	if (!lru_gen_can_evict(lrugen, type))
+		type = !type;
+	return lru_gen_can_evict(lrugen, type) ? type : -1;
+}
+
+static unsigned long lru_gen_evict(struct zone *zone, struct scan_control *sc,
+				   int type, unsigned long nr_to_scan)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	LIST_HEAD(page_list);
+	unsigned long nr_scanned = 0;
+	unsigned long nr_taken = 0;
+	unsigned long nr_protected = 0;
+	unsigned long nr_reclaimed;
+	struct page *page;
+
+	while (unlikely(too_many_isolated(zone, type, sc))) {
+		congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		/* We are about to die and free our memory. Return now. */
+		if (fatal_signal_pending(current))
+			return SWAP_CLUSTER_MAX;
+	}
+
+	lru_add_drain();
+	spin_lock_irq(&zone->lru_lock);
+
+	while (nr_scanned < nr_to_scan && lru_gen_can_evict(lrugen, type)) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		struct list_head *head = &lrugen->lists[gen][type];
+
+		if (list_empty(head)) {
+			lrugen->min_seq[type]++;
+			continue;
+		}
+
+		page = lru_to_page(head);
+		nr_scanned++;
+		if (__isolate_lru_page(page, ISOLATE_BOTH, type) == 0) {
+			list_move(&page->lru, &page_list);
+			mem_cgroup_del_lru(page);
+			nr_taken += hpage_nr_pages(page);
+		} else {
+			/* being freed elsewhere */
+			list_move(&page->lru, head);
+			mem_cgroup_rotate_lru_list(page, type * LRU_FILE);
+		}
+	}
+
+	zone->pages_scanned += nr_scanned;
+	if (current_is_kswapd())
+		__count_zone_vm_events(PGSCAN_KSWAPD, zone, nr_scanned);
+	else
+		__count_zone_vm_events(PGSCAN_DIRECT, zone, nr_scanned);
+	__mod_zone_page_state(zone, NR_LRU_BASE + type * LRU_FILE, -nr_taken);
+	__mod_zone_page_state(zone, NR_ISOLATED_ANON + type, nr_taken);
+	lrugen->avg_total[type] += nr_taken;
+
+	spin_unlock_irq(&zone->lru_lock);
+
+	if (!nr_taken)
+		return 0;
+
+	sc->lumpy_reclaim_mode = LUMPY_MODE_NONE;
+	nr_reclaimed = shrink_page_list(&page_list, zone, sc);
+
+	/* referenced after all, these go back to the youngest generation */
+	list_for_each_entry(page, &page_list, lru)
+		if (PageActive(page))
+			nr_protected += hpage_nr_pages(page);
+
+	local_irq_disable();
+	if (current_is_kswapd())
+		__count_vm_events(KSWAPD_STEAL, nr_reclaimed);
+	__count_zone_vm_events(PGSTEAL, zone, nr_reclaimed);
+
+	spin_lock(&zone->lru_lock);
+	lrugen->avg_refaulted[type] += nr_protected;
+	spin_unlock(&zone->lru_lock);
+
+	putback_lru_pages(zone, sc, type ? 0 : nr_taken, type ? nr_taken : 0,
+			  &page_list);
+
+	return nr_reclaimed;
+}
+
+static void lru_gen_shrink_zone(struct zone *zone, struct scan_control *sc,
+				int priority)
+{
+	unsigned long nr_to_scan;
+	unsigned long nr_reclaimed = sc->nr_reclaimed;
+	bool aged = false;
+
+	nr_to_scan = max_t(unsigned long,
+			   zone_reclaimable_pages(zone) >> priority,
+			   SWAP_CLUSTER_MAX);
+
+	while (nr_to_scan) {
+		unsigned long batch;
+		int type;
+
+		if (!aged && lru_gen_should_age(zone, sc)) {
+			lru_gen_age_zone(zone, ACCESS_ONCE(zone->lrugen.max_seq));
+			aged = true;
+		}
+
+		type = lru_gen_get_type(zone, sc);
+		if (type < 0)
+			break;
+
+		batch = min_t(unsigned long, nr_to_scan, SWAP_CLUSTER_MAX);
+		nr_to_scan -= batch;
+		nr_reclaimed += lru_gen_evict(zone, sc, type, batch);
+
+		/* see shrink_zone() */
+		if (nr_reclaimed >= sc->nr_to_reclaim && priority < DEF_PRIORITY)
+			break;
+	}
+
+	sc->nr_reclaimed = nr_reclaimed;
+}
+
+void __meminit lru_gen_init_zone(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	int gen, type;
+
+	memset(lrugen, 0, sizeof(*lrugen));
+	lrugen->max_seq = MIN_NR_GENS + 1;
+	lrugen->enabled = lru_gen_enabled;
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		lrugen->timestamps[gen] = jiffies;
+		for (type = 0; type < 2; type++)
+			INIT_LIST_HEAD(&lrugen->lists[gen][type]);
+	}
+}
+
+/*
+ * Move the pages of a zone between the classic lists and the
+ * generations, oldest first, SWAP_CLUSTER_MAX at a time.  Once the
+ * zone has been switched, nothing adds pages to the lists they are
+ * taken from, but rotation may move pages between generations: go
+ * over them until they are all empty.
+ */
+static void lru_gen_fill_zone(struct zone *zone)
+{
+	enum lru_list l;
+
+	for_each_evictable_lru(l) {
+		struct list_head *head = &zone->lru[l].list;
+
+		spin_lock_irq(&zone->lru_lock);
+		while (!list_empty(head)) {
+			int batch;
+
+			for (batch = 0; batch < SWAP_CLUSTER_MAX &&
+			     !list_empty(head); batch++) {
+				struct page *page = lru_to_page(head);
+
+				del_page_from_lru_list(zone, page, l);
+				add_page_to_lru_list(zone, page, l);
+			}
+			spin_unlock_irq(&zone->lru_lock);
+			cond_resched();
+			spin_lock_irq(&zone->lru_lock);
+		}
+		spin_unlock_irq(&zone->lru_lock);
+	}
+}
+
+static void lru_gen_drain_zone(struct zone *zone)
+{
+	struct lru_gen_struct *lrugen = &zone->lrugen;
+	bool drained;
+
+	do {
+		int i, type;
+
+		drained = true;
+		for (type = 0; type < 2; type++) {
+			for (i = 0; i < MAX_NR_GENS; i++) {
+				int gen, batch = 0;
+				struct list_head *head;
+
+				spin_lock_irq(&zone->lru_lock);
+				gen = lru_gen_from_seq(lrugen->min_seq[type] + i);
+				head = &lrugen->lists[gen][type];
+				while (!list_empty(head)) {
+					struct page *page = lru_to_page(head);
+
+					drained = false;
+					if (lru_gen_is_active(zone, gen))
+						SetPageActive(page);
+					del_page_from_lru_list(zone, page,
+							       page_lru(page));
+					add_page_to_lru_list(zone, page,
+							     page_lru(page));
+					if (++batch < SWAP_CLUSTER_MAX)
+						continue;
+					batch = 0;
+					spin_unlock_irq(&zone->lru_lock);
+					cond_resched();
+					spin_lock_irq(&zone->lru_lock);
+				}
+				spin_unlock_irq(&zone->lru_lock);
+			}
+		}
+	} while (!drained);
+}
+
+static void lru_gen_change_state(bool enable)
+{
+	struct zone *zone;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled)
+		goto unlock;
+
+	mutex_lock(&lru_gen_walk_mutex);
+	for_each_populated_zone(zone) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->lrugen.enabled = enable;
+		spin_unlock_irq(&zone->lru_lock);
+	}
+	/* so that the pages waiting in the pagevecs go the new way too */
+	lru_add_drain_all();
+	for_each_populated_zone(zone) {
+		if (enable)
+			lru_gen_fill_zone(zone);
+		else
+			lru_gen_drain_zone(zone);
+	}
+	lru_gen_enabled = enable;
+	mutex_unlock(&lru_gen_walk_mutex);
+unlock:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+static int __init setup_lru_gen(char *str)
+{
+	if (!str)
+		return -EINVAL;
+
+	if (!strcmp(str, "y") || !strcmp(str, "1"))
+		lru_gen_enabled = true;
+	else if (!strcmp(str, "n") || !strcmp(str, "0"))
+		lru_gen_enabled = false;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+early_param("lru_gen", setup_lru_gen);
+
+#ifdef CONFIG_SYSFS
+static ssize_t lru_gen_enabled_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", lru_gen_enabled ? "true" : "false");
+}
+static ssize_t lru_gen_enabled_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		lru_gen_change_state(true);
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		lru_gen_change_state(false);
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, lru_gen_enabled_show, lru_gen_enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+};
+
+static int __init lru_gen_init_sysfs(void)
+{
+	int err;
+	struct kobject *lru_gen_kobj;
+
+	lru_gen_kobj = kobject_create_and_add("lru_gen", mm_kobj);
+	if (!lru_gen_kobj) {
+		printk(KERN_ERR "failed to create lru_gen kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(lru_gen_kobj, &lru_gen_attr_group);
+	if (err) {
+		printk(KERN_ERR "failed to register lru_gen group\n");
+		kobject_put(lru_gen_kobj);
+		return err;
+	}
+	return 0;
+}
+module_init(lru_gen_init_sysfs);
+#endif /* CONFIG_SYSFS */
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * For each zone, one line per generation: its sequence number, its age
+ * in milliseconds, and the number of anon and file pages on it.
+ */
+static int lru_gen_show(struct seq_file *m, void *arg)
+{
+	struct zone *zone;
+
+	for_each_populated_zone(zone) {
+		struct lru_gen_struct *lrugen = &zone->lrugen;
+		unsigned long seq;
+
+		spin_lock_irq(&zone->lru_lock);
+		seq_printf(m, "Node %d, zone %8s%s\n", zone_to_nid(zone),
+			   zone->name, lrugen->enabled ? "" : " (disabled)");
+		for (seq = min(lrugen->min_seq[0], lrugen->min_seq[1]);
+		     seq <= lrugen->max_seq; seq++) {
+			int gen = lru_gen_from_seq(seq);
+
+			seq_printf(m, " %10lu %10u %10ld %10ld\n", seq,
+				   jiffies_to_msecs(jiffies -
+						    lrugen->timestamps[gen]),
+				   lrugen->nr_pages[gen][0],
+				   lrugen->nr_pages[gen][1]);
+		}
+		seq_printf(m, " refaulted/evicted anon %lu/%lu file %lu/%lu\n",
+			   lrugen->avg_refaulted[0], lrugen->avg_total[0],
+			   lrugen->avg_refaulted[1], lrugen->avg_total[1]);
+		spin_unlock_irq(&zone->lru_lock);
+	}
+	return 0;
+}
+
+static int lru_gen_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lru_gen_show, NULL);
+}
+
+static const struct file_operations lru_gen_fops = {
+	.open		= lru_gen_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init lru_gen_init_debugfs(void)
+{
+	if (!debugfs_create_file("lru_gen", 0444, NULL, NULL, &lru_gen_fops))
+		return -ENOMEM;
+	return 0;
+}
+module_init(lru_gen_init_debugfs);
+#endif /* CONFIG_DEBUG_FS */
+
+static bool lru_gen_zone_enabled(struct zone *zone, struct scan_control *sc)
+{
+	return zone->lrugen.enabled && scanning_global_lru(sc);
+}
+#else /* !CONFIG_LRU_GEN */
+static bool lru_gen_zone_enabled(struct zone *zone, struct scan_control *sc)
+{
+	return false;
+}
+
+static void lru_gen_shrink_zone(struct zone *zone, struct scan_control *sc,
+				int priority)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -1816,6 +2649,12 @@ static void shrink_zone(int priority, struct zone *zone,
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
 
+	if (lru_gen_zone_enabled(zone, sc)) {
+		lru_gen_shrink_zone(zone, sc, priority);
+		throttle_vm_writeout(sc->gfp_mask);
+		return;
+	}
+
 	get_scan_count(zone, sc, nr, priority);
 
 	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
@@ -2226,7 +3065,8 @@ loop_again:
 			 * Do some background aging of the anon list, to give
 			 * pages a chance to be referenced before reclaiming.
 			 */
-			if (inactive_anon_is_low(zone, &sc))
+			if (!lru_gen_zone_enabled(zone, &sc) &&
+			    inactive_anon_is_low(zone, &sc))
 				shrink_active_list(SWAP_CLUSTER_MAX, zone,
 							&sc, priority, 0);
 
@@ -2472,6 +3312,13 @@ static int kswapd(void *p)
 		if (!ret) {
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
 			balance_pgdat(pgdat, order);
+
+			/*
+			 * Reclaim alone rarely frees contiguous blocks; let
+			 * kcompactd defragment the node for the next
+			 * high-order allocation.
+			 */
+			wakeup_kcompactd(pgdat, order);
 		}
 	}
 	return 0;
@@ -2904,10 +3751,8 @@ retry:
 	if (page_evictable(page, NULL)) {
 		enum lru_list l = page_lru_base_type(page);
 
-		__dec_zone_state(zone, NR_UNEVICTABLE);
-		list_move(&page->lru, &zone->lru[l].list);
-		mem_cgroup_move_lists(page, LRU_UNEVICTABLE, l);
-		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		del_page_from_lru_list(zone, page, LRU_UNEVICTABLE);
+		add_page_to_lru_list(zone, page, l);
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
 		/*
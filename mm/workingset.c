@@ -0,0 +1,415 @@
+/*
+ * Workingset detection
+ *
+ *		Double CLOCK lists
+ *
+ * Per zone, two clock lists are maintained for file pages: the
+ * inactive and the active list.  Freshly faulted pages start out at
+ * the head of the inactive list and page reclaim scans pages from the
+ * tail.  Pages that are accessed multiple times on the inactive list
+ * are promoted to the active list, to protect them from reclaim,
+ * whereas active pages are demoted to the inactive list when the
+ * active list grows too big.
+ *
+ *   fault ------------------------+
+ *                                 |
+ *              +--------------+   |            +-------------+
+ *   reclaim <- |   inactive   | <-+-- demotion |    active   | <--+
+ *              +--------------+                +-------------+    |
+ *                     |                                           |
+ *                     +-------------- promotion ------------------+
+ *
+ *
+ *		Access frequency and refault distance
+ *
+ * A workload is thrashing when its pages are frequently used but they
+ * are evicted from the inactive list every time before another access
+ * would have promoted them to the active list.
+ *
+ * In cases where the average access distance between thrashing pages
+ * is bigger than the size of memory there is nothing that can be
+ * done - the thrashing set could never fit into memory under any
+ * circumstance.
+ *
+ * However, the average access distance could be bigger than the
+ * inactive list, yet smaller than the size of memory.  In this case,
+ * the set could fit into memory if it weren't for the currently
+ * active pages - which may be used more, hopefully less frequently:
+ *
+ *      +-memory available to cache-+
+ *      |                           |
+ *      +-inactive------+-active----+
+ *  a b | c d e f g h i | J K L M N |
+ *      +---------------+-----------+
+ *
+ * It is prohibitively expensive to accurately track access frequency
+ * of pages.  But a reasonable approximation can be made to measure
+ * thrashing on the inactive list, after which refaulting pages can be
+ * activated optimistically to compete with the existing active pages.
+ *
+ * Approximating inactive page access frequency - Observations:
+ *
+ * 1. When a page is accessed for the first time, it is added to the
+ *    head of the inactive list, slides every existing inactive page
+ *    towards the tail by one slot, and pushes the current tail page
+ *    out of memory.
+ *
+ * 2. When a page is accessed for the second time, it is promoted to
+ *    the active list, shrinking the inactive list by one slot.  This
+ *    also slides all inactive pages that were faulted into the cache
+ *    more recently than the activated page towards the tail of the
+ *    inactive list.
+ *
+ * Thus:
+ *
+ * 1. The sum of evictions and activations between any two points in
+ *    time indicate the minimum number of inactive pages accessed in
+ *    between.
+ *
+ * 2. Moving one inactive page N page slots towards the tail of the
+ *    list requires at least N inactive page accesses.
+ *
+ * Combining these:
+ *
+ * 1. When a page is finally evicted from memory, the number of
+ *    inactive pages accessed while the page was in cache is at least
+ *    the number of page slots on the inactive list.
+ *
+ * 2. In addition, measuring the sum of evictions and activations (E)
+ *    at the time of a page's eviction, and comparing it to another
+ *    reading (R) at the time the page faults back into memory tells
+ *    the minimum number of accesses while the page was not cached.
+ *    This is called the refault distance.
+ *
+ * Because the first access of the page was the fault and the second
+ * access the refault, we combine the in-cache distance with the
+ * out-of-cache distance to get the complete minimum access distance
+ * of this page:
+ *
+ *      NR_inactive + (R - E)
+ *
+ * And knowing the minimum access distance of a page, we can easily
+ * tell if the page would be able to stay in cache assuming all page
+ * slots in the cache were available:
+ *
+ *   NR_inactive + (R - E) <= NR_inactive + NR_active
+ *
+ * which can be further simplified to
+ *
+ *   (R - E) <= NR_active
+ *
+ * Put into words, the refault distance (out-of-cache) can be seen as
+ * a deficit in inactive list space (in-cache).  If the inactive list
+ * had (R - E) more page slots, the page would not have been evicted
+ * in between accesses, but activated instead.  And on a full system,
+ * the only thing eating into inactive list space is active pages.
+ *
+ *
+ *		Activating refaulting pages
+ *
+ * All that is known about the active list is that the pages have been
+ * accessed more than once in the past.  This means that at any given
+ * time there is actually a good chance that pages on the active list
+ * are no longer in active use.
+ *
+ * So when a refault distance of (R - E) is observed and there are at
+ * least (R - E) active pages, the refaulting page is activated
+ * optimistically in the hope that (R - E) active pages are actually
+ * used less frequently than the refaulting page - or even not used at
+ * all anymore.
+ *
+ * If this is wrong and demotion kicks in, the pages which are truly
+ * used more frequently will be reactivated while the less frequently
+ * used once will be evicted from memory.
+ *
+ * But if this is right, the stale pages will be pushed out of memory
+ * and the used pages get to stay in cache.
+ *
+ *
+ *		Implementation
+ *
+ * For each zone's file LRU lists, a counter for inactive evictions
+ * and activations is maintained (zone->inactive_age).
+ *
+ * On eviction, a snapshot of this counter (along with some bits to
+ * identify the zone) is stored in the now empty page cache radix tree
+ * slot of the evicted page.  This is called a shadow entry.
+ *
+ * On cache misses for which there are shadow entries, an eligible
+ * refault distance will immediately activate the refaulting page.
+ */
+
+#include <linux/pagemap.h>
+#include <linux/module.h>
+#include <linux/vmstat.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include "internal.h"
+
+/*
+ * The eviction counter is stored in the upper bits of the shadow
+ * entry, below them the node and zone the page belonged to, and the
+ * radix tree's exceptional entry marker at the bottom.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow,
+			  struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction;
+	unsigned long refault;
+	int zid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	*zone = NODE_DATA(entry & ((1UL << NODES_SHIFT) - 1))->node_zones + zid;
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.
+	 *
+	 * There is a special case: usually, shadow entries have a short
+	 * lifetime and are either refaulted or reclaimed along with the
+	 * inode before they get too old.  But it is not impossible for
+	 * the inactive_age to lap a shadow entry in the field, which can
+	 * result in a false small refault distance, leading to
+	 * a false activation should this old entry actually refault
+	 * again.  However, earlier kernels used to deactivate
+	 * unconditionally with *every* reclaim invocation for the
+	 * longest time, so the occasional inappropriate activation
+	 * leading to pressure on the active list is not a problem.
+	 */
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Shadow entries reflect the share of the working set that does not
+ * fit into memory, so their number depends on the access pattern of
+ * the workload.  In most cases, they will refault or get reclaimed
+ * along with the inode, but a (malicious) workload that streams
+ * through files with a total size several times that of available
+ * memory, while preventing the inodes from being reclaimed, can
+ * create excessive amounts of shadow nodes.  To keep a lid on this,
+ * radix tree nodes that contain nothing but shadow entries are kept
+ * on the shadow_nodes list and a shrinker reclaims them when their
+ * number grows out of proportion.
+ *
+ * shadow_nodes_lock nests inside the mapping's tree_lock, which is
+ * irq-safe, so it is always taken with interrupts disabled.
+ */
+static LIST_HEAD(shadow_nodes);
+static DEFINE_SPINLOCK(shadow_nodes_lock);
+static unsigned long nr_shadow_nodes;
+
+/**
+ * workingset_remember_node - track a radix tree node of shadow entries
+ * @node: page cache radix tree node
+ * @mapping: address space @node belongs to
+ * @index: an index covered by @node
+ *
+ * Called under @mapping->tree_lock when the last page in @node is
+ * replaced by a shadow entry or removed.
+ */
+void workingset_remember_node(struct radix_tree_node *node,
+			      struct address_space *mapping,
+			      pgoff_t index)
+{
+	node->private_data = mapping;
+	node->private_index = index & ~(unsigned long)RADIX_TREE_MAP_MASK;
+
+	spin_lock(&shadow_nodes_lock);
+	list_add_tail(&node->private_list, &shadow_nodes);
+	nr_shadow_nodes++;
+	spin_unlock(&shadow_nodes_lock);
+}
+
+/**
+ * workingset_forget_node - stop tracking a radix tree node
+ * @node: page cache radix tree node
+ *
+ * Called under the mapping's tree_lock when a page is inserted into
+ * @node again, or when its last shadow entry goes away.
+ */
+void workingset_forget_node(struct radix_tree_node *node)
+{
+	spin_lock(&shadow_nodes_lock);
+	list_del_init(&node->private_list);
+	nr_shadow_nodes--;
+	spin_unlock(&shadow_nodes_lock);
+}
+
+/*
+ * Allow one radix tree node of shadow entries for every eighth of a
+ * node's worth of pages in the system, i.e. one shadow entry per
+ * eight pages on average when nodes are fully populated.
+ */
+static unsigned long max_shadow_nodes(void)
+{
+	return totalram_pages >> (1 + RADIX_TREE_MAP_SHIFT - 3);
+}
+
+static unsigned long excess_shadow_nodes(void)
+{
+	unsigned long nr = nr_shadow_nodes;
+	unsigned long max = max_shadow_nodes();
+
+	return nr > max ? nr - max : 0;
+}
+
+/*
+ * Reclaim one node of shadow entries.  Returns with interrupts enabled
+ * and shadow_nodes_lock dropped.
+ */
+static void shadow_node_reclaim(struct radix_tree_node *node,
+				struct address_space *mapping)
+	__releases(shadow_nodes_lock)
+{
+	unsigned long base = node->private_index;
+	unsigned int i;
+
+	list_del_init(&node->private_list);
+	nr_shadow_nodes--;
+	spin_unlock(&shadow_nodes_lock);
+
+	/* A page may have been inserted since the node was tracked */
+	if (workingset_node_pages(node))
+		goto out;
+
+	inc_zone_state(page_zone(virt_to_page(node)), WORKINGSET_NODERECLAIM);
+
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		void *entry = node->slots[i];
+		bool last;
+
+		if (!radix_tree_exceptional_entry(entry))
+			continue;
+		/* The node is freed when its last entry goes */
+		last = workingset_node_shadows(node) == 1;
+		__remove_shadow_from_page_cache(mapping, base + i, entry);
+		if (last)
+			break;
+	}
+out:
+	spin_unlock(&mapping->tree_lock);
+	local_irq_enable();
+}
+
+static int shrink_shadow_nodes(struct shrinker *shrink, int nr_to_scan,
+			       gfp_t gfp_mask)
+{
+	if (!nr_to_scan)
+		goto out;
+
+	local_irq_disable();
+	spin_lock(&shadow_nodes_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&shadow_nodes) &&
+	       excess_shadow_nodes()) {
+		struct radix_tree_node *node;
+		struct address_space *mapping;
+
+		node = list_first_entry(&shadow_nodes, struct radix_tree_node,
+					private_list);
+		mapping = node->private_data;
+
+		/*
+		 * The tree_lock nests outside of shadow_nodes_lock, so
+		 * only trylock here.  The node can not go away while it
+		 * is on the list and the mapping can not go away while
+		 * it has tracked nodes.
+		 */
+		if (!spin_trylock(&mapping->tree_lock)) {
+			list_move_tail(&node->private_list, &shadow_nodes);
+			continue;
+		}
+
+		shadow_node_reclaim(node, mapping);
+		cond_resched();
+
+		local_irq_disable();
+		spin_lock(&shadow_nodes_lock);
+	}
+	spin_unlock(&shadow_nodes_lock);
+	local_irq_enable();
+out:
+	return min_t(unsigned long, excess_shadow_nodes(), INT_MAX);
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shrink_shadow_nodes,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init)
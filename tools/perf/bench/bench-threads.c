@@ -0,0 +1,86 @@
+/*
+ * bench-threads.c
+ *
+ * Timing, and starting a set of threads together, for the mem benchmarks
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "bench.h"
+
+#include <linux/kernel.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+struct bench_thread {
+	pthread_t	thread;
+	void		*(*fn)(void *);
+	void		*arg;
+};
+
+static pthread_mutex_t	start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	start_cond = PTHREAD_COND_INITIALIZER;
+static int		started;
+
+double bench_secs_since(struct timeval *tv_start)
+{
+	struct timeval tv_end, tv_diff;
+
+	BUG_ON(gettimeofday(&tv_end, NULL));
+	timersub(&tv_end, tv_start, &tv_diff);
+
+	return (double)tv_diff.tv_sec +
+		(double)tv_diff.tv_usec / (double)1000000;
+}
+
+static void *bench_thread_start(void *arg)
+{
+	struct bench_thread *bt = arg;
+
+	pthread_mutex_lock(&start_mutex);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_mutex);
+	pthread_mutex_unlock(&start_mutex);
+
+	return bt->fn(bt->arg);
+}
+
+/*
+ * Run @fn in @nr_threads threads, the n-th one on the n-th of the @size
+ * long elements of @data.  The threads are only let go once all of them
+ * are created, so that thread creation is not timed.
+ *
+ * Returns the seconds from then until the last of them finished.
+ */
+double bench_run_threads(int nr_threads, void *(*fn)(void *),
+			 void *data, size_t size)
+{
+	struct bench_thread *bts;
+	struct timeval tv_start;
+	double secs;
+	int t;
+
+	bts = zalloc(nr_threads * sizeof(*bts));
+	BUG_ON(!bts);
+
+	started = 0;
+	for (t = 0; t < nr_threads; t++) {
+		bts[t].fn = fn;
+		bts[t].arg = (char *)data + t * size;
+		BUG_ON(pthread_create(&bts[t].thread, NULL,
+				      bench_thread_start, &bts[t]));
+	}
+
+	BUG_ON(gettimeofday(&tv_start, NULL));
+	pthread_mutex_lock(&start_mutex);
+	started = 1;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_mutex);
+
+	for (t = 0; t < nr_threads; t++)
+		BUG_ON(pthread_join(bts[t].thread, NULL));
+	secs = bench_secs_since(&tv_start);
+
+	free(bts);
+
+	return secs;
+}
@@ -4,6 +4,9 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_madvise(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_faults(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_unmap(int argc, const char **argv, const char *prefix __used);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -14,4 +17,10 @@ extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __us
 
 extern int bench_format;
 
+struct timeval;
+
+extern double bench_secs_since(struct timeval *tv_start);
+extern double bench_run_threads(int nr_threads, void *(*fn)(void *),
+				void *data, size_t size);
+
 #endif
@@ -0,0 +1,169 @@
+/*
+ * mem-faults.c
+ *
+ * faults: Multithreaded page faults over many separate mappings
+ *
+ * Every thread keeps faulting in pages of its own set of anonymous
+ * mappings, and releasing them again with MADV_DONTNEED.  Each page
+ * fault starts with a find_vma() lookup, so with several threads working
+ * on different vmas of the same mm this measures how well those lookups
+ * are cached per thread.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+static int		nr_threads	= 4;
+static int		nr_vmas		= 8;
+static const char	*length_str	= "1MB";
+static int		iterations	= 100;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of faulting threads"),
+	OPT_INTEGER('v', "vmas", &nr_vmas,
+		    "Specify number of mappings per thread"),
+	OPT_STRING('l', "length", &length_str, "1MB",
+		    "Specify length of each mapping. "
+		    "available unit: B, MB, GB (upper and lower)"),
+	OPT_INTEGER('i', "iterations", &iterations,
+		    "Specify number of fault iterations"),
+	OPT_END()
+};
+
+static const char * const bench_mem_faults_usage[] = {
+	"perf bench mem faults <options>",
+	NULL
+};
+
+struct thread_data {
+	char		**vmas;
+	unsigned long	faults;
+};
+
+static size_t		length;
+static size_t		page_size;
+
+static void *fault_thread(void *arg)
+{
+	struct thread_data *td = arg;
+	size_t off;
+	int i, v;
+
+	for (i = 0; i < iterations; i++) {
+		/*
+		 * Go across the mappings page by page, so that consecutive
+		 * faults land in different vmas.
+		 */
+		for (off = 0; off < length; off += page_size) {
+			for (v = 0; v < nr_vmas; v++) {
+				td->vmas[v][off] = i;
+				td->faults++;
+			}
+		}
+		for (v = 0; v < nr_vmas; v++)
+			BUG_ON(madvise(td->vmas[v], length, MADV_DONTNEED));
+	}
+
+	return NULL;
+}
+
+/*
+ * Map the vmas of all the threads interleaved, with a PROT_NONE guard
+ * page in between so that none of them get merged.
+ */
+static char *map_vmas(struct thread_data *tds, size_t *total)
+{
+	size_t stride = length + page_size;
+	char *area, *p;
+	int t, v;
+
+	*total = stride * nr_threads * nr_vmas;
+	area = mmap(NULL, *total, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED)
+		die("mmap failed - maybe length is too large?\n");
+
+	p = area;
+	for (v = 0; v < nr_vmas; v++) {
+		for (t = 0; t < nr_threads; t++) {
+			if (mprotect(p, length, PROT_READ | PROT_WRITE))
+				die("mprotect failed: %s\n", strerror(errno));
+			tds[t].vmas[v] = p;
+			p += stride;
+		}
+	}
+
+	return area;
+}
+
+int bench_mem_faults(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct thread_data *tds;
+	unsigned long faults = 0;
+	size_t total;
+	double secs;
+	char *area;
+	int t;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_faults_usage, 0);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	length = (length + page_size - 1) & ~(page_size - 1);
+	if (nr_threads <= 0 || nr_vmas <= 0 || iterations <= 0) {
+		fprintf(stderr, "Invalid threads, vmas or iterations\n");
+		return 1;
+	}
+
+	tds = zalloc(nr_threads * sizeof(*tds));
+	BUG_ON(!tds);
+	for (t = 0; t < nr_threads; t++) {
+		tds[t].vmas = zalloc(nr_vmas * sizeof(char *));
+		BUG_ON(!tds[t].vmas);
+	}
+	area = map_vmas(tds, &total);
+
+	secs = bench_run_threads(nr_threads, fault_thread, tds, sizeof(*tds));
+	for (t = 0; t < nr_threads; t++)
+		faults += tds[t].faults;
+
+	munmap(area, total);
+	for (t = 0; t < nr_threads; t++)
+		free(tds[t].vmas);
+	free(tds);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads, %d vmas of %s each, %d iterations\n",
+		       nr_threads, nr_vmas, length_str, iterations);
+		printf(" %14lf Total time (sec)\n", secs);
+		printf(" %14lf faults/sec\n", (double)faults / secs);
+		printf(" %14lf usecs/fault\n\n",
+		       secs * 1000000 / (double)faults);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", (double)faults / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	return 0;
+}
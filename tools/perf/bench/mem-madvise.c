@@ -0,0 +1,178 @@
+/*
+ * mem-madvise.c
+ *
+ * madvise: Allocator style memory churn, releasing memory with
+ * MADV_DONTNEED or MADV_FREE between reuses
+ *
+ * Userspace allocators hand freed memory back to the kernel with
+ * madvise() and then reuse it.  With MADV_DONTNEED every reuse takes
+ * a page fault and gets a freshly zeroed page; with MADV_FREE the pages
+ * stay mapped unless the kernel needs the memory in between.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifndef MADV_FREE
+#define MADV_FREE	8
+#endif
+
+static const char	*length_str	= "64MB";
+static const char	*advice_str	= "all";
+static int		iterations	= 100;
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "64MB",
+		    "Specify length of memory to churn. "
+		    "available unit: B, MB, GB (upper and lower)"),
+	OPT_STRING('a', "advice", &advice_str, "all",
+		    "Specify advice to release memory with"),
+	OPT_INTEGER('i', "iterations", &iterations,
+		    "Specify number of reuse iterations"),
+	OPT_END()
+};
+
+struct advice {
+	const char *name;
+	const char *desc;
+	int advice;
+};
+
+static const struct advice advices[] = {
+	{ "dontneed",
+	  "Release memory with MADV_DONTNEED",
+	  MADV_DONTNEED },
+	{ "free",
+	  "Release memory with MADV_FREE",
+	  MADV_FREE },
+	{ NULL,
+	  NULL,
+	  0 }
+};
+
+static const char * const bench_mem_madvise_usage[] = {
+	"perf bench mem madvise <options>",
+	NULL
+};
+
+static void touch(char *buf, size_t length, size_t page_size, int val)
+{
+	size_t off;
+
+	for (off = 0; off < length; off += page_size)
+		buf[off] = val;
+}
+
+static int run_advice(const struct advice *adv, size_t length)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	struct timeval tv_start;
+	struct rusage ru_start, ru_end;
+	long faults;
+	double secs;
+	char *buf;
+	int i;
+
+	buf = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap failed - maybe length is too large?\n");
+
+	/* Populate once, so that every iteration releases and reuses */
+	touch(buf, length, page_size, 1);
+	if (madvise(buf, length, adv->advice)) {
+		if (errno == EINVAL) {
+			printf("# %s is not supported by this kernel\n",
+			       adv->name);
+			munmap(buf, length);
+			return 0;
+		}
+		die("madvise failed: %s\n", strerror(errno));
+	}
+
+	BUG_ON(getrusage(RUSAGE_SELF, &ru_start));
+	BUG_ON(gettimeofday(&tv_start, NULL));
+
+	for (i = 0; i < iterations; i++) {
+		touch(buf, length, page_size, i);
+		BUG_ON(madvise(buf, length, adv->advice));
+	}
+
+	secs = bench_secs_since(&tv_start);
+	BUG_ON(getrusage(RUSAGE_SELF, &ru_end));
+	munmap(buf, length);
+
+	faults = ru_end.ru_minflt - ru_start.ru_minflt;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s: %d iterations over %s\n",
+		       adv->name, iterations, length_str);
+		printf(" %14lf usecs/iteration\n",
+		       secs * 1000000 / iterations);
+		printf(" %14lf GB/Sec reused\n",
+		       (double)length * iterations / secs / 1024 / 1024 / 1024);
+		printf(" %14lf faults/iteration\n\n",
+		       (double)faults / iterations);
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %lf\n", adv->name, secs * 1000000 / iterations);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	return 0;
+}
+
+int bench_mem_madvise(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	size_t length;
+	int i, found = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_madvise_usage, 0);
+
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	if (iterations <= 0) {
+		fprintf(stderr, "Invalid iterations:%d\n", iterations);
+		return 1;
+	}
+
+	for (i = 0; advices[i].name; i++) {
+		if (strcmp(advice_str, "all") &&
+		    strcmp(advices[i].name, advice_str))
+			continue;
+		found = 1;
+		run_advice(&advices[i], length);
+	}
+
+	if (!found) {
+		printf("Unknown advice:%s\n", advice_str);
+		printf("Available advices...\n");
+		for (i = 0; advices[i].name; i++) {
+			printf("\t%s ... %s\n",
+			       advices[i].name, advices[i].desc);
+		}
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * mem-unmap.c
+ *
+ * unmap: Multithreaded munmap and reclaim throughput
+ *
+ * All threads of a process share its page tables, so when one thread
+ * unmaps pages the TLBs of every CPU the others run on must be flushed.
+ * In munmap mode every thread keeps mapping, touching and unmapping its
+ * own anonymous region.  In reclaim mode the threads keep touching a
+ * shared file mapping larger than the memory they are allowed (run it in
+ * a memory cgroup with a limit below --length), so that reclaim has to
+ * unmap the pages from under them.
+ */
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static int		nr_threads	= 8;
+static const char	*length_str	= "1MB";
+static const char	*mode_str	= "munmap";
+static const char	*dir_str	= ".";
+static int		iterations	= 1000;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads"),
+	OPT_STRING('l', "length", &length_str, "1MB",
+		    "Specify length of each thread's mapping in munmap mode, "
+		    "of the shared file mapping in reclaim mode. "
+		    "available unit: B, MB, GB (upper and lower)"),
+	OPT_STRING('m', "mode", &mode_str, "munmap",
+		    "Specify mode: munmap or reclaim"),
+	OPT_STRING('d', "dir", &dir_str, ".",
+		    "Specify directory for the file of reclaim mode"),
+	OPT_INTEGER('i', "iterations", &iterations,
+		    "Specify number of iterations"),
+	OPT_END()
+};
+
+static const char * const bench_mem_unmap_usage[] = {
+	"perf bench mem unmap <options>",
+	NULL
+};
+
+struct thread_data {
+	int		nr;
+	unsigned long	ops;
+};
+
+static size_t		length;
+static size_t		page_size;
+static char		*shared;
+
+static void *munmap_thread(void *arg)
+{
+	struct thread_data *td = arg;
+	size_t off;
+	char *p;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		BUG_ON(p == MAP_FAILED);
+		for (off = 0; off < length; off += page_size)
+			p[off] = i;
+		BUG_ON(munmap(p, length));
+		td->ops++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Each thread starts at its own offset into the shared mapping, so that
+ * they do not all fault on the same pages, and wraps around.
+ */
+static void *reclaim_thread(void *arg)
+{
+	struct thread_data *td = arg;
+	size_t off, start;
+	unsigned long sum = 0;
+	int i;
+
+	start = (length / nr_threads * td->nr) & ~(page_size - 1);
+	for (i = 0; i < iterations; i++) {
+		off = start;
+		do {
+			sum += shared[off];
+			td->ops++;
+			off += page_size;
+			if (off >= length)
+				off = 0;
+		} while (off != start);
+	}
+
+	return (void *)sum;
+}
+
+/* Sum of the pages reclaimed from all the zones so far */
+static unsigned long read_pgsteal(void)
+{
+	unsigned long val, total = 0;
+	char name[64];
+	FILE *fp;
+
+	fp = fopen("/proc/vmstat", "r");
+	if (!fp)
+		die("cannot open /proc/vmstat: %s\n", strerror(errno));
+	while (fscanf(fp, "%63s %lu", name, &val) == 2) {
+		if (!strncmp(name, "pgsteal_", 8))
+			total += val;
+	}
+	fclose(fp);
+
+	return total;
+}
+
+static void map_shared_file(void)
+{
+	char path[PATH_MAX];
+	size_t off;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/perf-bench-unmap.XXXXXX", dir_str);
+	fd = mkstemp(path);
+	if (fd < 0)
+		die("cannot create file in %s: %s\n", dir_str, strerror(errno));
+	unlink(path);
+	if (ftruncate(fd, length))
+		die("ftruncate failed: %s\n", strerror(errno));
+
+	shared = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shared == MAP_FAILED)
+		die("mmap failed - maybe length is too large?\n");
+	close(fd);
+
+	/* Populate the file up front: reclaim then drops clean pages */
+	for (off = 0; off < length; off += page_size)
+		shared[off] = 1;
+	if (msync(shared, length, MS_SYNC))
+		die("msync failed: %s\n", strerror(errno));
+}
+
+int bench_mem_unmap(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	void *(*fn)(void *) = munmap_thread;
+	unsigned long pgsteal = 0, ops = 0;
+	struct thread_data *tds;
+	int reclaim = 0;
+	double secs;
+	int t;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_unmap_usage, 0);
+
+	if (!strcmp(mode_str, "reclaim")) {
+		reclaim = 1;
+		fn = reclaim_thread;
+	} else if (strcmp(mode_str, "munmap")) {
+		fprintf(stderr, "Unknown mode:%s\n", mode_str);
+		return 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	length = (length + page_size - 1) & ~(page_size - 1);
+	if (nr_threads <= 0 || iterations <= 0) {
+		fprintf(stderr, "Invalid threads or iterations\n");
+		return 1;
+	}
+
+	if (reclaim)
+		map_shared_file();
+
+	tds = zalloc(nr_threads * sizeof(*tds));
+	BUG_ON(!tds);
+	for (t = 0; t < nr_threads; t++)
+		tds[t].nr = t;
+
+	if (reclaim)
+		pgsteal = read_pgsteal();
+	secs = bench_run_threads(nr_threads, fn, tds, sizeof(*tds));
+	for (t = 0; t < nr_threads; t++)
+		ops += tds[t].ops;
+	if (reclaim) {
+		pgsteal = read_pgsteal() - pgsteal;
+		munmap(shared, length);
+	}
+	free(tds);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d threads, %s mode on %s, %d iterations\n",
+		       nr_threads, mode_str, length_str, iterations);
+		printf(" %14lf Total time (sec)\n", secs);
+		if (reclaim) {
+			printf(" %14lf page accesses/sec\n",
+			       (double)ops / secs);
+			printf(" %14lf pages reclaimed/sec\n\n",
+			       (double)pgsteal / secs);
+		} else {
+			printf(" %14lf munmaps/sec\n", (double)ops / secs);
+			printf(" %14lf pages unmapped/sec\n\n",
+			       (double)ops * (length / page_size) / secs);
+		}
+		break;
+	case BENCH_FORMAT_SIMPLE:
+		if (reclaim)
+			printf("%lf\n", (double)pgsteal / secs);
+		else
+			printf("%lf\n", (double)ops / secs);
+		break;
+	default:
+		/* reaching this means there's some disaster: */
+		die("unknown format: %d\n", bench_format);
+		break;
+	}
+
+	return 0;
+}
@@ -52,6 +52,15 @@ static struct bench_suite mem_suites[] = {
 	{ "memcpy",
 	  "Simple memory copy in various ways",
 	  bench_mem_memcpy },
+	{ "madvise",
+	  "Memory reuse after MADV_DONTNEED or MADV_FREE",
+	  bench_mem_madvise },
+	{ "faults",
+	  "Multithreaded page faults over many mappings",
+	  bench_mem_faults },
+	{ "unmap",
+	  "Multithreaded munmap and reclaim throughput",
+	  bench_mem_unmap },
 	suite_all,
 	{ NULL,
 	  NULL,